@@ -0,0 +1,321 @@
+#include <emmintrin.h>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <algorithm>
+#include <ppl.h>
+#include "CacheComparator.h"
+#include "CacheHair.h"
+#include "Parameter.h"
+#include "wrLogger.h"
+
+namespace WR
+{
+    namespace
+    {
+        // four packed xyz particles to x, y, z registers
+        inline void loadSoA(const float* p, __m128& x, __m128& y, __m128& z)
+        {
+            __m128 r0 = _mm_loadu_ps(p);        // x0 y0 z0 x1
+            __m128 r1 = _mm_loadu_ps(p + 4);    // y1 z1 x2 y2
+            __m128 r2 = _mm_loadu_ps(p + 8);    // z2 x3 y3 z3
+
+            __m128 t0 = _mm_shuffle_ps(r1, r2, _MM_SHUFFLE(2, 1, 3, 2));  // x2 y2 x3 y3
+            __m128 t1 = _mm_shuffle_ps(r0, r1, _MM_SHUFFLE(1, 0, 2, 1));  // y0 z0 y1 z1
+            x = _mm_shuffle_ps(r0, t0, _MM_SHUFFLE(2, 0, 3, 0));
+            y = _mm_shuffle_ps(t1, t0, _MM_SHUFFLE(3, 1, 2, 0));
+            z = _mm_shuffle_ps(t1, r2, _MM_SHUFFLE(3, 0, 3, 1));
+        }
+
+        inline __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+        {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+        }
+
+        // position error |a - b| and direction error 1 - dot(da, db) of n particles
+        void particleErrors(const float* pa, const float* pb, const float* da, const float* db,
+            size_t n, float* ePos, float* eDir)
+        {
+            const __m128 one = _mm_set1_ps(1.f);
+
+            size_t k = 0;
+            for (; k + 4 <= n; k += 4)
+            {
+                __m128 ax, ay, az, bx, by, bz;
+                loadSoA(pa + 3 * k, ax, ay, az);
+                loadSoA(pb + 3 * k, bx, by, bz);
+                ax = _mm_sub_ps(ax, bx);
+                ay = _mm_sub_ps(ay, by);
+                az = _mm_sub_ps(az, bz);
+                _mm_storeu_ps(ePos + k, _mm_sqrt_ps(dot(ax, ay, az, ax, ay, az)));
+
+                if (!da || !db) continue;
+                loadSoA(da + 3 * k, ax, ay, az);
+                loadSoA(db + 3 * k, bx, by, bz);
+                _mm_storeu_ps(eDir + k, _mm_sub_ps(one, dot(ax, ay, az, bx, by, bz)));
+            }
+
+            for (; k < n; k++)
+            {
+                const float* a = pa + 3 * k, *b = pb + 3 * k;
+                float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+                ePos[k] = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+                if (!da || !db) continue;
+                a = da + 3 * k; b = db + 3 * k;
+                eDir[k] = 1.f - (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]);
+            }
+
+            if (!da || !db)
+                std::fill(eDir, eDir + n, 0.f);
+        }
+
+        struct FrameLocal
+        {
+            CacheComparator::FrameError error;
+            std::vector<size_t> posHist, dirHist;
+        };
+
+        bool readInts(std::ifstream& file, std::vector<int>& values, size_t n)
+        {
+            values.resize(n);
+            file.read(reinterpret_cast<char*>(values.data()), sizeof(int) * n);
+            return file.good();
+        }
+    }
+
+    double ErrorStat::mean() const
+    {
+        return n ? sum / n : 0.0;
+    }
+
+    double ErrorStat::rms() const
+    {
+        return n ? std::sqrt(sumSq / n) : 0.0;
+    }
+
+    bool CacheComparator::loadGroups(const char* groupFile)
+    {
+        std::ifstream file(groupFile, std::ios::binary);
+        int nStrand = 0;
+        file.read(reinterpret_cast<char*>(&nStrand), sizeof(int));
+        if (!file.is_open() || nStrand < 0 || !readInts(file, groupIndex, nStrand))
+        {
+            WR_LOG_ERROR << "cannot read group file " << groupFile;
+            groupIndex.clear();
+            return false;
+        }
+
+        // the groups index the per group statistics
+        if (std::find_if(groupIndex.begin(), groupIndex.end(), [](int g) { return g < 0; }) != groupIndex.end())
+        {
+            WR_LOG_ERROR << "negative group id in " << groupFile;
+            groupIndex.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool CacheComparator::loadGuides(const char* guideFile)
+    {
+        std::ifstream file(guideFile, std::ios::binary);
+        int nGuide = 0;
+        char skip[8];
+        file.read(reinterpret_cast<char*>(&nGuide), sizeof(int));
+        file.read(skip, 8);
+        if (!file.is_open() || nGuide < 0 || !readInts(file, guides, nGuide))
+        {
+            WR_LOG_ERROR << "cannot read guide file " << guideFile;
+            guides.clear();
+            return false;
+        }
+        return true;
+    }
+
+    bool CacheComparator::compare(const char* refFile, const char* testFile, size_t nFrame)
+    {
+        // two readers per cache, the next frame is loaded while the current one is compared
+        CacheHair20 ref[2], test[2];
+        try
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                ref[k].loadFile(refFile, true);
+                test[k].loadFile(testFile, true);
+            }
+        }
+        catch (std::exception& e)
+        {
+            WR_LOG_ERROR << "cannot read " << refFile << " or " << testFile << ": " << e.what();
+            return false;
+        }
+
+        const size_t nStrand = ref[0].n_strands();
+        if (test[0].n_strands() != nStrand)
+        {
+            WR_LOG_ERROR << "caches differ in strand number: " << nStrand << " vs " << test[0].n_strands();
+            return false;
+        }
+
+        if (!groupIndex.empty() && groupIndex.size() != nStrand)
+        {
+            WR_LOG_WARNING << "group file does not match the caches, ignored.";
+            groupIndex.clear();
+        }
+
+        isGuide.assign(nStrand, 0);
+        for (size_t i = 0; i < guides.size(); i++)
+            if (size_t(guides[i]) < nStrand) isGuide[guides[i]] = 1;
+
+        size_t n = std::min(ref[0].get_nFrame(), test[0].get_nFrame());
+        if (nFrame > 0) n = std::min(n, nFrame);
+
+        frames.clear();
+        frames.reserve(n);
+        strandPos.assign(nStrand, ErrorStat());
+        strandDir.assign(nStrand, ErrorStat());
+        posHist.assign(nBin, 0);
+        dirHist.assign(nBin, 0);
+
+        auto load = [](CacheHair* hair, size_t f){ hair->jumpTo(int(f)); };
+        load(ref, 0);
+        load(test, 0);
+        for (size_t f = 0; f < n; f++)
+        {
+            std::future<void> nextRef, nextTest;
+            if (f + 1 < n)
+            {
+                nextRef = std::async(std::launch::async, load, &ref[(f + 1) % 2], f + 1);
+                nextTest = std::async(std::launch::async, load, &test[(f + 1) % 2], f + 1);
+            }
+
+            compareFrame(&ref[f % 2], &test[f % 2]);
+
+            if (nextRef.valid()) nextRef.get();
+            if (nextTest.valid()) nextTest.get();
+        }
+
+        WR_LOG_INFO << "compared " << n << " frames of " << nStrand << " strands.";
+        return true;
+    }
+
+    void CacheComparator::compareFrame(const IHair* ref, const IHair* test)
+    {
+        const size_t nStrand = ref->n_strands();
+        const float posScale = nBin / posRange, dirScale = nBin / 2.f;
+
+        concurrency::combinable<FrameLocal> locals;
+        concurrency::parallel_for(size_t(0), nStrand, [&](size_t i)
+        {
+            FrameLocal& local = locals.local();
+            if (local.posHist.empty())
+            {
+                local.posHist.assign(nBin, 0);
+                local.dirHist.assign(nBin, 0);
+            }
+
+            float ePos[N_PARTICLES_PER_STRAND], eDir[N_PARTICLES_PER_STRAND];
+            particleErrors(ref->get_visible_particle_position(i, 0), test->get_visible_particle_position(i, 0),
+                ref->get_visible_particle_direction(i, 0), test->get_visible_particle_direction(i, 0),
+                N_PARTICLES_PER_STRAND, ePos, eDir);
+
+            double posSum = 0.0, posSq = 0.0, dirSum = 0.0, dirSq = 0.0;
+            float posMax = 0.f, dirMax = 0.f;
+            for (size_t j = 0; j < N_PARTICLES_PER_STRAND; j++)
+            {
+                posSum += ePos[j]; posSq += ePos[j] * ePos[j]; posMax = std::max(posMax, ePos[j]);
+                dirSum += eDir[j]; dirSq += eDir[j] * eDir[j]; dirMax = std::max(dirMax, eDir[j]);
+
+                local.posHist[std::min(size_t(ePos[j] * posScale), nBin - 1)]++;
+                local.dirHist[std::min(size_t(std::max(eDir[j], 0.f) * dirScale), nBin - 1)]++;
+            }
+
+            strandPos[i].add(posSum, posSq, posMax, N_PARTICLES_PER_STRAND);
+            strandDir[i].add(dirSum, dirSq, dirMax, N_PARTICLES_PER_STRAND);
+
+            local.error.pos.add(posSum, posSq, posMax, N_PARTICLES_PER_STRAND);
+            local.error.dir.add(dirSum, dirSq, dirMax, N_PARTICLES_PER_STRAND);
+            if (isGuide[i])
+                local.error.guidePos.add(posSum, posSq, posMax, N_PARTICLES_PER_STRAND);
+        });
+
+        FrameError frame;
+        locals.combine_each([&](const FrameLocal& local)
+        {
+            frame.pos.merge(local.error.pos);
+            frame.dir.merge(local.error.dir);
+            frame.guidePos.merge(local.error.guidePos);
+            for (size_t b = 0; b < local.posHist.size(); b++)
+            {
+                posHist[b] += local.posHist[b];
+                dirHist[b] += local.dirHist[b];
+            }
+        });
+        frames.push_back(frame);
+    }
+
+    bool CacheComparator::writeSummary(const char* prefix) const
+    {
+        std::string name(prefix);
+        std::ofstream file(name + "_frames.csv");
+        if (!file.is_open())
+        {
+            WR_LOG_ERROR << "cannot write " << name << "_frames.csv";
+            return false;
+        }
+
+        file << "frame,pos_mean,pos_rms,pos_max,dir_mean,dir_max,guide_pos_rms,guide_pos_max\n";
+        for (size_t f = 0; f < frames.size(); f++)
+        {
+            auto& e = frames[f];
+            file << f << ',' << e.pos.mean() << ',' << e.pos.rms() << ',' << e.pos.maxVal << ','
+                << e.dir.mean() << ',' << e.dir.maxVal << ',' << e.guidePos.rms() << ',' << e.guidePos.maxVal << '\n';
+        }
+        file.close();
+
+        file.open(name + "_strands.csv");
+        file << "strand,group,guide,pos_mean,pos_rms,pos_max,dir_mean,dir_max\n";
+        for (size_t i = 0; i < strandPos.size(); i++)
+        {
+            file << i << ',' << (groupIndex.empty() ? -1 : groupIndex[i]) << ',' << int(isGuide[i]) << ','
+                << strandPos[i].mean() << ',' << strandPos[i].rms() << ',' << strandPos[i].maxVal << ','
+                << strandDir[i].mean() << ',' << strandDir[i].maxVal << '\n';
+        }
+        file.close();
+
+        if (!groupIndex.empty())
+        {
+            size_t nGroup = std::max(guides.size(), size_t(*std::max_element(groupIndex.begin(), groupIndex.end()) + 1));
+            std::vector<ErrorStat> groupPos(nGroup), groupDir(nGroup);
+            std::vector<size_t> groupSize(nGroup, 0);
+            for (size_t i = 0; i < strandPos.size(); i++)
+            {
+                groupPos[groupIndex[i]].merge(strandPos[i]);
+                groupDir[groupIndex[i]].merge(strandDir[i]);
+                groupSize[groupIndex[i]]++;
+            }
+
+            file.open(name + "_groups.csv");
+            file << "group,n_strand,guide,pos_mean,pos_rms,pos_max,dir_mean,dir_max\n";
+            for (size_t g = 0; g < nGroup; g++)
+            {
+                file << g << ',' << groupSize[g] << ',' << (g < guides.size() ? guides[g] : -1) << ','
+                    << groupPos[g].mean() << ',' << groupPos[g].rms() << ',' << groupPos[g].maxVal << ','
+                    << groupDir[g].mean() << ',' << groupDir[g].maxVal << '\n';
+            }
+            file.close();
+        }
+
+        file.open(name + "_hist.csv");
+        file << "pos_lo,pos_hi,pos_count,dir_lo,dir_hi,dir_count\n";
+        const float posWidth = posRange / nBin, dirWidth = 2.f / nBin;
+        for (size_t b = 0; b < nBin; b++)
+        {
+            file << b * posWidth << ',' << (b + 1 == nBin ? INFINITY : (b + 1) * posWidth) << ',' << posHist[b] << ','
+                << b * dirWidth << ',' << (b + 1) * dirWidth << ',' << dirHist[b] << '\n';
+        }
+        file.close();
+
+        return true;
+    }
+}
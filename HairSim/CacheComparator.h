@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+
+namespace WR
+{
+    class IHair;
+
+    struct ErrorStat
+    {
+        double  sum = 0.0;
+        double  sumSq = 0.0;
+        float   maxVal = 0.f;
+        size_t  n = 0;
+
+        void add(double s, double sq, float m, size_t count)
+        {
+            sum += s; sumSq += sq; n += count;
+            if (m > maxVal) maxVal = m;
+        }
+        void merge(const ErrorStat& other) { add(other.sum, other.sumSq, other.maxVal, other.n); }
+        double mean() const;
+        double rms() const;
+    };
+
+    // Streams two .anim2 caches in lockstep and measures how far the second one
+    // deviates from the first (the ground truth): position error |p - p0| and
+    // direction error 1 - dot(d, d0), aggregated per strand, per group (.group),
+    // for the guides (.guide) and per frame, plus histograms over all particles.
+    class CacheComparator
+    {
+    public:
+        CacheComparator(float posRange = 0.05f, size_t nBin = 64) :
+            posRange(posRange), nBin(nBin){}
+
+        bool loadGroups(const char* groupFile);
+        bool loadGuides(const char* guideFile);
+
+        // compares at most nFrame frames (0 means all frames both caches have)
+        bool compare(const char* refFile, const char* testFile, size_t nFrame = 0);
+
+        // writes <prefix>_frames.csv, _groups.csv, _strands.csv and _hist.csv
+        bool writeSummary(const char* prefix) const;
+
+        struct FrameError
+        {
+            ErrorStat pos, dir, guidePos;
+        };
+
+        const std::vector<FrameError>& get_frameErrors() const { return frames; }
+        const std::vector<ErrorStat>& get_strandPosErrors() const { return strandPos; }
+        const std::vector<ErrorStat>& get_strandDirErrors() const { return strandDir; }
+
+    private:
+        void compareFrame(const IHair* ref, const IHair* test);
+
+        float   posRange;
+        size_t  nBin;
+
+        std::vector<int> groupIndex;    // strand -> group
+        std::vector<int> guides;        // group -> guide strand
+        std::vector<char> isGuide;
+
+        std::vector<FrameError> frames;
+        std::vector<ErrorStat> strandPos, strandDir;
+        std::vector<size_t> posHist, dirHist;
+    };
+}
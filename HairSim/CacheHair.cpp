@@ -1,12 +1,35 @@
 #include <exception>
 #include <string>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <ppl.h>
 #include "CacheHair.h"
+#include "wrSpline.h"
+#include "wrLogger.h"
 
 
 namespace WR
 {
     const float max_fps = 0.03;
 
+    // strands skipped between two selected ones before a new range is started;
+    // reading a few unused strands is cheaper than another seek
+    const size_t max_range_gap = 4;
+
+    namespace
+    {
+        // of nStrand strands, the ones at the given buffer slots if there are any
+        void computeDirections(const float* pos, float* dir, size_t nStrand, const size_t* slots = nullptr)
+        {
+            concurrency::parallel_for(size_t(0), nStrand, [pos, dir, slots](size_t i)
+            {
+                size_t offset = (slots ? slots[i] : i) * N_PARTICLES_PER_STRAND * 3;
+                computeStrandDirections(pos + offset, N_PARTICLES_PER_STRAND, dir + offset);
+            });
+        }
+    }
+
     CacheHair::~CacheHair()
     {
         SAFE_DELETE_ARRAY(position);
@@ -22,7 +45,7 @@ namespace WR
         np = *reinterpret_cast<int*>(bytes);
     }
 
-    void CacheHair::BinaryHelper::readFrame20(float* rigidTrans, float* pos, float* dir, size_t np)
+    void CacheHair::BinaryHelper::readFrame20(float* rigidTrans, float* pos, float* dir, size_t np, bool bDir)
     {
         char* bytes = reinterpret_cast<char*>(rigidTrans);
         file.read(bytes, sizeof(float)*16);
@@ -30,8 +53,15 @@ namespace WR
         bytes = reinterpret_cast<char*>(pos);
         file.read(bytes, sizeof(float)*np * 3);
 
-        bytes = reinterpret_cast<char*>(dir);
-        file.read(bytes, sizeof(float)*np * 3);
+        if (!bDir) return;
+
+        if (dir)
+        {
+            bytes = reinterpret_cast<char*>(dir);
+            file.read(bytes, sizeof(float)*np * 3);
+        }
+        else
+            file.seekg(std::streamoff(sizeof(float)*np * 3), std::ios::cur);
     }
 
     void CacheHair::BinaryHelper::readFrame(float* pos, size_t np)
@@ -40,6 +70,36 @@ namespace WR
         file.read(bytes, sizeof(float)*np*3);
     }
 
+    void CacheHair::BinaryHelper::readRanges(float* dst, size_t np, const std::vector<StrandRange>& ranges)
+    {
+        const size_t strandBytes = sizeof(float) * 3 * N_PARTICLES_PER_STRAND;
+        const std::streampos block = file.tellg();
+
+        char* bytes = reinterpret_cast<char*>(dst);
+        for (size_t i = 0; dst && i < ranges.size(); i++)
+        {
+            file.seekg(block + std::streamoff(ranges[i].first * strandBytes));
+            file.read(bytes, ranges[i].count * strandBytes);
+            bytes += ranges[i].count * strandBytes;
+        }
+        file.seekg(block + std::streamoff(sizeof(float) * 3 * np));
+    }
+
+    void CacheHair::BinaryHelper::readFrameRanges(float* pos, size_t np, const std::vector<StrandRange>& ranges)
+    {
+        readRanges(pos, np, ranges);
+    }
+
+    void CacheHair::BinaryHelper::readFrame20Ranges(float* rigidTrans, float* pos, float* dir, size_t np, bool bDir, const std::vector<StrandRange>& ranges)
+    {
+        char* bytes = reinterpret_cast<char*>(rigidTrans);
+        file.read(bytes, sizeof(float) * 16);
+
+        readRanges(pos, np, ranges);
+        if (bDir)
+            readRanges(dir, np, ranges);
+    }
+
     bool CacheHair::BinaryHelper::hasNextFrame(size_t &id)
     {
         char bytes[4];
@@ -96,20 +156,84 @@ namespace WR
             helper = new AsciiHelper(file);
         }
         if (!file.is_open()) throw std::exception("file not found!");
+        this->fileName = fileName;
 
         helper->init(m_nFrame, m_nParticle);
 
-        position = new float[3 * m_nParticle];
+        CacheHair::allocBuffers(m_nParticle);
         firstFrame = file.tellg();
+        set_curFrame(0);
+        nextRead = 0;
         bNextFrame = true;
         return true;
     }
 
+    void CacheHair::allocBuffers(size_t np)
+    {
+        SAFE_DELETE_ARRAY(position);
+        position = new float[3 * np]();
+    }
+
+    bool CacheHair::selectStrands(const std::vector<size_t>& strandIds)
+    {
+        if (!dynamic_cast<BinaryHelper*>(helper))
+        {
+            WR_LOG_ERROR << "strand subset is only supported for binary caches.";
+            return false;
+        }
+
+        const size_t nStrand = get_nParticle() / N_PARTICLES_PER_STRAND;
+        std::vector<size_t> ids(strandIds);
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        if (ids.empty() || ids.back() >= nStrand)
+        {
+            WR_LOG_ERROR << "invalid strand subset.";
+            return false;
+        }
+
+        ranges.clear();
+        slots.resize(ids.size());
+        size_t nBuffered = 0;
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            if (ranges.empty() || ids[i] > ranges.back().first + ranges.back().count + max_range_gap)
+            {
+                StrandRange r = { ids[i], 1 };
+                ranges.push_back(r);
+                nBuffered++;
+            }
+            else
+            {
+                size_t end = ids[i] + 1;
+                nBuffered += end - (ranges.back().first + ranges.back().count);
+                ranges.back().count = end - ranges.back().first;
+            }
+            slots[i] = nBuffered - 1;
+        }
+        selected.swap(ids);
+
+        allocBuffers(nBuffered * N_PARTICLES_PER_STRAND);
+
+        WR_LOG_INFO << "strand subset: " << selected.size() << " strands in " << ranges.size()
+            << " ranges, " << nBuffered << "/" << nStrand << " strands read per frame.";
+        return true;
+    }
+
+    void CacheHair::selectAllStrands()
+    {
+        ranges.clear();
+        selected.clear();
+        slots.clear();
+        allocBuffers(get_nParticle());
+    }
+
     void CacheHair::rewind()
     {
         file.clear();
         file.seekg(firstFrame);
         set_curFrame(0);
+        nextRead = 0;
     }
 
     size_t CacheHair::getFrameNumber() const
@@ -124,12 +248,14 @@ namespace WR
 
     size_t CacheHair::n_strands() const
     {
+        if (isSubset())
+            return selected.size();
         return get_nParticle() / N_PARTICLES_PER_STRAND;
     }
 
     const float* CacheHair::get_visible_particle_position(size_t i, size_t j) const
     {
-        return position + (i*N_PARTICLES_PER_STRAND+j)*3;
+        return position + (bufferStrand(i)*N_PARTICLES_PER_STRAND+j)*3;
     }
 
     void CacheHair::onFrame(Mat3 world, float fTime, float fTimeElapsed, void*)
@@ -157,13 +283,18 @@ namespace WR
 
     void CacheHair::readFrame()
     {
-        helper->readFrame(position, get_nParticle());
-        set_curFrame(get_curFrame() + 1);
+        if (isSubset())
+            helper->readFrameRanges(position, get_nParticle(), ranges);
+        else
+            helper->readFrame(position, get_nParticle());
+        set_curFrame(nextRead++);
     }
 
     bool CacheHair::hasNextFrame()
     {
-        return helper->hasNextFrame(m_curFrame);
+        // the frames are counted as read, whatever ids the file gives them
+        size_t id;
+        return helper->hasNextFrame(id);
     }
 
     bool CacheHair20::loadFile(const char* fileName, bool binary)
@@ -174,24 +305,68 @@ namespace WR
             direction = new float[3 * get_nParticle()];
             rigidTrans = new float[16];
         }
+
+        // caches without the direction block are recognised by their size
+        if (result && binary)
+        {
+            file.seekg(0, std::ios::end);
+            std::streamoff size = file.tellg() - firstFrame;
+            file.seekg(firstFrame);
+
+            const std::streamoff posOnly = sizeof(int) + sizeof(float) * (16 + 3 * get_nParticle());
+            bDirStored = size != std::streamoff(get_nFrame()) * posOnly;
+            if (!bDirStored)
+                WR_LOG_INFO << fileName << " has no direction block, directions are recomputed.";
+
+            prefetchFile.open(fileName, std::ios::binary);
+        }
         return result;
     }
 
+    size_t CacheHair20::frameBytes() const
+    {
+        return sizeof(int) + sizeof(float) * (16 + 3 * get_nParticle() * (bDirStored ? 2 : 1));
+    }
+
+    void CacheHair20::readFrameData()
+    {
+        bool bCompute = !bDirStored || get_bRecomputeDirection();
+        float* dir = bCompute ? nullptr : direction;
+
+        if (isSubset())
+            helper->readFrame20Ranges(rigidTrans, position, dir, get_nParticle(), bDirStored, ranges);
+        else
+            helper->readFrame20(rigidTrans, position, dir, get_nParticle(), bDirStored);
+
+        if (bCompute)
+            computeDirections(position, direction, n_strands(), isSubset() ? slots.data() : nullptr);
+    }
+
+    void CacheHair20::allocBuffers(size_t np)
+    {
+        CacheHair::allocBuffers(np);
+        SAFE_DELETE_ARRAY(direction);
+        direction = new float[3 * np]();
+    }
+
     CacheHair20::~CacheHair20()
     {
+        if (prefetchTask.valid())
+            prefetchTask.wait();
+
         SAFE_DELETE_ARRAY(direction);
         SAFE_DELETE_ARRAY(rigidTrans);
     }
 
     void CacheHair20::readFrame()
     { 
-        helper->readFrame20(rigidTrans, position, direction, get_nParticle());
-        set_curFrame(get_curFrame() + 1);
+        readFrameData();
+        set_curFrame(nextRead++);
     }
 
     const float* CacheHair20::get_visible_particle_direction(size_t i, size_t j) const
     {
-        return direction + (i*N_PARTICLES_PER_STRAND + j) * 3;
+        return direction + (bufferStrand(i)*N_PARTICLES_PER_STRAND + j) * 3;
     }
 
     const float* CacheHair20::get_rigidMotionMatrix() const
@@ -202,15 +377,95 @@ namespace WR
     void  CacheHair::jumpTo(int frameNo)
     {
         set_curFrame(frameNo);
+        nextRead = frameNo + 1;
         jumpTo();
     }
+
+    void CacheHair::stepForward()
+    {
+        if (!get_nFrame()) return;
+        jumpTo(int((get_curFrame() + 1) % get_nFrame()));
+    }
+
+    void CacheHair::stepBackward()
+    {
+        if (!get_nFrame()) return;
+        jumpTo(int((get_curFrame() + get_nFrame() - 1) % get_nFrame()));
+    }
+
+    FrameCache::FramePtr CacheHair20::loadFrame(std::ifstream& in, size_t frameNo)
+    {
+        auto frame = pFrameCache->get(fileName, frameNo);
+        if (frame) return frame;
+
+        const size_t np = get_nParticle();
+        auto data = std::make_shared<std::vector<float>>(16 + 6 * np);
+        float* rigid = data->data(), *pos = rigid + 16, *dir = pos + 3 * np;
+
+        in.clear();
+        in.seekg(firstFrame + std::streamoff(frameNo * frameBytes()));
+
+        BinaryHelper reader(in);
+        size_t id;
+        if (!reader.hasNextFrame(id)) return nullptr;
+
+        bool bCompute = !bDirStored || get_bRecomputeDirection();
+        reader.readFrame20(rigid, pos, bCompute ? nullptr : dir, np, bDirStored);
+        if (!in) return nullptr;
+
+        if (bCompute)
+            computeDirections(pos, dir, np / N_PARTICLES_PER_STRAND);
+
+        pFrameCache->put(fileName, frameNo, data);
+        return data;
+    }
+
+    void CacheHair20::prefetchNeighbours()
+    {
+        if (prefetchTask.valid())
+        {
+            // still busy with the previous neighbours, the next jump will catch up
+            if (prefetchTask.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                return;
+            prefetchTask.get();
+        }
+
+        const size_t nf = get_nFrame();
+        size_t next = (get_curFrame() + 1) % nf, prev = (get_curFrame() + nf - 1) % nf;
+        if (pFrameCache->contains(fileName, next) && pFrameCache->contains(fileName, prev))
+            return;
+
+        prefetchTask = std::async(std::launch::async, [this, next, prev]()
+        {
+            loadFrame(prefetchFile, next);
+            loadFrame(prefetchFile, prev);
+        });
+    }
     
     void CacheHair20::jumpTo()
     {
-        file.seekg(firstFrame + std::streamoff(get_curFrame()*(sizeof(int)+
-            sizeof(float)*(16 + 3 * 2 * get_nParticle()))));
+        // subsets have their own buffer layout and bypass the frame cache
+        if (pFrameCache && !isSubset() && prefetchFile.is_open())
+        {
+            auto frame = loadFrame(file, get_curFrame());
+            if (frame)
+            {
+                const size_t np = get_nParticle();
+                memcpy(rigidTrans, frame->data(), sizeof(float) * 16);
+                memcpy(position, frame->data() + 16, sizeof(float) * 3 * np);
+                memcpy(direction, frame->data() + 16 + 3 * np, sizeof(float) * 3 * np);
+
+                // playback continues right after this frame
+                file.clear();
+                file.seekg(firstFrame + std::streamoff((get_curFrame() + 1) * frameBytes()));
+                prefetchNeighbours();
+                return;
+            }
+        }
+
+        file.seekg(firstFrame + std::streamoff(get_curFrame()*frameBytes()));
         if (hasNextFrame())
-            helper->readFrame20(rigidTrans, position, direction, get_nParticle());
+            readFrameData();
     }
 
 }
\ No newline at end of file
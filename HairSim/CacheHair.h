@@ -1,8 +1,11 @@
 #pragma once
 #include <vector>
 #include <fstream>
+#include <future>
+#include <string>
 
 #include "IHair.h"
+#include "FrameCache.h"
 #include "Parameter.h"
 #include "wrMacro.h"
 
@@ -19,12 +22,22 @@ namespace WR
         COMMON_PROPERTY(size_t, curFrame);
 
     protected:
+        // a run of consecutive strands as they are laid out in the file
+        struct StrandRange
+        {
+            size_t first;
+            size_t count;
+        };
+
         class IHelper
         {
         public:
             virtual void init(size_t &nf, size_t &np) = 0;
             virtual void readFrame(float* pos, size_t np) = 0;
-            virtual void readFrame20(float* rigidTrans, float* pos, float* dir, size_t np){ assert(0); }
+            // dir == nullptr skips a stored direction block, bDir tells whether the frame has one
+            virtual void readFrame20(float* rigidTrans, float* pos, float* dir, size_t np, bool bDir){ assert(0); }
+            virtual void readFrameRanges(float* pos, size_t np, const std::vector<StrandRange>& ranges){ assert(0); }
+            virtual void readFrame20Ranges(float* rigidTrans, float* pos, float* dir, size_t np, bool bDir, const std::vector<StrandRange>& ranges){ assert(0); }
             virtual bool hasNextFrame(size_t &id) = 0;
         };
 
@@ -50,10 +63,16 @@ namespace WR
 
             void init(size_t &nf, size_t &np);
             void readFrame(float* pos, size_t np);
-            void readFrame20(float* rigidTrans, float* pos, float* dir, size_t np);
+            void readFrame20(float* rigidTrans, float* pos, float* dir, size_t np, bool bDir);
+            void readFrameRanges(float* pos, size_t np, const std::vector<StrandRange>& ranges);
+            void readFrame20Ranges(float* rigidTrans, float* pos, float* dir, size_t np, bool bDir, const std::vector<StrandRange>& ranges);
             bool hasNextFrame(size_t &id);
 
         private:
+            // reads the requested strands of one np*3 float block (skips it if dst is nullptr),
+            // leaves the stream at the end of the block
+            void readRanges(float* dst, size_t np, const std::vector<StrandRange>& ranges);
+
             std::ifstream& file;
         };
 
@@ -67,6 +86,16 @@ namespace WR
         size_t getFrameNumber() const;
         size_t getCurrentFrame() const;
         void jumpTo(int frameNo);
+        void stepForward();
+        void stepBackward();
+
+        // restrict the reader to the given strands (binary caches only). Ids are file strand ids,
+        // duplicates are ignored and the subset is exposed in ascending id order through IHair.
+        // Takes effect from the next frame read.
+        bool selectStrands(const std::vector<size_t>& strandIds);
+        void selectAllStrands();
+        bool isSubset() const { return !ranges.empty(); }
+        size_t get_file_strand_id(size_t i) const { return isSubset() ? selected[i] : i; }
 
         virtual size_t n_strands() const;
         virtual const float* get_visible_particle_position(size_t i, size_t j) const;
@@ -75,32 +104,63 @@ namespace WR
     protected:
         virtual void jumpTo(){}
         virtual void readFrame();
+        virtual void allocBuffers(size_t np);
         bool hasNextFrame();
+        size_t bufferStrand(size_t i) const { return isSubset() ? slots[i] : i; }
 
+        std::string fileName;
         std::streampos firstFrame = 0;
         std::ifstream file;
         bool bNextFrame = false;
+        // curFrame is the frame shown, this the one the stream reads next
+        size_t nextRead = 0;
         float* position = nullptr;
 
         IHelper* helper = nullptr;
         float timeBuffer = 0.f;
+
+        // strand subset: coalesced file ranges, selected file ids and their strand slot in the buffers
+        std::vector<StrandRange> ranges;
+        std::vector<size_t> selected;
+        std::vector<size_t> slots;
     };
 
     class CacheHair20 :
         public CacheHair
     {
+        // recompute the directions from the positions even if the cache stores them
+        COMMON_PROPERTY(bool, bRecomputeDirection);
+
     public:
+        CacheHair20(){ m_bRecomputeDirection = false; }
         ~CacheHair20();
 
         bool loadFile(const char* fileName, bool binary = true);
         const float* get_visible_particle_direction(size_t i, size_t j) const;
         const float* get_rigidMotionMatrix() const;
 
+        // optional shared cache of decoded frames used by jumpTo, not owned
+        void setFrameCache(FrameCache* cache) { pFrameCache = cache; }
+
     protected:
         void readFrame();
         void jumpTo();
+        void allocBuffers(size_t np);
+        void readFrameData();
+        size_t frameBytes() const;
 
+        // decoded frame (rigid motion, positions, directions) from the frame cache or from the stream
+        FrameCache::FramePtr loadFrame(std::ifstream& in, size_t frameNo);
+        void prefetchNeighbours();
+
+        // false for caches written without the direction block
+        bool bDirStored = true;
+        FrameCache* pFrameCache = nullptr;
         float* direction = nullptr;
         float* rigidTrans = nullptr;
+
+        // the prefetch task owns its own stream
+        std::ifstream prefetchFile;
+        std::future<void> prefetchTask;
     };
 }
\ No newline at end of file
@@ -0,0 +1,198 @@
+#include <cstring>
+#include <algorithm>
+#include "CacheWriter.h"
+#include "CacheHair.h"
+#include "Parameter.h"
+#include "wrLogger.h"
+
+namespace WR
+{
+    CacheWriter::~CacheWriter()
+    {
+        if (is_open()) close();
+    }
+
+    size_t CacheWriter::frameSize() const
+    {
+        size_t size = sizeof(int) + sizeof(float) * 3 * nParticle;
+        if (format != ANIM)
+            size += sizeof(float) * 16;
+        if (format == ANIM2)
+            size += sizeof(float) * 3 * nParticle;
+        return size;
+    }
+
+    bool CacheWriter::open(const char* fileName, size_t nStrand, Format fmt)
+    {
+        if (is_open()) close();
+
+        file.open(fileName, std::ios::binary);
+        if (!file.is_open())
+        {
+            WR_LOG_ERROR << "cannot open " << fileName << " for writing.";
+            return false;
+        }
+
+        format = fmt;
+        nParticle = nStrand * N_PARTICLES_PER_STRAND;
+        nFrame = 0;
+
+        // the frame count is unknown yet and gets patched in close()
+        int header[2] = { 0, int(nParticle) };
+        file.write(reinterpret_cast<char*>(header), sizeof(header));
+
+        size_t nFramePerChunk = std::max<size_t>(1, m_chunkSize / frameSize());
+        front.resize(nFramePerChunk * frameSize());
+        back.resize(front.size());
+        frontUsed = backUsed = 0;
+
+        bQuit = bFailed = false;
+        writer = std::thread(&CacheWriter::run, this);
+        return true;
+    }
+
+    bool CacheWriter::writeFrame(const IHair* hair, int frameId)
+    {
+        if (!is_open() || hair->n_strands() * N_PARTICLES_PER_STRAND != nParticle)
+        {
+            WR_LOG_ERROR << "frame does not match the opened cache.";
+            return false;
+        }
+
+        if (frontUsed + frameSize() > front.size())
+            flush();
+
+        char* p = &front[frontUsed];
+        int id = frameId < 0 ? int(nFrame) : frameId;
+        memcpy(p, &id, sizeof(int));
+        p += sizeof(int);
+
+        const size_t nStrand = hair->n_strands();
+        if (format != ANIM)
+        {
+            static const float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+            const float* rigid = hair->get_rigidMotionMatrix();
+            memcpy(p, rigid ? rigid : identity, sizeof(float) * 16);
+            p += sizeof(float) * 16;
+        }
+
+        // strands go back to the order the hair was loaded in
+        const size_t strandSize = sizeof(float) * 3 * N_PARTICLES_PER_STRAND;
+        for (size_t i = 0; i < nStrand; i++)
+        {
+            char* s = p + hair->get_original_strand_id(i) * strandSize;
+            for (size_t j = 0; j < N_PARTICLES_PER_STRAND; j++, s += sizeof(float) * 3)
+                memcpy(s, hair->get_visible_particle_position(i, j), sizeof(float) * 3);
+        }
+        p += nStrand * strandSize;
+
+        if (format == ANIM2)
+        {
+            for (size_t i = 0; i < nStrand; i++)
+            {
+                char* s = p + hair->get_original_strand_id(i) * strandSize;
+                for (size_t j = 0; j < N_PARTICLES_PER_STRAND; j++, s += sizeof(float) * 3)
+                {
+                    const float* dir = hair->get_visible_particle_direction(i, j);
+                    if (dir) memcpy(s, dir, sizeof(float) * 3);
+                    else memset(s, 0, sizeof(float) * 3);
+                }
+            }
+        }
+
+        frontUsed += frameSize();
+        nFrame++;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        return !bFailed;
+    }
+
+    void CacheWriter::flush()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this]{ return backUsed == 0; });
+
+        front.swap(back);
+        backUsed = frontUsed;
+        frontUsed = 0;
+        cv.notify_all();
+    }
+
+    void CacheWriter::run()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (true)
+        {
+            cv.wait(lock, [this]{ return backUsed > 0 || bQuit; });
+            if (backUsed == 0) break;
+
+            size_t n = backUsed;
+            lock.unlock();
+            file.write(back.data(), n);
+            bool ok = file.good();
+            lock.lock();
+
+            if (!ok) bFailed = true;
+            backUsed = 0;
+            cv.notify_all();
+        }
+    }
+
+    bool CacheWriter::close()
+    {
+        if (!is_open()) return false;
+
+        if (frontUsed > 0)
+            flush();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            bQuit = true;
+        }
+        cv.notify_all();
+        writer.join();
+
+        int n = int(nFrame);
+        file.seekp(0);
+        file.write(reinterpret_cast<char*>(&n), sizeof(int));
+        bool ok = !bFailed && file.good();
+        file.close();
+
+        std::vector<char>().swap(front);
+        std::vector<char>().swap(back);
+
+        if (!ok) WR_LOG_ERROR << "failed writing the cache.";
+        else WR_LOG_INFO << "cache closed, " << nFrame << " frames written.";
+        return ok;
+    }
+
+    bool transcodeCache(const char* inFile, const char* outFile, CacheWriter::Format format)
+    {
+        CacheHair20 hair;
+        try
+        {
+            if (!hair.loadFile(inFile, true))
+                return false;
+        }
+        catch (std::exception& e)
+        {
+            WR_LOG_ERROR << "cannot read " << inFile << ": " << e.what();
+            return false;
+        }
+
+        CacheWriter writer;
+        if (!writer.open(outFile, hair.n_strands(), format))
+            return false;
+
+        CacheHair* pFrames = &hair;
+        for (size_t f = 0; f < hair.getFrameNumber(); f++)
+        {
+            pFrames->jumpTo(int(f));
+            if (!writer.writeFrame(&hair, int(f)))
+            {
+                writer.close();
+                return false;
+            }
+        }
+        return writer.close();
+    }
+}
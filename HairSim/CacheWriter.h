@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace WR
+{
+    class IHair;
+
+    // Streams the frames of any IHair into a .anim/.anim2 cache.
+    // Frames are packed into large chunks; a full chunk is handed to a background
+    // thread and written with a single call while the producer fills the other one.
+    // The frame count in the header is patched when the file is closed.
+    class CacheWriter
+    {
+    public:
+        // ANIM2_NO_DIRECTION drops the direction block, CacheHair20 recomputes it on load
+        enum Format { ANIM, ANIM2, ANIM2_NO_DIRECTION };
+
+        CacheWriter(size_t chunkSize = 8 << 20) :m_chunkSize(chunkSize){}
+        ~CacheWriter();
+
+        bool open(const char* fileName, size_t nStrand, Format format = ANIM2);
+        bool writeFrame(const IHair* hair, int frameId = -1);
+        bool close();
+
+        bool is_open() const { return file.is_open(); }
+        size_t get_nFrame() const { return nFrame; }
+
+    private:
+        void run();
+        void flush();
+        size_t frameSize() const;
+
+        std::ofstream file;
+        Format format = ANIM2;
+        size_t nParticle = 0;
+        size_t nFrame = 0;
+        size_t m_chunkSize;
+
+        // front is filled by the producer, back is owned by the writer thread while backUsed > 0
+        std::vector<char> front, back;
+        size_t frontUsed = 0, backUsed = 0;
+
+        std::thread writer;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool bQuit = false;
+        bool bFailed = false;
+    };
+
+    // rewrites every frame of the binary .anim2 cache inFile into outFile, e.g.
+    // to drop the direction block or to store the one computed on load
+    bool transcodeCache(const char* inFile, const char* outFile, CacheWriter::Format format = CacheWriter::ANIM2);
+}
@@ -0,0 +1,392 @@
+#include "DXUT.h"
+#include "ColliderBenchmark.h"
+#include "CacheComparator.h"
+#include "CacheHair.h"
+#include "CompoundCollisionObject.h"
+#include "LevelSet.h"
+#include "Parameter.h"
+#include "wrLogger.h"
+#include "wrMath.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <ppl.h>
+
+namespace
+{
+#define LATENCY_CHUNK 32
+// a chunk of the body collision, 32 strands without their roots
+#define BATCH_SIZE 768
+#define DEFAULT_GRID_RES 256
+#define N_SURFACE_QUERIES 50000
+#define MAX_CACHE_QUERIES 200000
+// sideways bend of the deformable mesh in parts of the mesh extent, within
+// the grid margin of createDeformableCollisionObject
+#define BEND_AMPLITUDE 0.05f
+
+    const char* QUERY_NAMES[] = { "distance", "correlation", "batch" };
+
+    // offsets of the surface queries in parts of the mesh extent
+    const float SURFACE_OFFSETS[] = { -0.01f, 0.f, 0.01f, 0.05f };
+}
+
+namespace WR
+{
+    typedef ICollisionObject::Point_3 Point_3;
+
+    ColliderBenchmark::ColliderBenchmark(const DistanceFunc& exact, float thresh) :
+        exact(exact), thresh(thresh)
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        nsPerTick = 1e9 / double(freq.QuadPart);
+    }
+
+    void ColliderBenchmark::add_collider(const char* name, const ICollisionObject* pCollider)
+    {
+        colliders.push_back(std::make_pair(std::string(name), pCollider));
+    }
+
+    void ColliderBenchmark::add_surface_queries(const char* name, const float* positions, const unsigned* indices, size_t nTriangles,
+        float offset, size_t n, unsigned seed)
+    {
+        // cumulative areas, twice over
+        std::vector<double> area(nTriangles + 1, 0.0);
+        for (size_t t = 0; t < nTriangles; t++)
+        {
+            const float* v0 = positions + 3 * indices[3 * t];
+            const float* v1 = positions + 3 * indices[3 * t + 1];
+            const float* v2 = positions + 3 * indices[3 * t + 2];
+            Vec3 e0(v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]);
+            Vec3 e1(v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]);
+            area[t + 1] = area[t] + e0.cross(e1).norm();
+        }
+
+        QuerySet set;
+        set.name = name;
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (size_t i = 0; i < n; i++)
+        {
+            size_t t = std::upper_bound(area.begin(), area.end(), uniform(gen) * area.back()) - area.begin() - 1;
+            t = std::min(t, nTriangles - 1);
+
+            const float* v0 = positions + 3 * indices[3 * t];
+            const float* v1 = positions + 3 * indices[3 * t + 1];
+            const float* v2 = positions + 3 * indices[3 * t + 2];
+            Vec3 e0(v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]);
+            Vec3 e1(v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]);
+            Vec3 normal = e0.cross(e1).normalized();
+
+            // uniform over the triangle
+            float r = float(std::sqrt(uniform(gen))), s = float(uniform(gen));
+            Vec3 p = Vec3(v0[0], v0[1], v0[2]) + r * (1.f - s) * e0 + r * s * e1 + offset * normal;
+            for (int d = 0; d < 3; d++)
+                set.pos[d].push_back(p[d]);
+        }
+        add_query_set(set);
+    }
+
+    bool ColliderBenchmark::add_cache_queries(const char* name, const char* cacheFile, size_t maxQueries)
+    {
+        CacheHair20 hair;
+        try
+        {
+            if (!hair.loadFile(cacheFile, true))
+                return false;
+        }
+        catch (std::exception& e)
+        {
+            WR_LOG_ERROR << "cannot read " << cacheFile << ": " << e.what();
+            return false;
+        }
+
+        QuerySet set;
+        set.name = name;
+        size_t count = 0;
+        CacheHair* pFrames = &hair;
+        for (size_t f = 0; f < hair.getFrameNumber() && count < maxQueries; f++)
+        {
+            pFrames->jumpTo(int(f));
+            const float* m = hair.get_rigidMotionMatrix();
+            const float R[9] = { m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10] };
+            const float t[3] = { m[3], m[7], m[11] };
+            const RigidTransform xf(R, t);
+
+            // the roots are not collided
+            for (size_t i = 0; i < hair.n_strands() && count < maxQueries; i++)
+            {
+                for (size_t j = 1; j < N_PARTICLES_PER_STRAND && count < maxQueries; j++, count++)
+                {
+                    float q[3];
+                    xf.to_local(hair.get_visible_particle_position(i, j), q);
+                    for (int d = 0; d < 3; d++)
+                        set.pos[d].push_back(q[d]);
+                }
+            }
+        }
+        add_query_set(set);
+        return true;
+    }
+
+    void ColliderBenchmark::add_query_set(QuerySet& set)
+    {
+        const size_t n = set.pos[0].size();
+        set.exact.resize(n);
+        concurrency::parallel_for(size_t(0), n, [this, &set](size_t i)
+        {
+            set.exact[i] = exact(Point_3(set.pos[0][i], set.pos[1][i], set.pos[2][i]));
+        });
+
+        querySets.push_back(QuerySet());
+        std::swap(querySets.back(), set);
+    }
+
+    void ColliderBenchmark::warm_up(const ICollisionObject* pCollider) const
+    {
+        for (auto& set : querySets)
+        {
+            concurrency::parallel_for(size_t(0), set.exact.size(), [pCollider, &set](size_t i)
+            {
+                pCollider->query_distance(Point_3(set.pos[0][i], set.pos[1][i], set.pos[2][i]));
+            });
+        }
+    }
+
+    void ColliderBenchmark::run(bool bParallel)
+    {
+        results.clear();
+        for (auto& collider : colliders)
+        {
+            for (auto& set : querySets)
+            {
+                for (int q = 0; q < N_QUERY; q++)
+                {
+                    for (int mode = 0; mode < (bParallel ? 2 : 1); mode++)
+                    {
+                        Result res = measure(collider.second, set, Query(q), mode == 1);
+                        res.collider = collider.first;
+                        results.push_back(res);
+
+                        WR_LOG_INFO << res.collider << " " << res.querySet << " " << QUERY_NAMES[q]
+                            << (res.bParallel ? " parallel: " : " single: ") << res.nsPerQuery << " ns/query, p50 "
+                            << res.p50 << " ns, p99 " << res.p99 << " ns, error max " << res.maxError << " rms " << res.rmsError;
+                    }
+                }
+            }
+        }
+    }
+
+    ColliderBenchmark::Result ColliderBenchmark::measure(const ICollisionObject* pCollider, const QuerySet& set, Query query, bool bParallel) const
+    {
+        const size_t n = set.exact.size();
+        const size_t chunk = query == BATCH ? BATCH_SIZE : LATENCY_CHUNK;
+        const size_t nChunk = (n + chunk - 1) / chunk;
+        const float* x = set.pos[0].data(), *y = set.pos[1].data(), *z = set.pos[2].data();
+
+        // distance, gradient and correction
+        std::vector<float> out(7 * n);
+        std::vector<unsigned char> collide(n, 0);
+        float* dist = out.data();
+        float* grad[3] = { dist + n, dist + 2 * n, dist + 3 * n };
+        float* corrected[3] = { dist + 4 * n, dist + 5 * n, dist + 6 * n };
+
+        std::vector<double> chunkNs(nChunk);
+        auto body = [&](size_t c)
+        {
+            const size_t begin = c * chunk, end = std::min(n, begin + chunk);
+            LARGE_INTEGER t0, t1;
+            QueryPerformanceCounter(&t0);
+            switch (query)
+            {
+            case DISTANCE:
+                for (size_t i = begin; i < end; i++)
+                    dist[i] = pCollider->query_distance(Point_3(x[i], y[i], z[i]));
+                break;
+            case CORRELATION:
+                for (size_t i = begin; i < end; i++)
+                {
+                    Point_3 p;
+                    collide[i] = pCollider->position_correlation(Point_3(x[i], y[i], z[i]), &p, thresh);
+                    if (!collide[i]) continue;
+                    corrected[0][i] = p.x();
+                    corrected[1][i] = p.y();
+                    corrected[2][i] = p.z();
+                }
+                break;
+            case BATCH:
+            {
+                CollisionBatch b(end - begin);
+                for (int d = 0; d < 3; d++)
+                {
+                    b.pos[d] = set.pos[d].data() + begin;
+                    b.grad[d] = grad[d] + begin;
+                    b.corrected[d] = corrected[d] + begin;
+                }
+                b.uniformThresh = thresh;
+                b.dist = dist + begin;
+                b.collide = collide.data() + begin;
+                pCollider->query_batch(b);
+                break;
+            }
+            default:
+                break;
+            }
+            QueryPerformanceCounter(&t1);
+            chunkNs[c] = double(t1.QuadPart - t0.QuadPart) * nsPerTick / double(end - begin);
+        };
+
+        LARGE_INTEGER t0, t1;
+        QueryPerformanceCounter(&t0);
+        if (bParallel)
+            concurrency::parallel_for(size_t(0), nChunk, body);
+        else
+        {
+            for (size_t c = 0; c < nChunk; c++)
+                body(c);
+        }
+        QueryPerformanceCounter(&t1);
+
+        Result res;
+        res.querySet = set.name;
+        res.query = query;
+        res.bParallel = bParallel;
+        res.n = n;
+        res.nsPerQuery = n ? double(t1.QuadPart - t0.QuadPart) * nsPerTick / double(n) : 0.0;
+
+        std::sort(chunkNs.begin(), chunkNs.end());
+        res.p50 = nChunk ? chunkNs[nChunk / 2] : 0.0;
+        res.p99 = nChunk ? chunkNs[std::min(nChunk - 1, nChunk * 99 / 100)] : 0.0;
+
+        // the residuals need the exact distance at every result, outside the timing
+        std::vector<float> error(n);
+        concurrency::parallel_for(size_t(0), n, [&](size_t i)
+        {
+            if (query == DISTANCE)
+                error[i] = std::abs(dist[i] - set.exact[i]);
+            else
+            {
+                const float c[3] = { corrected[0][i], corrected[1][i], corrected[2][i] };
+                error[i] = residual(set, i, collide[i] != 0, c);
+            }
+        });
+
+        ErrorStat stat;
+        for (float e : error)
+            stat.add(e, double(e) * e, e, 1);
+        res.maxError = stat.maxVal;
+        res.rmsError = stat.rms();
+        return res;
+    }
+
+    float ColliderBenchmark::residual(const QuerySet& set, size_t i, bool collide, const float* corrected) const
+    {
+        float d = collide ? exact(Point_3(corrected[0], corrected[1], corrected[2])) : set.exact[i];
+        return std::max(0.f, thresh - d);
+    }
+
+    bool ColliderBenchmark::writeResults(const char* fileName, bool bAppend) const
+    {
+        std::ofstream file(fileName, bAppend ? std::ios::app : std::ios::out);
+        if (!file.is_open())
+        {
+            WR_LOG_ERROR << "cannot write " << fileName;
+            return false;
+        }
+
+        if (!bAppend)
+            file << "collider,queries,query,mode,n,ns_per_query,p50_ns,p99_ns,max_error,rms_error\n";
+        for (auto& res : results)
+        {
+            file << res.collider << ',' << res.querySet << ',' << QUERY_NAMES[res.query] << ','
+                << (res.bParallel ? "parallel" : "single") << ',' << res.n << ',' << res.nsPerQuery << ','
+                << res.p50 << ',' << res.p99 << ',' << res.maxError << ',' << res.rmsError << '\n';
+        }
+        return true;
+    }
+
+    bool runColliderBenchmark(const wchar_t* modelFile, const wchar_t* adfFile, const char* cacheFile, const char* outFile)
+    {
+        const size_t resolution = BRICK_GRID_RES > 0 ? BRICK_GRID_RES : DEFAULT_GRID_RES;
+
+        std::vector<float> positions;
+        std::vector<unsigned> indices;
+        CGAL::Bbox_3 box = readTriangleMesh(modelFile, positions, indices);
+        const float extent = float(std::max(box.xmax() - box.xmin(), std::max(box.ymax() - box.ymin(), box.zmax() - box.zmin())));
+
+        // the deformable grid samples the exact mesh distance
+        DeformableCollisionObject* pMesh = createDeformableCollisionObject(modelFile, resolution);
+        ColliderBenchmark bench([pMesh](const Point_3& p){ return pMesh->exact_distance(p); });
+
+        for (float offset : SURFACE_OFFSETS)
+        {
+            std::ostringstream name;
+            name << "surface" << offset;
+            bench.add_surface_queries(name.str().c_str(), positions.data(), indices.data(), indices.size() / 3,
+                offset * extent, N_SURFACE_QUERIES);
+        }
+        if (cacheFile && *cacheFile)
+            bench.add_cache_queries("cache", cacheFile, MAX_CACHE_QUERIES);
+
+        std::vector<ICollisionObject*> owned;
+        owned.push_back(loadCollisionObject(adfFile));
+        bench.add_collider("adf", owned.back());
+        owned.push_back(loadBakedCollisionObject(adfFile, resolution));
+        if (owned.back())
+            bench.add_collider("brickgrid", owned.back());
+        if (LAZY_ADF_LEVEL > 0)
+        {
+            ADFLazyCollisionObject* pLazy = createLazyCollisionObject(modelFile, LAZY_ADF_LEVEL);
+            bench.warm_up(pLazy);
+            pLazy->refine();
+
+            // the same queries again touch only leaves the refinement made
+            const size_t nRefined = pLazy->n_refined();
+            bench.warm_up(pLazy);
+            pLazy->refine();
+            if (pLazy->n_refined() != nRefined)
+                WR_LOG_ERROR << "lazy ADF refined " << pLazy->n_refined() - nRefined << " leaves again";
+            owned.push_back(pLazy);
+            bench.add_collider("lazyadf", pLazy);
+        }
+        bench.add_collider("deformable", pMesh);
+
+        bench.run(true);
+        bool ok = bench.writeResults(outFile);
+
+        for (auto p : owned)
+            delete p;
+
+        // bend the mesh sideways along its height, within the margin of the grid,
+        // and measure the updated grid against the exact distance of the bent mesh
+        std::vector<float> bent(positions);
+        const float height = float(box.ymax() - box.ymin());
+        for (size_t v = 0; v < bent.size(); v += 3)
+            bent[v] += BEND_AMPLITUDE * extent * std::sin(WR_M_PI * (bent[v + 1] - float(box.ymin())) / height);
+
+        LARGE_INTEGER t0, t1, freq;
+        QueryPerformanceFrequency(&freq);
+        QueryPerformanceCounter(&t0);
+        size_t nBricks = pMesh->update(bent.data());
+        QueryPerformanceCounter(&t1);
+        WR_LOG_INFO << "deformable update: " << nBricks << " bricks resampled in "
+            << 1e3 * double(t1.QuadPart - t0.QuadPart) / double(freq.QuadPart) << " ms";
+
+        ColliderBenchmark bentBench([pMesh](const Point_3& p){ return pMesh->exact_distance(p); });
+        for (float offset : SURFACE_OFFSETS)
+        {
+            std::ostringstream name;
+            name << "surface" << offset;
+            bentBench.add_surface_queries(name.str().c_str(), bent.data(), indices.data(), indices.size() / 3,
+                offset * extent, N_SURFACE_QUERIES);
+        }
+        bentBench.add_collider("deformable_bent", pMesh);
+        bentBench.run(true);
+        ok = bentBench.writeResults(outFile, true) && ok;
+
+        delete pMesh;
+        return ok;
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "ICollisionObject.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace WR
+{
+    // Runs every collider over every query set, single threaded and with a
+    // parallel_for over chunks of queries, and measures them against an exact
+    // signed distance:
+    //  - DISTANCE      query_distance, error |d - exact|
+    //  - CORRELATION   position_correlation, error is the penetration left
+    //                  after the correction, max(0, thresh - exact(result))
+    //  - BATCH         query_batch with distance, gradient and correction in
+    //                  batches of the size the hair uses, error as CORRELATION
+    // Latencies are per query within chunks of a few queries, which keeps the
+    // timer overhead out of them; p50 and p99 are over those chunks.
+    class ColliderBenchmark
+    {
+    public:
+        typedef std::function<float(const ICollisionObject::Point_3&)> DistanceFunc;
+
+        enum Query { DISTANCE, CORRELATION, BATCH, N_QUERY };
+
+        struct Result
+        {
+            std::string collider;
+            std::string querySet;
+            Query       query;
+            bool        bParallel;
+            size_t      n;
+            double      nsPerQuery;     // wall time over n
+            double      p50, p99;       // ns per query
+            float       maxError;
+            double      rmsError;
+        };
+
+        // thresh is the collision threshold of the correction queries
+        ColliderBenchmark(const DistanceFunc& exact, float thresh = 3e-3f);
+
+        // not owned, has to outlive run
+        void add_collider(const char* name, const ICollisionObject* pCollider);
+
+        // n points on the triangles, area weighted, moved along their face
+        // normal by offset
+        void add_surface_queries(const char* name, const float* positions, const unsigned* indices, size_t nTriangles,
+            float offset, size_t n, unsigned seed = 0);
+        // the particles of a binary .anim2 cache from its first frames on, at
+        // most maxQueries, taken into body space by the inverse rigid motion of
+        // their frame
+        bool add_cache_queries(const char* name, const char* cacheFile, size_t maxQueries);
+
+        // queries the distance at every point once, for colliders that refine
+        // where they are queried
+        void warm_up(const ICollisionObject* pCollider) const;
+        void run(bool bParallel = true);
+        // one csv row per result, after the rows already in the file if bAppend
+        bool writeResults(const char* fileName, bool bAppend = false) const;
+
+        const std::vector<Result>& get_results() const { return results; }
+
+    private:
+        struct QuerySet
+        {
+            std::string         name;
+            std::vector<float>  pos[3];
+            std::vector<float>  exact;
+        };
+
+        void add_query_set(QuerySet& set);
+        Result measure(const ICollisionObject* pCollider, const QuerySet& set, Query query, bool bParallel) const;
+        // penetration left at the result of a correction of point i
+        float residual(const QuerySet& set, size_t i, bool collide, const float* corrected) const;
+
+        DistanceFunc    exact;
+        float           thresh;
+        double          nsPerTick;
+
+        std::vector<std::pair<std::string, const ICollisionObject*>>    colliders;
+        std::vector<QuerySet>                                           querySets;
+        std::vector<Result>                                             results;
+    };
+
+    // benchmarks the head colliders the scene can be configured with: the ADF
+    // in adfFile, its brick grid bake, the lazy ADF and the deformable grid of
+    // the mesh in modelFile, which also gives the exact distance. Queries are
+    // taken near the mesh at a few offsets and from cacheFile if it is set.
+    // The deformable grid is then updated to a bent mesh and measured again
+    // against it, its rows are appended as "deformable_bent".
+    bool runColliderBenchmark(const wchar_t* modelFile, const wchar_t* adfFile, const char* cacheFile, const char* outFile);
+}
@@ -0,0 +1,546 @@
+#include "DXUT.h"
+#include "CompoundCollisionObject.h"
+#include "wrMacro.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+#define LEAF_PROXIES 2
+#define MAX_TREE_STACK 64
+#define MAX_PROJECTION_ITERATION 4
+#define MAX_RESOLVE_ROUND 3
+
+    inline float dot3(const float* a, const float* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+    // squared distance from p to the box, zero inside
+    inline float box_distance(const float* bmin, const float* bmax, const float* p)
+    {
+        float d = 0.f;
+        for (int i = 0; i < 3; i++)
+        {
+            float e = std::max(0.f, std::max(bmin[i] - p[i], p[i] - bmax[i]));
+            d += e * e;
+        }
+        return d;
+    }
+
+    // a box whose distance bounds the proxies in it from below can only be
+    // skipped when p is outside; inside it, a proxy may be deeper than best
+    inline bool prune(float sqBoxDist, float best)
+    {
+        return sqBoxDist > 0.f && (best < 0.f || sqBoxDist >= best * best);
+    }
+}
+
+namespace WR
+{
+    RigidTransform::RigidTransform()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+                R[i][j] = i == j ? 1.f : 0.f;
+            t[i] = 0.f;
+        }
+    }
+
+    RigidTransform::RigidTransform(const float* rot, const float* trans)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 3; j++)
+                R[i][j] = rot[3 * i + j];
+            t[i] = trans[i];
+        }
+    }
+
+    CompoundCollisionObject::~CompoundCollisionObject()
+    {
+        for (auto& proxy : proxies)
+            SAFE_DELETE(proxy.pLevelSet);
+    }
+
+    size_t CompoundCollisionObject::add_sphere(const RigidTransform& xf, float radius)
+    {
+        Proxy proxy = { SPHERE, xf, { radius, 0.f, 0.f }, nullptr };
+        return add(proxy);
+    }
+
+    size_t CompoundCollisionObject::add_capsule(const RigidTransform& xf, float halfLength, float radius)
+    {
+        Proxy proxy = { CAPSULE, xf, { halfLength, radius, 0.f }, nullptr };
+        return add(proxy);
+    }
+
+    size_t CompoundCollisionObject::add_ellipsoid(const RigidTransform& xf, float rx, float ry, float rz)
+    {
+        Proxy proxy = { ELLIPSOID, xf, { rx, ry, rz }, nullptr };
+        return add(proxy);
+    }
+
+    size_t CompoundCollisionObject::add_level_set(const RigidTransform& xf, ICollisionObject* pLevelSet, const CGAL::Bbox_3& box)
+    {
+        assert(pLevelSet);
+        Proxy proxy = { LEVEL_SET, xf, { 0.f, 0.f, 0.f }, pLevelSet, box };
+        return add(proxy);
+    }
+
+    size_t CompoundCollisionObject::add(const Proxy& proxy)
+    {
+        proxies.push_back(proxy);
+        update_box(proxies.back());
+        build_tree();
+        return proxies.size() - 1;
+    }
+
+    void CompoundCollisionObject::set_transform(size_t id, const RigidTransform& xf)
+    {
+        assert(id < proxies.size());
+        proxies[id].xf = xf;
+        update_box(proxies[id]);
+        refit();
+    }
+
+    void CompoundCollisionObject::update_box(Proxy& proxy) const
+    {
+        const RigidTransform& xf = proxy.xf;
+        float c[3], e[3];
+        switch (proxy.type)
+        {
+        case SPHERE:
+            for (int i = 0; i < 3; i++)
+            {
+                c[i] = xf.t[i];
+                e[i] = proxy.size[0];
+            }
+            break;
+        case CAPSULE:
+            for (int i = 0; i < 3; i++)
+            {
+                c[i] = xf.t[i];
+                e[i] = std::abs(xf.R[i][1]) * proxy.size[0] + proxy.size[1];
+            }
+            break;
+        case ELLIPSOID:
+            for (int i = 0; i < 3; i++)
+            {
+                c[i] = xf.t[i];
+                float s = 0.f;
+                for (int j = 0; j < 3; j++)
+                    s += xf.R[i][j] * xf.R[i][j] * proxy.size[j] * proxy.size[j];
+                e[i] = std::sqrt(s);
+            }
+            break;
+        case LEVEL_SET:
+        {
+            const CGAL::Bbox_3& box = proxy.localBox;
+            float lc[3], h[3];
+            for (int j = 0; j < 3; j++)
+            {
+                lc[j] = float(box.min(j) + box.max(j)) * 0.5f;
+                h[j] = float(box.max(j) - box.min(j)) * 0.5f;
+            }
+            xf.to_world(lc, c);
+            for (int i = 0; i < 3; i++)
+                e[i] = std::abs(xf.R[i][0]) * h[0] + std::abs(xf.R[i][1]) * h[1] + std::abs(xf.R[i][2]) * h[2];
+            break;
+        }
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            proxy.bmin[i] = c[i] - e[i];
+            proxy.bmax[i] = c[i] + e[i];
+        }
+    }
+
+    void CompoundCollisionObject::build_tree()
+    {
+        order.clear();
+        levelSets.clear();
+        for (unsigned i = 0; i < unsigned(proxies.size()); i++)
+        {
+            if (proxies[i].type == LEVEL_SET) levelSets.push_back(i);
+            else order.push_back(i);
+        }
+
+        nodes.clear();
+        if (!order.empty())
+            build_node(0, order.size());
+        refit();
+    }
+
+    // median split along the longest axis of the box centres
+    unsigned CompoundCollisionObject::build_node(size_t begin, size_t end)
+    {
+        const unsigned idx = unsigned(nodes.size());
+        nodes.push_back(Node());
+
+        Node node;
+        float cmin[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, cmax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t k = begin; k < end; k++)
+        {
+            const Proxy& proxy = proxies[order[k]];
+            for (int i = 0; i < 3; i++)
+            {
+                float c = 0.5f * (proxy.bmin[i] + proxy.bmax[i]);
+                cmin[i] = std::min(cmin[i], c);
+                cmax[i] = std::max(cmax[i], c);
+            }
+        }
+
+        node.offset = unsigned(begin);
+        node.count = unsigned(end - begin);
+        if (end - begin > LEAF_PROXIES)
+        {
+            int axis = 0;
+            for (int i = 1; i < 3; i++)
+            {
+                if (cmax[i] - cmin[i] > cmax[axis] - cmin[axis])
+                    axis = i;
+            }
+
+            const size_t mid = (begin + end) / 2;
+            const std::vector<Proxy>& pr = proxies;
+            std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end, [&](unsigned a, unsigned b)
+            {
+                return pr[a].bmin[axis] + pr[a].bmax[axis] < pr[b].bmin[axis] + pr[b].bmax[axis];
+            });
+
+            node.count = 0;
+            build_node(begin, mid);
+            node.offset = build_node(mid, end);
+        }
+        nodes[idx] = node;
+        return idx;
+    }
+
+    void CompoundCollisionObject::refit()
+    {
+        // build_node numbers both halves of a split after the node itself,
+        // so walking backwards fits the halves before the box that holds them
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            Node& node = nodes[i];
+            for (int a = 0; a < 3; a++)
+            {
+                node.bmin[a] = FLT_MAX;
+                node.bmax[a] = -FLT_MAX;
+            }
+
+            auto grow = [&node](const float* bmin, const float* bmax)
+            {
+                for (int a = 0; a < 3; a++)
+                {
+                    node.bmin[a] = std::min(node.bmin[a], bmin[a]);
+                    node.bmax[a] = std::max(node.bmax[a], bmax[a]);
+                }
+            };
+
+            if (node.count)
+            {
+                for (unsigned k = 0; k < node.count; k++)
+                {
+                    const Proxy& proxy = proxies[order[node.offset + k]];
+                    grow(proxy.bmin, proxy.bmax);
+                }
+            }
+            else
+            {
+                grow(nodes[i + 1].bmin, nodes[i + 1].bmax);
+                grow(nodes[node.offset].bmin, nodes[node.offset].bmax);
+            }
+        }
+    }
+
+    float CompoundCollisionObject::closest(const float* p, float* grad, size_t* pProxy) const
+    {
+        float best = FLT_MAX;
+        size_t bestProxy = proxies.size();
+
+        // analytic proxies, nearer boxes first
+        if (!nodes.empty() && !prune(box_distance(nodes[0].bmin, nodes[0].bmax, p), best))
+        {
+            unsigned stack[MAX_TREE_STACK];
+            int top = 0;
+            unsigned idx = 0;
+            while (true)
+            {
+                const Node& node = nodes[idx];
+                if (node.count)
+                {
+                    for (unsigned k = 0; k < node.count; k++)
+                    {
+                        float d = proxy_distance(proxies[order[node.offset + k]], p, nullptr);
+                        if (d < best)
+                        {
+                            best = d;
+                            bestProxy = order[node.offset + k];
+                        }
+                    }
+                }
+                else
+                {
+                    unsigned l = idx + 1, r = node.offset;
+                    float dl = box_distance(nodes[l].bmin, nodes[l].bmax, p);
+                    float dr = box_distance(nodes[r].bmin, nodes[r].bmax, p);
+                    if (dr < dl)
+                    {
+                        std::swap(l, r);
+                        std::swap(dl, dr);
+                    }
+                    if (!prune(dl, best))
+                    {
+                        if (!prune(dr, best))
+                            stack[top++] = r;
+                        idx = l;
+                        continue;
+                    }
+                }
+
+                // a proxy found meanwhile can have lowered best below a stacked box
+                bool next = false;
+                while (top && !next)
+                {
+                    idx = stack[--top];
+                    next = !prune(box_distance(nodes[idx].bmin, nodes[idx].bmax, p), best);
+                }
+                if (!next) break;
+            }
+        }
+
+        // the gradient of the closest analytic proxy only
+        if (grad && bestProxy < proxies.size())
+            proxy_distance(proxies[bestProxy], p, grad);
+
+        // then the level sets that can still be closer, with their gradient at once
+        for (unsigned id : levelSets)
+        {
+            const Proxy& proxy = proxies[id];
+            if (prune(box_distance(proxy.bmin, proxy.bmax, p), best))
+                continue;
+
+            float g[3];
+            float d = proxy_distance(proxy, p, g);
+            if (d < best)
+            {
+                best = d;
+                bestProxy = id;
+                if (grad) std::copy(g, g + 3, grad);
+            }
+        }
+
+        if (pProxy) *pProxy = bestProxy;
+        return best;
+    }
+
+    float CompoundCollisionObject::proxy_distance(const Proxy& proxy, const float* p, float* grad) const
+    {
+        float q[3], n[3] = { 0.f, 1.f, 0.f }, d;
+        proxy.xf.to_local(p, q);
+
+        switch (proxy.type)
+        {
+        case SPHERE:
+        {
+            float len = std::sqrt(dot3(q, q));
+            if (len > 0.f)
+            {
+                float inv = 1.f / len;
+                for (int i = 0; i < 3; i++)
+                    n[i] = q[i] * inv;
+            }
+            d = len - proxy.size[0];
+            break;
+        }
+        case CAPSULE:
+        {
+            float v[3] = { q[0], q[1] - std::max(-proxy.size[0], std::min(proxy.size[0], q[1])), q[2] };
+            float len = std::sqrt(dot3(v, v));
+            if (len > 0.f)
+            {
+                float inv = 1.f / len;
+                for (int i = 0; i < 3; i++)
+                    n[i] = v[i] * inv;
+            }
+            d = len - proxy.size[1];
+            break;
+        }
+        case ELLIPSOID:
+        {
+            // |q / r| (|q / r| - 1) / |q / r^2|, with the gradient of |q / r|
+            float qr[3], qrr[3];
+            for (int i = 0; i < 3; i++)
+            {
+                qr[i] = q[i] / proxy.size[i];
+                qrr[i] = qr[i] / proxy.size[i];
+            }
+            float k0 = std::sqrt(dot3(qr, qr)), k1 = std::sqrt(dot3(qrr, qrr));
+            if (k1 > 0.f)
+            {
+                float inv = 1.f / k1;
+                d = k0 * (k0 - 1.f) * inv;
+                for (int i = 0; i < 3; i++)
+                    n[i] = qrr[i] * inv;
+            }
+            else d = -std::min(proxy.size[0], std::min(proxy.size[1], proxy.size[2]));
+            break;
+        }
+        case LEVEL_SET:
+            d = level_set_distance(proxy, q, n);
+            break;
+        }
+
+        if (grad) proxy.xf.rotate(n, grad);
+        return d;
+    }
+
+    float CompoundCollisionObject::level_set_distance(const Proxy& proxy, const float* q, float* n) const
+    {
+        // one point batch, for the gradient the level set computes with the distance
+        float x[3] = { q[0], q[1], q[2] }, d;
+        CollisionBatch b(1);
+        for (int i = 0; i < 3; i++)
+        {
+            b.pos[i] = x + i;
+            b.grad[i] = n + i;
+        }
+        b.dist = &d;
+        proxy.pLevelSet->query_batch(b);
+        return d;
+    }
+
+    void CompoundCollisionObject::project(const Proxy& proxy, float* p, float d, const float* grad, float thresh) const
+    {
+        if (proxy.type == LEVEL_SET)
+        {
+            float q[3];
+            proxy.xf.to_local(p, q);
+            Point_3 corrected;
+            if (proxy.pLevelSet->position_correlation(Point_3(q[0], q[1], q[2]), &corrected, thresh))
+            {
+                float c[3] = { corrected.x(), corrected.y(), corrected.z() };
+                proxy.xf.to_world(c, p);
+            }
+            return;
+        }
+
+        // one step along the normal is exact for spheres and capsules, the
+        // ellipsoid estimate needs a few
+        float g[3] = { grad[0], grad[1], grad[2] };
+        for (int it = 0; it < MAX_PROJECTION_ITERATION && d < thresh; it++)
+        {
+            for (int i = 0; i < 3; i++)
+                p[i] += g[i] * (thresh - d);
+            d = proxy_distance(proxy, p, g);
+        }
+    }
+
+    void CompoundCollisionObject::resolve(float* p, float d, float* grad, size_t id, float thresh) const
+    {
+        // pushed out of one proxy, p may end up in an overlapping one
+        for (int round = 0; round < MAX_RESOLVE_ROUND && d < thresh; round++)
+        {
+            project(proxies[id], p, d, grad, thresh);
+            d = closest(p, grad, &id);
+        }
+    }
+
+    float CompoundCollisionObject::query_distance(const Point_3& p) const
+    {
+        assert(!proxies.empty());
+        float x[3] = { p.x(), p.y(), p.z() };
+        return closest(x, nullptr, nullptr);
+    }
+
+    float CompoundCollisionObject::query_squared_distance(const Point_3& p) const
+    {
+        float d = query_distance(p);
+        return d * d;
+    }
+
+    bool CompoundCollisionObject::exceed_threshhold(const Point_3& p, float thresh) const
+    {
+        return query_distance(p) < thresh;
+    }
+
+    bool CompoundCollisionObject::position_correlation(const Point_3& p, Point_3* pCorrect, float thresh) const
+    {
+        assert(!proxies.empty());
+
+        float x[3] = { p.x(), p.y(), p.z() }, g[3];
+        size_t id;
+        float d = closest(x, g, &id);
+        if (d >= thresh) return false;
+        if (!pCorrect) return true;
+
+        resolve(x, d, g, id, thresh);
+        *pCorrect = Point_3(x[0], x[1], x[2]);
+        return true;
+    }
+
+    void CompoundCollisionObject::query_batch(CollisionBatch& b) const
+    {
+        assert(!proxies.empty());
+
+        for (size_t i = 0; i < b.n; i++)
+        {
+            float x[3] = { b.pos[0][i], b.pos[1][i], b.pos[2][i] }, g[3];
+            size_t id;
+            float d = closest(x, g, &id);
+
+            if (b.dist) b.dist[i] = d;
+            if (b.grad[0])
+            {
+                for (int k = 0; k < 3; k++)
+                    b.grad[k][i] = g[k];
+            }
+            if (!b.corrected[0] && !b.collide) continue;
+
+            const float thresh = b.threshold(i);
+            bool isCollide = d < thresh;
+            if (isCollide && b.corrected[0])
+                resolve(x, d, g, id, thresh);
+            if (b.collide) b.collide[i] = isCollide;
+            if (b.corrected[0])
+            {
+                for (int k = 0; k < 3; k++)
+                    b.corrected[k][i] = x[k];
+            }
+        }
+    }
+
+    CompoundCollisionObject* createBodyCollisionObject(ICollisionObject* pHead, const CGAL::Bbox_3& headBox)
+    {
+        const float sx = float(headBox.xmax() - headBox.xmin());
+        const float sy = float(headBox.ymax() - headBox.ymin());
+        const float sz = float(headBox.zmax() - headBox.zmin());
+        const float cx = float(headBox.xmin() + headBox.xmax()) * 0.5f;
+        const float cz = float(headBox.zmin() + headBox.zmax()) * 0.5f;
+        const float bottom = float(headBox.ymin());
+
+        CompoundCollisionObject* pBody = new CompoundCollisionObject;
+        pBody->add_level_set(RigidTransform(), pHead, headBox);
+
+        RigidTransform neck;
+        neck.t[0] = cx;
+        neck.t[1] = bottom - 0.1f * sy;
+        neck.t[2] = cz;
+        pBody->add_capsule(neck, 0.2f * sy, 0.2f * sx);
+
+        // across the body: local y turned onto x
+        const float across[9] = { 0.f, -1.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f };
+        const float shoulderPos[3] = { cx, bottom - 0.45f * sy, cz };
+        pBody->add_capsule(RigidTransform(across, shoulderPos), 0.85f * sx, 0.3f * sz);
+
+        RigidTransform torso;
+        torso.t[0] = cx;
+        torso.t[1] = bottom - 1.1f * sy;
+        torso.t[2] = cz;
+        pBody->add_ellipsoid(torso, 1.1f * sx, 0.8f * sy, 0.55f * sz);
+
+        return pBody;
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include "ICollisionObject.h"
+#include <CGAL\Bbox_3.h>
+#include <vector>
+
+namespace WR
+{
+    // rotation R and translation t taking a proxy's own space to the world,
+    // x = R q + t
+    struct RigidTransform
+    {
+        RigidTransform();
+        // R is row major
+        RigidTransform(const float* R, const float* t);
+
+        void to_local(const float* x, float* q) const
+        {
+            float d[3] = { x[0] - t[0], x[1] - t[1], x[2] - t[2] };
+            for (int j = 0; j < 3; j++)
+                q[j] = R[0][j] * d[0] + R[1][j] * d[1] + R[2][j] * d[2];
+        }
+
+        void to_world(const float* q, float* x) const
+        {
+            rotate(q, x);
+            for (int i = 0; i < 3; i++)
+                x[i] += t[i];
+        }
+
+        void rotate(const float* v, float* w) const
+        {
+            for (int i = 0; i < 3; i++)
+                w[i] = R[i][0] * v[0] + R[i][1] * v[1] + R[i][2] * v[2];
+        }
+
+        float R[3][3];
+        float t[3];
+    };
+
+    // Union of analytic proxies, spheres, capsules and oriented ellipsoids, and
+    // wrapped level sets, each placed by its own rigid transform. A small BVH
+    // over the world boxes of the analytic proxies finds the closest ones first;
+    // a level set is only queried when its box is nearer than the best analytic
+    // distance, so the ADF of the head is skipped around the rest of the body.
+    //
+    // Transforms may change between frames, not while queries run.
+    class CompoundCollisionObject :
+        public ICollisionObject
+    {
+    public:
+        CompoundCollisionObject() {}
+        ~CompoundCollisionObject();
+
+        // each returns the proxy id for set_transform
+        size_t add_sphere(const RigidTransform& xf, float radius);
+        // around the segment from -halfLength to halfLength on the local y axis
+        size_t add_capsule(const RigidTransform& xf, float halfLength, float radius);
+        // the ellipsoid distance is the first order estimate, exact on the surface
+        size_t add_ellipsoid(const RigidTransform& xf, float rx, float ry, float rz);
+        // takes pLevelSet over, box bounds its surface in its own space
+        size_t add_level_set(const RigidTransform& xf, ICollisionObject* pLevelSet, const CGAL::Bbox_3& box);
+        // moves a proxy and refits the tree
+        void set_transform(size_t id, const RigidTransform& xf);
+
+        virtual float query_distance(const Point_3& p) const;
+        virtual float query_squared_distance(const Point_3& p) const;
+        virtual bool exceed_threshhold(const Point_3& p, float thresh = 0.f) const;
+        virtual bool position_correlation(const Point_3& p, Point_3* pCorrect, float thresh = 0.f) const;
+        virtual void query_batch(CollisionBatch& b) const;
+
+        size_t n_proxies() const { return proxies.size(); }
+
+    private:
+        enum ProxyType { SPHERE, CAPSULE, ELLIPSOID, LEVEL_SET };
+
+        struct Proxy
+        {
+            ProxyType           type;
+            RigidTransform      xf;
+            float               size[3];            // radius; half length and radius; radii
+            ICollisionObject*   pLevelSet;
+            CGAL::Bbox_3        localBox;           // level sets only
+            float               bmin[3], bmax[3];   // world box of the solid
+        };
+
+        struct Node
+        {
+            float       bmin[3];
+            unsigned    offset;     // where order[] starts for the proxies, else the second half
+            float       bmax[3];
+            unsigned    count;      // proxies held; a split node holds none
+        };
+
+        size_t add(const Proxy& proxy);
+        void update_box(Proxy& proxy) const;
+        void build_tree();
+        unsigned build_node(size_t begin, size_t end);
+        void refit();
+
+        // closest proxy to p with its distance and world gradient, grad may be null
+        float closest(const float* p, float* grad, size_t* pProxy) const;
+        float proxy_distance(const Proxy& proxy, const float* p, float* grad) const;
+        float level_set_distance(const Proxy& proxy, const float* q, float* n) const;
+        // moves p onto the thresh iso-surface of the proxy
+        void project(const Proxy& proxy, float* p, float d, const float* grad, float thresh) const;
+        // projects onto proxy id, then onto whichever proxy p still collides with
+        void resolve(float* p, float d, float* grad, size_t id, float thresh) const;
+
+        std::vector<Proxy>      proxies;
+        std::vector<Node>       nodes;      // over the analytic proxies, depth first
+        std::vector<unsigned>   order;      // analytic proxies in leaf order
+        std::vector<unsigned>   levelSets;
+    };
+
+    // wraps the head level set with a neck, shoulders and torso in rough
+    // proportion to the head box, y up
+    CompoundCollisionObject* createBodyCollisionObject(ICollisionObject* pHead, const CGAL::Bbox_3& headBox);
+}
@@ -0,0 +1,59 @@
+#include "FrameCache.h"
+
+namespace WR
+{
+    FrameCache::FramePtr FrameCache::get(const std::string& file, size_t frame)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto itr = index.find(Key(file, frame));
+        if (itr == index.end())
+        {
+            misses++;
+            return nullptr;
+        }
+
+        hits++;
+        lru.splice(lru.begin(), lru, itr->second);
+        return itr->second->second;
+    }
+
+    bool FrameCache::contains(const std::string& file, size_t frame) const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return index.count(Key(file, frame)) > 0;
+    }
+
+    void FrameCache::put(const std::string& file, size_t frame, const FramePtr& data)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        Key key(file, frame);
+
+        auto itr = index.find(key);
+        if (itr != index.end())
+        {
+            used -= bytes(itr->second->second);
+            lru.erase(itr->second);
+            index.erase(itr);
+        }
+
+        lru.push_front(std::make_pair(key, data));
+        index[key] = lru.begin();
+        used += bytes(data);
+
+        // the newest frame always stays, even if it alone exceeds the budget
+        while (used > budget && lru.size() > 1)
+        {
+            used -= bytes(lru.back().second);
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+
+    void FrameCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        lru.clear();
+        index.clear();
+        used = 0;
+    }
+}
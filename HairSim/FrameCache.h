@@ -0,0 +1,45 @@
+#pragma once
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace WR
+{
+    // Thread-safe LRU cache of decoded cache frames keyed by (file, frame),
+    // bounded by a memory budget in bytes. Frames are shared and immutable,
+    // an evicted frame stays alive as long as somebody still holds it.
+    class FrameCache
+    {
+    public:
+        typedef std::shared_ptr<const std::vector<float>> FramePtr;
+
+        FrameCache(size_t budget) :budget(budget){}
+
+        FramePtr get(const std::string& file, size_t frame);
+        bool contains(const std::string& file, size_t frame) const;
+        void put(const std::string& file, size_t frame, const FramePtr& data);
+        void clear();
+
+        size_t get_budget() const { return budget; }
+        size_t get_used() const { return used; }
+        size_t get_hits() const { return hits; }
+        size_t get_misses() const { return misses; }
+
+    private:
+        typedef std::pair<std::string, size_t> Key;
+        typedef std::list<std::pair<Key, FramePtr>> LruList;
+
+        static size_t bytes(const FramePtr& data) { return data->size() * sizeof(float); }
+
+        LruList lru;    // most recently used first
+        std::map<Key, LruList::iterator> index;
+        mutable std::mutex mtx;
+
+        size_t budget;
+        size_t used = 0;
+        size_t hits = 0, misses = 0;
+    };
+}
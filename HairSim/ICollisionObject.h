@@ -21,6 +21,31 @@ namespace WR
 
     typedef CGAL::FloatKernel     K;
 
+    // points of a batch query in SoA layout, outputs left null are not computed
+    struct CollisionBatch
+    {
+        CollisionBatch(size_t n = 0) : n(n)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                pos[i] = nullptr;
+                grad[i] = corrected[i] = nullptr;
+            }
+        }
+
+        float threshold(size_t i) const { return thresh ? thresh[i] : uniformThresh; }
+
+        size_t          n;
+        const float*    pos[3];
+        const float*    thresh = nullptr;       // per point, uniformThresh when null
+        float           uniformThresh = 0.f;
+
+        float*          dist = nullptr;
+        float*          grad[3];
+        float*          corrected[3];           // the input position where not colliding
+        unsigned char*  collide = nullptr;      // 1 where the point was corrected
+    };
+
     // since most are geometry computation, using CGAL Point_3
     class ICollisionObject
     {
@@ -37,5 +62,37 @@ namespace WR
         virtual float query_squared_distance(const Point_3& p) const = 0;
         virtual bool exceed_threshhold(const Point_3& p, float thresh = 0.f) const = 0;
         virtual bool position_correlation(const Point_3& p, Point_3* pCorrect, float thresh = 0.f) const = 0;
+
+        // distance, gradient and correction of a whole batch, safe to call from
+        // several threads at once. The fallback goes point by point, with a
+        // central difference gradient.
+        virtual void query_batch(CollisionBatch& b) const
+        {
+            const float h = 1e-4f;
+            for (size_t i = 0; i < b.n; i++)
+            {
+                Point_3 p(b.pos[0][i], b.pos[1][i], b.pos[2][i]);
+                if (b.dist) b.dist[i] = query_distance(p);
+                if (b.grad[0])
+                {
+                    b.grad[0][i] = (query_distance(p + Vector_3(h, 0, 0)) - query_distance(p - Vector_3(h, 0, 0))) / (2 * h);
+                    b.grad[1][i] = (query_distance(p + Vector_3(0, h, 0)) - query_distance(p - Vector_3(0, h, 0))) / (2 * h);
+                    b.grad[2][i] = (query_distance(p + Vector_3(0, 0, h)) - query_distance(p - Vector_3(0, 0, h))) / (2 * h);
+                }
+                if (b.corrected[0] || b.collide)
+                {
+                    Point_3 c;
+                    bool isCollide = position_correlation(p, &c, b.threshold(i));
+                    if (!isCollide) c = p;
+                    if (b.collide) b.collide[i] = isCollide;
+                    if (b.corrected[0])
+                    {
+                        b.corrected[0][i] = c.x();
+                        b.corrected[1][i] = c.y();
+                        b.corrected[2][i] = c.z();
+                    }
+                }
+            }
+        }
     };
 }
\ No newline at end of file
@@ -11,6 +11,13 @@ namespace WR
         virtual const float* get_visible_particle_position(size_t i, size_t j) const = 0;
         virtual const float* get_visible_particle_direction(size_t i, size_t j) const { return nullptr; }
         virtual const float* get_rigidMotionMatrix() const { return nullptr; }
+        // where strand i was in the order the hair was loaded in
+        virtual size_t get_original_strand_id(size_t i) const { return i; }
+        // playback position of a hair read from a cache, 0 of 0 otherwise
+        virtual size_t getCurrentFrame() const { return 0; }
+        virtual size_t getFrameNumber() const { return 0; }
+        // strands the simulation leaves out for now, 0 for hairs that never sleep
+        virtual size_t n_sleeping_strands() const { return 0; }
         virtual void onFrame(Mat3 world, float fTime, float fTimeElapsed, void* = nullptr) = 0;
     };
 }
\ No newline at end of file
@@ -31,6 +31,19 @@ std::string GUIDE_FILE;
 std::string GROUP_FILE;
 std::string REF_FILE, NEIGH_FILE;
 bool hasShadow = false;
+int FRAME_CACHE_SIZE = 0;
+int BRICK_GRID_RES = 0;
+int LAZY_ADF_LEVEL = 0;
+bool BODY_PROXIES = false;
+bool COLLIDER_BENCH = false;
+bool CONTACT_CONSTRAINT = false;
+float FRICTION = 0.f;
+bool APPLY_CCD = false;
+float SLEEP_SPEED = 0.f;
+bool SORT_STRANDS = false;
+float SIM_RATE = 0.f;
+std::string TRANSCODE_FILE;
+bool TRANSCODE_DIRECTION = true;
 
 
 void init_global_param()
@@ -52,4 +65,17 @@ void init_global_param()
     REF_FILE = reader.getValue("reffile");
     NEIGH_FILE = reader.getValue("neighfile");
     hasShadow = bool(std::stoi(reader.getValue("shadow")));
+    FRAME_CACHE_SIZE = std::stoi(reader.getValue("framecache"));
+    BRICK_GRID_RES = std::stoi(reader.getValue("brickgrid"));
+    LAZY_ADF_LEVEL = std::stoi(reader.getValue("lazyadf"));
+    BODY_PROXIES = bool(std::stoi(reader.getValue("bodyproxies")));
+    COLLIDER_BENCH = bool(std::stoi(reader.getValue("colliderbench")));
+    CONTACT_CONSTRAINT = bool(std::stoi(reader.getValue("contactconstraint")));
+    FRICTION = std::stof(reader.getValue("friction"));
+    APPLY_CCD = bool(std::stoi(reader.getValue("ccd")));
+    SLEEP_SPEED = std::stof(reader.getValue("sleepspeed"));
+    SORT_STRANDS = bool(std::stoi(reader.getValue("sortstrands")));
+    SIM_RATE = std::stof(reader.getValue("simrate"));
+    TRANSCODE_FILE = reader.getValue("transcodefile");
+    TRANSCODE_DIRECTION = bool(std::stoi(reader.getValue("transcodedirection")));
 }
\ No newline at end of file
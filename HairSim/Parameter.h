@@ -23,5 +23,17 @@ extern float K_ALTITUDE_SPRING;
 extern bool APPLY_COLLISION;
 extern bool APPLY_STRAINLIMIT;
 extern bool APPLY_PCG;
+extern int FRAME_CACHE_SIZE;   // MB of decoded frames kept for scrubbing, 0 disables
+extern int BRICK_GRID_RES;     // cells along the longest axis of the baked collider, 0 keeps the ADF
+extern int LAZY_ADF_LEVEL;     // builds the head ADF from the mesh, refined to this level where hair goes, 0 loads it
+extern bool BODY_PROXIES;      // adds analytic neck, shoulders and torso around the head collider
+extern bool COLLIDER_BENCH;    // benchmarks the head colliders at startup into collider_bench.csv
+extern bool CONTACT_CONSTRAINT; // body collisions as velocity constraints of the pcg solve
+extern float FRICTION;          // Coulomb coefficient of the hair on the body
+extern bool APPLY_CCD;          // stops particles where their path through a step first reaches the body
+extern float SLEEP_SPEED;       // strands moving slower than this relative to the body fall asleep, 0 disables
+extern bool SORT_STRANDS;       // orders loaded strands along a space filling curve over their roots
+extern float SIM_RATE;          // steps per second of the hairs on their own threads, 0 steps them on the render thread
+extern bool TRANSCODE_DIRECTION; // keeps the direction block when the cache is transcoded
 
 void init_global_param();
@@ -0,0 +1,181 @@
+#include "DXUT.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "SimulationRunner.h"
+#include "Parameter.h"
+
+namespace
+{
+    // a simulation further behind the clock than this many steps drops the
+    // time instead of catching up
+    const float MAX_LAG_STEPS = 4.f;
+}
+
+namespace WR
+{
+    SimulationRunner::SimulationRunner(IHair* pHair, float rate, void* pData) :
+        pHair(pHair), pData(pData), step(1.f / rate), nStrand(pHair->n_strands()),
+        bDirection(nStrand > 0 && pHair->get_visible_particle_direction(0, 0) != nullptr),
+        bRigid(pHair->get_rigidMotionMatrix() != nullptr),
+        middle(2), back(3), prev(0), cur(1)
+    {
+        world = Mat3::Identity();
+        for (auto& state : slots)
+            capture(state, 0.f);
+        show(0.f);
+
+        worker = std::thread(&SimulationRunner::run, this);
+    }
+
+    SimulationRunner::~SimulationRunner()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            bQuit = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    const float* SimulationRunner::get_visible_particle_position(size_t i, size_t j) const
+    {
+        return &pos[3 * (i * N_PARTICLES_PER_STRAND + j)];
+    }
+
+    const float* SimulationRunner::get_visible_particle_direction(size_t i, size_t j) const
+    {
+        return bDirection ? &dir[3 * (i * N_PARTICLES_PER_STRAND + j)] : nullptr;
+    }
+
+    const float* SimulationRunner::get_rigidMotionMatrix() const
+    {
+        return bRigid ? rigid : nullptr;
+    }
+
+    void SimulationRunner::onFrame(Mat3 w, float fTime, float fTimeElapsed, void*)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            world = w;
+            renderTime = fTime;
+            if (!bStarted)
+            {
+                bStarted = true;
+                simTime = fTime;
+                slots[prev].time = slots[cur].time = fTime;
+            }
+        }
+        cv.notify_one();
+
+        // one step behind the clock, the state after it is usually published
+        const float shown = fTime - step;
+        if (shown >= slots[cur].time && (middle.load() & FRESH))
+        {
+            int fresh = middle.exchange(prev) & ~FRESH;
+            prev = cur;
+            cur = fresh;
+        }
+        show(shown);
+    }
+
+    void SimulationRunner::exclusive(const std::function<void(IHair*)>& f)
+    {
+        std::lock_guard<std::mutex> lock(stepMtx);
+        f(pHair);
+
+        // a state published before f is out of date, it goes back unread
+        if (middle.load() & FRESH)
+            prev = middle.exchange(prev) & ~FRESH;
+
+        capture(slots[cur], slots[cur].time);
+        slots[prev] = slots[cur];
+        show(slots[cur].time);
+    }
+
+    void SimulationRunner::run()
+    {
+        while (true)
+        {
+            Mat3 w;
+            float time;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this]{ return bQuit || (bStarted && simTime < renderTime); });
+                if (bQuit) break;
+
+                if (renderTime - simTime > MAX_LAG_STEPS * step)
+                    simTime = renderTime - step;
+                simTime += step;
+                time = simTime;
+                w = world;
+            }
+
+            std::lock_guard<std::mutex> lock(stepMtx);
+            pHair->onFrame(w, time, step, pData);
+            capture(slots[back], time);
+            back = middle.exchange(back | FRESH) & ~FRESH;
+        }
+    }
+
+    void SimulationRunner::capture(State& state, float time) const
+    {
+        const size_t n = 3 * nStrand * N_PARTICLES_PER_STRAND;
+        state.time = time;
+        state.frame = pHair->getCurrentFrame();
+        state.nFrame = pHair->getFrameNumber();
+        state.nSleeping = pHair->n_sleeping_strands();
+        state.pos.resize(n);
+        for (size_t i = 0; i < nStrand; i++)
+            for (size_t j = 0; j < N_PARTICLES_PER_STRAND; j++)
+                memcpy(&state.pos[3 * (i * N_PARTICLES_PER_STRAND + j)], pHair->get_visible_particle_position(i, j), sizeof(float) * 3);
+
+        if (bDirection)
+        {
+            state.dir.resize(n);
+            for (size_t i = 0; i < nStrand; i++)
+                for (size_t j = 0; j < N_PARTICLES_PER_STRAND; j++)
+                    memcpy(&state.dir[3 * (i * N_PARTICLES_PER_STRAND + j)], pHair->get_visible_particle_direction(i, j), sizeof(float) * 3);
+        }
+
+        if (bRigid)
+            memcpy(state.rigid, pHair->get_rigidMotionMatrix(), sizeof(state.rigid));
+    }
+
+    void SimulationRunner::show(float time)
+    {
+        const State& a = slots[prev];
+        const State& b = slots[cur];
+        const float span = b.time - a.time;
+        const float s = span > 0.f ? std::min(1.f, std::max(0.f, (time - a.time) / span)) : 1.f;
+
+        frame = s < 0.5f ? a.frame : b.frame;
+        nSleeping = s < 0.5f ? a.nSleeping : b.nSleeping;
+        nFrame = b.nFrame;
+
+        pos.resize(b.pos.size());
+        for (size_t k = 0; k < pos.size(); k++)
+            pos[k] = a.pos[k] + s * (b.pos[k] - a.pos[k]);
+
+        if (bDirection)
+        {
+            dir.resize(b.dir.size());
+            for (size_t k = 0; k < dir.size(); k += 3)
+            {
+                float d[3], length = 0.f;
+                for (int c = 0; c < 3; c++)
+                {
+                    d[c] = a.dir[k + c] + s * (b.dir[k + c] - a.dir[k + c]);
+                    length += d[c] * d[c];
+                }
+                length = length > 0.f ? 1.f / std::sqrt(length) : 0.f;
+                for (int c = 0; c < 3; c++)
+                    dir[k + c] = d[c] * length;
+            }
+        }
+
+        if (bRigid)
+            for (int k = 0; k < 16; k++)
+                rigid[k] = a.rigid[k] + s * (b.rigid[k] - a.rigid[k]);
+    }
+}
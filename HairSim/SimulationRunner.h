@@ -0,0 +1,90 @@
+#pragma once
+#include "IHair.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace WR
+{
+    // Steps an IHair on its own thread at a fixed rate of the render clock and
+    // shows it to the renderer as an IHair itself.
+    //
+    // Finished steps are handed over lock-free: the worker fills its back slot
+    // and exchanges it with the middle one, the renderer takes the middle slot
+    // when it needs a newer state. The renderer keeps the last two states it
+    // took, so there are four slots, and shows them interpolated one step
+    // behind its clock. The worker runs at most one step ahead of the clock,
+    // which usually has the next state published before it is needed.
+    class SimulationRunner :
+        public IHair
+    {
+    public:
+        // rate in steps per second, pHair and pData have to outlive the runner
+        SimulationRunner(IHair* pHair, float rate, void* pData = nullptr);
+        ~SimulationRunner();
+
+        size_t n_strands() const { return nStrand; }
+        const float* get_visible_particle_position(size_t i, size_t j) const;
+        const float* get_visible_particle_direction(size_t i, size_t j) const;
+        const float* get_rigidMotionMatrix() const;
+        size_t get_original_strand_id(size_t i) const { return pHair->get_original_strand_id(i); }
+        // of the state nearer to the one shown
+        size_t getCurrentFrame() const { return frame; }
+        size_t getFrameNumber() const { return nFrame; }
+        size_t n_sleeping_strands() const { return nSleeping; }
+
+        // advances the clock and interpolates the latest states, never waits
+        // for the simulation. The data argument is ignored, the worker steps
+        // with the one given at construction.
+        void onFrame(Mat3 world, float fTime, float fTimeElapsed, void* = nullptr);
+
+        // runs f on the hair between two steps, e.g. to seek a cache, and
+        // shows the result at once
+        void exclusive(const std::function<void(IHair*)>& f);
+
+    private:
+        struct State
+        {
+            std::vector<float>  pos, dir;
+            float               rigid[16];
+            float               time;
+            size_t              frame, nFrame;
+            size_t              nSleeping;
+        };
+
+        enum { N_SLOT = 4, FRESH = 4 };
+
+        void run();
+        void capture(State& state, float time) const;
+        void show(float time);
+
+        IHair*      pHair;
+        void*       pData;
+        float       step;
+        size_t      nStrand;
+        bool        bDirection, bRigid;
+
+        State               slots[N_SLOT];
+        std::atomic<int>    middle;         // slot index, FRESH when newer than the renderer's
+        int                 back;           // the worker's
+        int                 prev, cur;      // the renderer's
+
+        // interpolated for the renderer
+        std::vector<float>  pos, dir;
+        float               rigid[16];
+        size_t              frame, nFrame;
+        size_t              nSleeping;
+
+        std::thread             worker;
+        std::mutex              mtx;        // clock, world and quit flag
+        std::mutex              stepMtx;    // the hair
+        std::condition_variable cv;
+        Mat3                    world;
+        float                   renderTime = 0.f, simTime = 0.f;
+        bool                    bStarted = false;
+        bool                    bQuit = false;
+    };
+}
@@ -1,6 +1,33 @@
 #include "DXUT.h"
 #include "SphereCollisionObject.h"
 #include <CGAL\bounding_box.h>
+#include <algorithm>
+#include <emmintrin.h>
+
+namespace
+{
+    // loads m < 4 trailing lanes, the rest repeats the last one
+    inline __m128 load_lanes(const float* p, size_t m)
+    {
+        if (m == 4) return _mm_loadu_ps(p);
+        float tmp[4];
+        for (size_t i = 0; i < 4; i++)
+            tmp[i] = p[std::min(i, m - 1)];
+        return _mm_loadu_ps(tmp);
+    }
+
+    inline void store_lanes(float* p, __m128 v, size_t m)
+    {
+        if (m == 4)
+        {
+            _mm_storeu_ps(p, v);
+            return;
+        }
+        float tmp[4];
+        _mm_storeu_ps(tmp, v);
+        std::copy(tmp, tmp + m, p);
+    }
+}
 
 namespace WR
 {
@@ -13,4 +40,55 @@ namespace WR
         radius *= 0.3f;
     }
 
+    void SphereCollisionObject::query_batch(CollisionBatch& b) const
+    {
+        const __m128 cx = _mm_set1_ps(center.x());
+        const __m128 cy = _mm_set1_ps(center.y());
+        const __m128 cz = _mm_set1_ps(center.z());
+        const __m128 r = _mm_set1_ps(radius);
+        const __m128 eps = _mm_set1_ps(1e-12f);
+
+        for (size_t i = 0; i < b.n; i += 4)
+        {
+            const size_t m = std::min<size_t>(4, b.n - i);
+            __m128 x = load_lanes(b.pos[0] + i, m);
+            __m128 y = load_lanes(b.pos[1] + i, m);
+            __m128 z = load_lanes(b.pos[2] + i, m);
+            __m128 t = b.thresh ? load_lanes(b.thresh + i, m) : _mm_set1_ps(b.uniformThresh);
+
+            __m128 dx = _mm_sub_ps(x, cx), dy = _mm_sub_ps(y, cy), dz = _mm_sub_ps(z, cz);
+            __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            __m128 inv = _mm_div_ps(_mm_set1_ps(1.f), _mm_max_ps(len, eps));
+            __m128 nx = _mm_mul_ps(dx, inv), ny = _mm_mul_ps(dy, inv), nz = _mm_mul_ps(dz, inv);
+            __m128 d = _mm_sub_ps(len, r);
+
+            if (b.dist) store_lanes(b.dist + i, d, m);
+            if (b.grad[0])
+            {
+                store_lanes(b.grad[0] + i, nx, m);
+                store_lanes(b.grad[1] + i, ny, m);
+                store_lanes(b.grad[2] + i, nz, m);
+            }
+
+            // same test as exceed_threshhold: |p - c| < r + thresh
+            __m128 mask = _mm_cmplt_ps(d, t);
+            if (b.collide)
+            {
+                int bits = _mm_movemask_ps(mask);
+                for (size_t k = 0; k < m; k++)
+                    b.collide[i + k] = (bits >> k) & 1;
+            }
+            if (b.corrected[0])
+            {
+                __m128 rt = _mm_add_ps(r, t);
+                __m128 px = _mm_add_ps(cx, _mm_mul_ps(nx, rt));
+                __m128 py = _mm_add_ps(cy, _mm_mul_ps(ny, rt));
+                __m128 pz = _mm_add_ps(cz, _mm_mul_ps(nz, rt));
+                store_lanes(b.corrected[0] + i, _mm_or_ps(_mm_and_ps(mask, px), _mm_andnot_ps(mask, x)), m);
+                store_lanes(b.corrected[1] + i, _mm_or_ps(_mm_and_ps(mask, py), _mm_andnot_ps(mask, y)), m);
+                store_lanes(b.corrected[2] + i, _mm_or_ps(_mm_and_ps(mask, pz), _mm_andnot_ps(mask, z)), m);
+            }
+        }
+    }
+
 }
\ No newline at end of file
@@ -43,6 +43,9 @@ namespace WR
             else return false;
         }
 
+        // SSE, four points per iteration
+        virtual void query_batch(CollisionBatch& b) const;
+
         //CGAL::Bbox_3 bbox() const { return box; };
         //Point_3 center() const { return Point_3((box.xmax() + box.xmin()) / 2, (box.ymax() + box.ymin()) / 2, (box.zmax() + box.zmin()) / 2); }
         //float radius() const { return sqrt(Vector_3((box.xmax() - box.xmin()) / 2, (box.ymax() - box.ymin()) / 2, (box.zmax() - box.zmin()) / 2).squared_length()) / 1.4; }
@@ -15,6 +15,7 @@
 #include "SDKmesh.h"
 #include "resource.h"
 #include "CacheHair.h"
+#include "Parameter.h"
 
 #include "wrSceneManager.h"
 
@@ -170,8 +171,15 @@ void RenderText()
     g_pTxtHelper->SetForegroundColor( Colors::Yellow );
     g_pTxtHelper->DrawTextLine( DXUTGetFrameStats( DXUTIsVsyncEnabled() ) );
     g_pTxtHelper->DrawTextLine( DXUTGetDeviceStats() );
-    auto pHair = dynamic_cast<WR::CacheHair20*>(g_SceneMngr.pHair);
-    g_pTxtHelper->DrawFormattedTextLine(L"Frame: %d / %d", pHair->getCurrentFrame(), pHair->getFrameNumber());
+    auto pHair = g_SceneMngr.getShownHair();
+    if (pHair->getFrameNumber() > 0)
+        g_pTxtHelper->DrawFormattedTextLine(L"Frame: %d / %d", pHair->getCurrentFrame(), pHair->getFrameNumber());
+    if (SLEEP_SPEED > 0.f)
+    {
+        size_t nSleeping = pHair->n_sleeping_strands();
+        g_pTxtHelper->DrawFormattedTextLine(L"Strands: %d active, %d sleeping",
+            static_cast<int>(pHair->n_strands() - nSleeping), static_cast<int>(nSleeping));
+    }
     g_pTxtHelper->End();
 }
 
@@ -1,7 +1,10 @@
 #include "wrHair.h"
+#include <algorithm>
+#include <cfloat>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <ppl.h>
 #include "Parameter.h"
 #include "linmath.h"
 #include "wrMath.h"
@@ -29,6 +32,62 @@ namespace
         { 1, 3, 0 }
     };
 
+    // particles nearer to the body are collided, in body space
+    const float COLLISION_THRESHOLD = 3e-3f;
+    // body queries are batched over this many strands
+    const size_t STRANDS_PER_CHUNK = 32;
+    // solves of the contact update loop
+    const int MAX_CONTACT_ITERATION = 4;
+
+    enum ContactState { FREE, IN_CONTACT, RELEASED };
+
+    // bound on the slope of the body distance, a little over 1 since the
+    // interpolated distance fields are not exactly 1-Lipschitz
+    const float CCD_LIPSCHITZ = 1.2f;
+    // advancement stops this much outside the threshold
+    const float CCD_TOLERANCE = 0.1f * COLLISION_THRESHOLD;
+    // particles still advancing after these steps stop where they are
+    const int MAX_CCD_ITERATION = 16;
+
+    // steps in a row below SLEEP_SPEED before a strand falls asleep
+    const int SLEEP_STEPS = 30;
+    // root acceleration that wakes a strand
+    const float WAKE_ACCELERATION = 0.5f;
+    // cosine of the turn of gravity in body space that wakes a strand, 2 degrees
+    const float WAKE_GRAVITY_COS = 0.9994f;
+    // a sleeping strand is checked against the body every this many steps
+    const size_t WAKE_CHECK_INTERVAL = 8;
+
+    // distances, and gradients if grad is set, of body space points
+    void query_points(const ICollisionObject* pCollision, const std::vector<Vec3>& q, float* dist, float* grad = nullptr)
+    {
+        const size_t n = q.size();
+        std::vector<float> buffer(3 * n);
+        for (size_t k = 0; k < n; k++)
+            for (int d = 0; d < 3; d++)
+                buffer[d * n + k] = q[k][d];
+
+        CollisionBatch batch(n);
+        for (int d = 0; d < 3; d++)
+        {
+            batch.pos[d] = buffer.data() + d * n;
+            if (grad) batch.grad[d] = grad + d * n;
+        }
+        batch.dist = dist;
+        pCollision->query_batch(batch);
+    }
+
+    // spreads the low 10 bits of x to every third bit
+    unsigned spread_bits(unsigned x)
+    {
+        x &= 0x3ff;
+        x = (x | (x << 16)) & 0x030000ff;
+        x = (x | (x << 8)) & 0x0300f00f;
+        x = (x | (x << 4)) & 0x030c30c3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
     inline void remove_vertical_comp(const Vec3& n, Vec3& v)
     {
         Vec3 diff = n.normalized();
@@ -142,6 +201,9 @@ namespace WR
 #endif
             }
 
+            if (hair && SORT_STRANDS)
+                hair->sort_strands();
+
             file.close();
             return hair;
         }
@@ -221,6 +283,62 @@ namespace WR
         return true;
     }
 
+    void Hair::sort_strands()
+    {
+        assert(!mb_simInited);
+        const size_t ns = m_strands.size();
+        if (ns < 2) return;
+
+        // roots quantized to 10 bits per axis of their box
+        Vec3 lo = Vec3::Constant(FLT_MAX), hi = Vec3::Constant(-FLT_MAX);
+        for (auto& strand : m_strands)
+        {
+            const Vec3& root = m_particles[strand.get_particle(2)].get_ref();
+            lo = lo.cwiseMin(root);
+            hi = hi.cwiseMax(root);
+        }
+        const float extent = std::max((hi - lo).maxCoeff(), 1e-6f);
+
+        std::vector<std::pair<unsigned, size_t>> keys(ns);
+        for (size_t i = 0; i < ns; i++)
+        {
+            Vec3 q = (m_particles[m_strands[i].get_particle(2)].get_ref() - lo) * (1023.f / extent);
+            keys[i].first = spread_bits(unsigned(q.x())) | (spread_bits(unsigned(q.y())) << 1) | (spread_bits(unsigned(q.z())) << 2);
+            keys[i].second = i;
+        }
+        std::sort(keys.begin(), keys.end());
+
+        // a strand's particles stay consecutive, springs are pushed from them later
+        std::vector<HairParticle> particles;
+        std::vector<HairStrand> strands(ns);
+        std::vector<size_t> originalIds(ns);
+        std::vector<int> newIds(m_particles.size());
+        particles.reserve(m_particles.size());
+        for (size_t k = 0; k < ns; k++)
+        {
+            const size_t i = keys[k].second;
+            const HairStrand& strand = m_strands[i];
+            originalIds[k] = m_originalIds.empty() ? i : m_originalIds[i];
+
+            for (int id : strand.m_parIds)
+            {
+                newIds[id] = static_cast<int>(particles.size());
+                particles.push_back(m_particles[id]);
+                particles.back().m_Id = newIds[id];
+            }
+
+            strands[k].reserve(strand.m_parIds.size(), strand.m_visibleParticles.size());
+            for (int id : strand.m_parIds)
+                strands[k].m_parIds.push_back(newIds[id]);
+            for (int id : strand.m_visibleParticles)
+                strands[k].m_visibleParticles.push_back(newIds[id]);
+        }
+
+        m_particles.swap(particles);
+        m_strands.swap(strands);
+        m_originalIds.swap(originalIds);
+    }
+
     void Hair::add_particle(HairStrand& strand, const vec3& pos, float mass_1, bool isPerturbed, bool isFixedPos, bool isVisible)
     {
         size_t idx = add_particle(pos, mass_1, isPerturbed, isFixedPos);
@@ -251,6 +369,11 @@ namespace WR
         m_strands.clear();
         m_segments.clear();
         m_strain_limits.clear();
+        m_activity.clear();
+        m_strandSprings.clear();
+        m_strandLimits.clear();
+        m_originalIds.clear();
+        m_nSleeping = 0;
     }
 
     bool Hair::init_simulation()
@@ -275,6 +398,13 @@ namespace WR
         m_filter.resize(3 * n);
         m_filter.setOnes();
 
+        m_lastWorld = Mat3::Identity();
+
+        StrandActivity awake = { 0, false, Vec3::Zero(), 0.f };
+        m_activity.assign(m_strands.size(), awake);
+        m_nSleeping = 0;
+        m_nStep = 0;
+
         m_gravity.resize(3 * n);
         m_gravity.setZero();
         for (size_t i = 0; i < n; i++)
@@ -325,6 +455,7 @@ namespace WR
         {
             auto & strand = m_strands[i];
             size_t np = strand.m_parIds.size();
+            auto last = m_strain_limits.empty() ? m_strain_limits.end() : std::prev(m_strain_limits.end());
             for (size_t i = 4; i < np; i++)
             {
                 data = new StrainLimitPair;
@@ -346,6 +477,7 @@ namespace WR
                 data->squared_length = diff.dot(diff);
                 m_strain_limits.push_back(data);
             }
+            m_strandLimits.push_back(last == m_strain_limits.end() ? m_strain_limits.begin() : std::next(last));
         }
     }
 
@@ -356,8 +488,10 @@ namespace WR
         {
             auto & strand = m_strands[i];
             size_t np = strand.m_parIds.size();
+            auto last = m_springs.empty() ? m_springs.end() : std::prev(m_springs.end());
             for (size_t i = 3; i < np; i++)
                 push_springs(strand.m_parIds[i]);
+            m_strandSprings.push_back(last == m_springs.end() ? m_springs.begin() : std::next(last));
         }
     }
 
@@ -419,17 +553,26 @@ namespace WR
 
         // modify root node's pos, vel. first 3.
         // ̶㶼˶
-        for (auto &strand : m_strands)
+        for (size_t i = 0; i < m_strands.size(); i++)
         {
+            auto &strand = m_strands[i];
+            float rootDv = 0.f;
             for (int j = 0; j < 3; j++)
             {
                 size_t idx = strand.get_particle(j);
                 Vec3 newPos = get_particle(idx).transposeFromReference(mWorld);
                 Vec3 newVel = (newPos - Vec3(get_particle_position(idx))) / fTimeElapsed;
+                rootDv = std::max(rootDv, (newVel - triple(m_velocity, idx)).norm());
                 triple(m_velocity, idx) = newVel;
             }
+
+            if (m_activity[i].bAsleep && rootDv > WAKE_ACCELERATION * fTimeElapsed)
+                set_asleep(i, false);
         }
 
+        if (m_nSleeping)
+            wake_sleeping(mWorld);
+
         size_t dim = m_position.size();
         SparseMatAssemble K(dim, dim), B(dim, dim);
         K.reserve(VecX::Constant(dim, 30));
@@ -441,8 +584,14 @@ namespace WR
         VecX C(dim);
         C.setZero();
 
-        for (auto &spring : m_springs)
-            spring->applyForces(K, B, C);
+        for (size_t i = 0; i < m_strands.size(); i++)
+        {
+            if (m_activity[i].bAsleep) continue;
+
+            auto end = i + 1 < m_strands.size() ? m_strandSprings[i + 1] : m_springs.end();
+            for (auto spring = m_strandSprings[i]; spring != end; ++spring)
+                (*spring)->applyForces(K, B, C);
+        }
 
         K.flush();
         B.flush();
@@ -456,7 +605,10 @@ namespace WR
         {
             SparseMat A = m_mass + T * fTimeElapsed;
             VecX b = -fTimeElapsed * (((K * m_position - C) + T * m_velocity) - m_gravity);
-            modified_pcg(A, b, dv);
+            if (APPLY_COLLISION && CONTACT_CONSTRAINT)
+                solve_with_contacts(mWorld, A, b, fTimeElapsed, dv);
+            else
+                modified_pcg(A, b, VecX::Zero(dim), dv);
         }
         else
         {
@@ -471,9 +623,18 @@ namespace WR
         m_velocity += dv;
         VecX newPos = m_position + m_velocity * fTimeElapsed;
 
+        const Mat3 mCarry = mWorld * m_lastWorld.inverse();
+        if (m_nSleeping)
+            carry_sleeping(mCarry, newPos, m_velocity, fTimeElapsed);
+
         if (APPLY_STRAINLIMIT)
             resolve_strain_limits(newPos, m_velocity, fTimeElapsed);
 
+        if (APPLY_COLLISION && APPLY_CCD)
+            resolve_continuous_collision(mWorld, newPos, m_velocity, fTimeElapsed);
+
+        // last, also behind the contact solve: the strain limits, friction and
+        // CCD slides move particles after it
         if (APPLY_COLLISION)
             resolve_body_collision(mWorld, newPos, m_velocity, fTimeElapsed);
 
@@ -481,7 +642,12 @@ namespace WR
         //    if (std::isnan(newPos[i]))
         //        std::cout << i << std::endl;
 
+        if (SLEEP_SPEED > 0.f)
+            update_sleep(mWorld, mCarry, newPos, fTimeElapsed);
+
         m_position = newPos;
+        m_lastWorld = mWorld;
+        m_nStep++;
 
 #else
         const float tdiv2 = fTimeElapsed / 2;
@@ -491,7 +657,7 @@ namespace WR
         VecX b = -tdiv2 * ((K * m_position - C) + T * m_velocity);
 
         VecX dv(dim);
-        modified_pcg(A, b, dv);
+        modified_pcg(A, b, VecX::Zero(dim), dv);
 
         m_velocity += 2 *dv;
         VecX v_1_2 = m_velocity - dv;
@@ -519,7 +685,17 @@ namespace WR
         dv = solver.solve(b);
     }
 
-    void Hair::modified_pcg(const SparseMat& A, const VecX& b, VecX& dv) const
+    void Hair::filter(const VecX& vec, VecX& res) const
+    {
+        res = m_filter.cwiseProduct(vec);
+        for (auto& contact : m_contacts)
+        {
+            auto r = triple(res, contact.id);
+            r -= contact.normal.dot(r) * contact.normal;
+        }
+    }
+
+    void Hair::modified_pcg(const SparseMat& A, const VecX& b, const VecX& z, VecX& dv) const
     {
         const size_t dim = b.size();
 
@@ -538,7 +714,7 @@ namespace WR
 
         const float tol = 1e-7, tol_square = tol * tol;
 
-        dv.setZero();
+        dv = z;
         filter(b, b_f);
         const float delta0 = b_f.transpose() * P * b_f;
         filter(b - A*dv, r);
@@ -579,56 +755,487 @@ namespace WR
     
     void Hair::resolve_body_collision(const Mat3& mWorld, VecX& pos, VecX& vel, float t) const
     {
-        auto mInvWorld = mWorld.inverse();
-        size_t ns = m_strands.size();
-        for (size_t i = 0; i < ns; i++)
+        // strands are gathered in chunks into body space SoA buffers, one batched
+        // query per chunk. Chunks touch disjoint particles and run in parallel.
+        const Mat3 mInvWorld = mWorld.inverse();
+        const ICollisionObject* pCollision = mp_data->pCollisionHead;
+        const size_t ns = m_strands.size();
+        const size_t nChunk = (ns + STRANDS_PER_CHUNK - 1) / STRANDS_PER_CHUNK;
+
+        concurrency::parallel_for(size_t(0), nChunk, [&](size_t c)
+        {
+            std::vector<int> ids;
+            for (size_t i = c * STRANDS_PER_CHUNK; i < std::min(ns, (c + 1) * STRANDS_PER_CHUNK); i++)
+            {
+                if (m_activity[i].bAsleep) continue;
+
+                auto& visible = m_strands[i].m_visibleParticles;
+                if (visible.size() > 1)
+                    ids.insert(ids.end(), visible.begin() + 1, visible.end());
+            }
+
+            const size_t n = ids.size();
+            std::vector<float> buffer(6 * n);
+            std::vector<unsigned char> collide(n);
+            for (size_t k = 0; k < n; k++)
+            {
+                Vec3 p = mInvWorld * triple(pos, ids[k]);
+                for (int d = 0; d < 3; d++)
+                    buffer[d * n + k] = p[d];
+            }
+
+            CollisionBatch batch(n);
+            for (int d = 0; d < 3; d++)
+            {
+                batch.pos[d] = buffer.data() + d * n;
+                batch.corrected[d] = buffer.data() + (3 + d) * n;
+            }
+            batch.uniformThresh = COLLISION_THRESHOLD;
+            batch.collide = collide.data();
+            pCollision->query_batch(batch);
+
+            for (size_t k = 0; k < n; k++)
+            {
+                if (!collide[k]) continue;
+
+                const int idx = ids[k];
+                Vec3 p = mWorld * Vec3(batch.corrected[0][k], batch.corrected[1][k], batch.corrected[2][k]);
+                triple(pos, idx) = p;
+                triple(vel, idx) = (p - Vec3(get_particle_position(idx))) / t;
+            }
+        });
+    }
+
+    void Hair::resolve_continuous_collision(const Mat3& mWorld, VecX& pos, VecX& vel, float t) const
+    {
+        // each particle moves on the segment from its start, in the body space
+        // of the last step, to its end in the current one. Its distance at
+        // the start bounds how far along it can safely go; only the segments
+        // that may reach the threshold are advanced.
+        const Mat3 mInvLast = m_lastWorld.inverse();
+        const Mat3 mInvWorld = mWorld.inverse();
+        const ICollisionObject* pCollision = mp_data->pCollisionHead;
+        const size_t ns = m_strands.size();
+        const size_t nChunk = (ns + STRANDS_PER_CHUNK - 1) / STRANDS_PER_CHUNK;
+
+        concurrency::parallel_for(size_t(0), nChunk, [&](size_t c)
         {
-            size_t nvp = m_strands[i].m_visibleParticles.size();
-            for (size_t j = 1; j < nvp; j++)
+            std::vector<int> ids;
+            std::vector<Vec3> q0, dq;
+            for (size_t i = c * STRANDS_PER_CHUNK; i < std::min(ns, (c + 1) * STRANDS_PER_CHUNK); i++)
             {
-                size_t idx = m_strands[i].m_visibleParticles[j];
-                Vec3 p = mInvWorld * triple(pos, idx);
-                ICollisionObject::Point_3 p1, p0 = ICollisionObject::Point_3(p[0], p[1], p[2]);
-                bool isCollide = mp_data->pCollisionHead->position_correlation(p0, &p1, 3e-3f);
-                if (isCollide)
+                if (m_activity[i].bAsleep) continue;
+
+                auto& visible = m_strands[i].m_visibleParticles;
+                for (size_t j = 1; j < visible.size(); j++)
                 {
-                    convert3(p, p1);
-                    p = mWorld * p;
-                    triple(pos, idx) = p;
-                    triple(vel, idx) = (p - Vec3(get_particle_position(idx))) / t;
+                    const int idx = visible[j];
+                    ids.push_back(idx);
+                    q0.push_back(mInvLast * triple(m_position, idx));
+                    dq.push_back(mInvWorld * triple(pos, idx) - q0.back());
                 }
             }
+
+            std::vector<float> d0(ids.size());
+            query_points(pCollision, q0, d0.data());
+
+            // particles already within the threshold are left to the discrete
+            // pass, which step runs after this one whenever collisions are on
+            std::vector<size_t> active;
+            std::vector<float> tc, length;
+            for (size_t k = 0; k < ids.size(); k++)
+            {
+                const float l = dq[k].norm();
+                if (d0[k] <= COLLISION_THRESHOLD || d0[k] - CCD_LIPSCHITZ * l > COLLISION_THRESHOLD)
+                    continue;
+                active.push_back(k);
+                tc.push_back(0.f);
+                length.push_back(l);
+            }
+            if (active.empty()) return;
+
+            // conservative advancement: the distance cannot drop faster than
+            // CCD_LIPSCHITZ times the path length
+            std::vector<float> dist(d0.size());
+            for (size_t a = 0; a < active.size(); a++)
+                dist[a] = d0[active[a]];
+
+            std::vector<size_t> hits;
+            std::vector<float> hitT;
+            std::vector<Vec3> q;
+            for (int iter = 0; iter < MAX_CCD_ITERATION && !active.empty(); iter++)
+            {
+                size_t m = 0;
+                for (size_t a = 0; a < active.size(); a++)
+                {
+                    const float step = (dist[a] - COLLISION_THRESHOLD) / (CCD_LIPSCHITZ * length[a]);
+                    if (tc[a] + step >= 1.f) continue;
+                    active[m] = active[a];
+                    tc[m] = tc[a] + step;
+                    length[m] = length[a];
+                    m++;
+                }
+                active.resize(m);
+                tc.resize(m);
+                length.resize(m);
+
+                q.resize(m);
+                for (size_t a = 0; a < m; a++)
+                    q[a] = q0[active[a]] + tc[a] * dq[active[a]];
+                query_points(pCollision, q, dist.data());
+
+                m = 0;
+                for (size_t a = 0; a < active.size(); a++)
+                {
+                    if (dist[a] < COLLISION_THRESHOLD + CCD_TOLERANCE)
+                    {
+                        hits.push_back(active[a]);
+                        hitT.push_back(tc[a]);
+                        continue;
+                    }
+                    active[m] = active[a];
+                    tc[m] = tc[a];
+                    length[m] = length[a];
+                    dist[m] = dist[a];
+                    m++;
+                }
+                active.resize(m);
+                tc.resize(m);
+                length.resize(m);
+            }
+
+            // those still advancing stop at the safe point reached so far
+            hits.insert(hits.end(), active.begin(), active.end());
+            hitT.insert(hitT.end(), tc.begin(), tc.end());
+            if (hits.empty()) return;
+
+            // the rest of the step slides along the body
+            const size_t nHit = hits.size();
+            q.resize(nHit);
+            for (size_t h = 0; h < nHit; h++)
+                q[h] = q0[hits[h]] + hitT[h] * dq[hits[h]];
+            std::vector<float> hitDist(nHit), grad(3 * nHit);
+            query_points(pCollision, q, hitDist.data(), grad.data());
+
+            for (size_t h = 0; h < nHit; h++)
+            {
+                const size_t k = hits[h];
+                Vec3 rest = (1.f - hitT[h]) * dq[k];
+                Vec3 normal(grad[h], grad[nHit + h], grad[2 * nHit + h]);
+                if (normal.squaredNorm() > 0.f)
+                {
+                    normal.normalize();
+                    rest -= std::min(0.f, normal.dot(rest)) * normal;
+                }
+
+                const int idx = ids[k];
+                Vec3 p = mWorld * (q[h] + rest);
+                triple(pos, idx) = p;
+                triple(vel, idx) = (p - Vec3(get_particle_position(idx))) / t;
+            }
+        });
+    }
+
+    void Hair::solve_with_contacts(const Mat3& mWorld, const SparseMat& A, const VecX& b, float t, VecX& dv)
+    {
+        const size_t dim = b.size();
+        VecX z = VecX::Zero(dim);
+        std::vector<unsigned char> state(m_particles.size(), FREE);
+        m_contacts.clear();
+
+        dv.setZero();
+        add_contacts(mWorld, dv, t, z, state);
+        modified_pcg(A, b, z, dv);
+
+        // the residual A dv - b is the constraint force of the contacts
+        for (int i = 1; i < MAX_CONTACT_ITERATION; i++)
+        {
+            bool released = release_contacts(A * dv - b, z, state);
+            bool added = add_contacts(mWorld, dv, t, z, state);
+            if (!released && !added)
+                break;
+            modified_pcg(A, b, z, dv);
+        }
+
+        apply_friction(A * dv - b, dv);
+        m_contacts.clear();
+    }
+
+    bool Hair::add_contacts(const Mat3& mWorld, const VecX& dv, float t, VecX& z, std::vector<unsigned char>& state)
+    {
+        const Mat3 mInvWorld = mWorld.inverse();
+        const Mat3 mNormal = mInvWorld.transpose();
+        const ICollisionObject* pCollision = mp_data->pCollisionHead;
+        const size_t ns = m_strands.size();
+        const size_t nChunk = (ns + STRANDS_PER_CHUNK - 1) / STRANDS_PER_CHUNK;
+
+        std::vector<std::vector<Contact>> found(nChunk);
+        std::vector<std::vector<float>> targets(nChunk);
+        concurrency::parallel_for(size_t(0), nChunk, [&](size_t c)
+        {
+            std::vector<int> ids;
+            for (size_t i = c * STRANDS_PER_CHUNK; i < std::min(ns, (c + 1) * STRANDS_PER_CHUNK); i++)
+            {
+                if (m_activity[i].bAsleep) continue;
+
+                auto& visible = m_strands[i].m_visibleParticles;
+                for (size_t j = 1; j < visible.size(); j++)
+                    if (state[visible[j]] == FREE)
+                        ids.push_back(visible[j]);
+            }
+
+            // where the particles end up with the current solution
+            const size_t n = ids.size();
+            std::vector<float> buffer(7 * n);
+            for (size_t k = 0; k < n; k++)
+            {
+                const int idx = ids[k];
+                Vec3 p = mInvWorld * (triple(m_position, idx) + t * (triple(m_velocity, idx) + triple(dv, idx)));
+                for (int d = 0; d < 3; d++)
+                    buffer[d * n + k] = p[d];
+            }
+
+            CollisionBatch batch(n);
+            for (int d = 0; d < 3; d++)
+            {
+                batch.pos[d] = buffer.data() + d * n;
+                batch.grad[d] = buffer.data() + (4 + d) * n;
+            }
+            batch.dist = buffer.data() + 3 * n;
+            pCollision->query_batch(batch);
+
+            // the normal velocity change that ends the step on the threshold
+            for (size_t k = 0; k < n; k++)
+            {
+                if (batch.dist[k] >= COLLISION_THRESHOLD) continue;
+
+                Vec3 normal = mNormal * Vec3(batch.grad[0][k], batch.grad[1][k], batch.grad[2][k]);
+                if (normal.squaredNorm() == 0.f) continue;
+                normal.normalize();
+
+                Contact contact = { ids[k], normal };
+                found[c].push_back(contact);
+                targets[c].push_back(normal.dot(triple(dv, ids[k])) + (COLLISION_THRESHOLD - batch.dist[k]) / t);
+            }
+        });
+
+        bool added = false;
+        for (size_t c = 0; c < nChunk; c++)
+        {
+            for (size_t k = 0; k < found[c].size(); k++)
+            {
+                const Contact& contact = found[c][k];
+                state[contact.id] = IN_CONTACT;
+                triple(z, contact.id) = targets[c][k] * contact.normal;
+                m_contacts.push_back(contact);
+                added = true;
+            }
         }
+        return added;
     }
 
+    // a released particle stays free for the rest of the step, which keeps it
+    // from flipping between both
+    bool Hair::release_contacts(const VecX& force, VecX& z, std::vector<unsigned char>& state)
+    {
+        auto end = std::remove_if(m_contacts.begin(), m_contacts.end(), [&](const Contact& contact)
+        {
+            if (contact.normal.dot(triple(force, contact.id)) >= 0.f)
+                return false;
+
+            state[contact.id] = RELEASED;
+            triple(z, contact.id).setZero();
+            return true;
+        });
 
-    void Hair::resolve_strain_limits(VecX& pos, VecX& vel, float t) const
+        bool released = end != m_contacts.end();
+        m_contacts.erase(end, m_contacts.end());
+        return released;
+    }
+
+    // Coulomb friction against a body at rest: the tangential velocity is
+    // reduced by at most FRICTION times the normal impulse over the mass
+    void Hair::apply_friction(const VecX& force, VecX& dv) const
     {
-        bool flag = false;
-        for (auto &limit : m_strain_limits)
+        for (auto& contact : m_contacts)
+        {
+            const int idx = contact.id;
+            const float impulse = contact.normal.dot(triple(force, idx));
+            if (impulse <= 0.f) continue;
+
+            Vec3 v = triple(m_velocity, idx) + triple(dv, idx);
+            Vec3 vt = v - contact.normal.dot(v) * contact.normal;
+            const float vtLength = vt.norm();
+            if (vtLength == 0.f) continue;
+
+            const float maxChange = FRICTION * impulse * m_particles[idx].get_mass_1();
+            triple(dv, idx) -= vt * std::min(1.f, maxChange / vtLength);
+        }
+    }
+
+    void Hair::set_asleep(size_t i, bool bAsleep)
+    {
+        auto& activity = m_activity[i];
+        if (activity.bAsleep == bAsleep) return;
+
+        activity.bAsleep = bAsleep;
+        activity.quietSteps = 0;
+        if (bAsleep) m_nSleeping++;
+        else m_nSleeping--;
+
+        // the filter keeps sleeping particles out of the solve
+        for (int idx : m_strands[i].m_parIds)
+            if (!m_particles[idx].isFixedPos())
+                triple(m_filter, idx) = bAsleep ? Vec3::Zero() : Vec3::Ones();
+    }
+
+    void Hair::wake_sleeping(const Mat3& mWorld)
+    {
+        const Vec3 gravity = (mWorld.inverse() * Vec3(GRAVITY)).normalized();
+        std::vector<size_t> checked;
+        for (size_t i = 0; i < m_strands.size(); i++)
+        {
+            const auto& activity = m_activity[i];
+            if (!activity.bAsleep) continue;
+
+            if (gravity.dot(activity.gravity) < WAKE_GRAVITY_COS)
+                set_asleep(i, false);
+            else if ((i + m_nStep) % WAKE_CHECK_INTERVAL == 0)
+                checked.push_back(i);
+        }
+
+        // the strands ride with the body, only a moving collider gets nearer
+        if (!APPLY_COLLISION || checked.empty()) return;
+
+        std::vector<float> dist;
+        body_distance(m_lastWorld, m_position, checked, dist);
+        for (size_t k = 0; k < checked.size(); k++)
+            if (dist[k] < m_activity[checked[k]].distance - COLLISION_THRESHOLD)
+                set_asleep(checked[k], false);
+    }
+
+    void Hair::carry_sleeping(const Mat3& mCarry, VecX& pos, VecX& vel, float t) const
+    {
+        for (size_t i = 0; i < m_strands.size(); i++)
         {
-            Vec3 diff = Vec3(get_particle_position(limit->Id[0])) - Vec3(get_particle_position(limit->Id[1]));
-            Vec3 pred_diff = triple(pos, limit->Id[0]) - triple(pos, limit->Id[1]);
-            float sqRatio = pred_diff.dot(pred_diff) / limit->squared_length;
+            if (!m_activity[i].bAsleep) continue;
 
-            if (sqRatio > 1.21f)
+            for (int idx : m_strands[i].m_parIds)
             {
-                flag = true;
-                pred_diff *=  1.1 / sqrt(sqRatio);
+                if (m_particles[idx].isFixedPos()) continue;
+
+                Vec3 p = mCarry * triple(m_position, idx);
+                triple(vel, idx) = (p - triple(m_position, idx)) / t;
+                triple(pos, idx) = p;
             }
-            else if (sqRatio < 0.81f)
+        }
+    }
+
+    // the kinetic energy of a strand is taken relative to the body: of what
+    // is left of the step after carrying the particles rigidly with it
+    void Hair::update_sleep(const Mat3& mWorld, const Mat3& mCarry, const VecX& pos, float t)
+    {
+        const float squaredStep = SLEEP_SPEED * SLEEP_SPEED * t * t;
+        std::vector<size_t> asleep;
+        for (size_t i = 0; i < m_strands.size(); i++)
+        {
+            auto& activity = m_activity[i];
+            if (activity.bAsleep) continue;
+
+            float energy = 0.f, mass = 0.f;
+            for (int idx : m_strands[i].m_parIds)
             {
-                flag = true;
-                pred_diff *= 0.9 / sqrt(sqRatio);
+                if (m_particles[idx].isFixedPos()) continue;
+
+                const float m = 1.f / m_particles[idx].get_mass_1();
+                energy += m * (triple(pos, idx) - mCarry * triple(m_position, idx)).squaredNorm();
+                mass += m;
             }
 
-            if (flag)
+            if (energy > mass * squaredStep)
+                activity.quietSteps = 0;
+            else if (++activity.quietSteps >= SLEEP_STEPS)
+                asleep.push_back(i);
+        }
+        if (asleep.empty()) return;
+
+        std::vector<float> dist(asleep.size(), FLT_MAX);
+        if (APPLY_COLLISION)
+            body_distance(mWorld, pos, asleep, dist);
+
+        const Vec3 gravity = (mWorld.inverse() * Vec3(GRAVITY)).normalized();
+        for (size_t k = 0; k < asleep.size(); k++)
+        {
+            set_asleep(asleep[k], true);
+            m_activity[asleep[k]].gravity = gravity;
+            m_activity[asleep[k]].distance = dist[k];
+        }
+    }
+
+    void Hair::body_distance(const Mat3& mWorld, const VecX& pos, const std::vector<size_t>& strands, std::vector<float>& dist) const
+    {
+        const Mat3 mInvWorld = mWorld.inverse();
+        const ICollisionObject* pCollision = mp_data->pCollisionHead;
+        const size_t ns = strands.size();
+        const size_t nChunk = (ns + STRANDS_PER_CHUNK - 1) / STRANDS_PER_CHUNK;
+
+        dist.assign(ns, FLT_MAX);
+        concurrency::parallel_for(size_t(0), nChunk, [&](size_t c)
+        {
+            std::vector<Vec3> q;
+            std::vector<size_t> owner;
+            for (size_t s = c * STRANDS_PER_CHUNK; s < std::min(ns, (c + 1) * STRANDS_PER_CHUNK); s++)
+            {
+                auto& visible = m_strands[strands[s]].m_visibleParticles;
+                for (size_t j = 1; j < visible.size(); j++)
+                {
+                    q.push_back(mInvWorld * triple(pos, visible[j]));
+                    owner.push_back(s);
+                }
+            }
+            if (q.empty()) return;
+
+            std::vector<float> d(q.size());
+            query_points(pCollision, q, d.data());
+            for (size_t k = 0; k < q.size(); k++)
+                dist[owner[k]] = std::min(dist[owner[k]], d[k]);
+        });
+    }
+
+    void Hair::resolve_strain_limits(VecX& pos, VecX& vel, float t) const
+    {
+        bool flag = false;
+        for (size_t i = 0; i < m_strands.size(); i++)
+        {
+            if (m_activity[i].bAsleep) continue;
+
+            auto end = i + 1 < m_strands.size() ? m_strandLimits[i + 1] : m_strain_limits.end();
+            for (auto it = m_strandLimits[i]; it != end; ++it)
             {
-                flag = false;
-                Vec3 newpos = pred_diff + triple(pos, limit->Id[1]);
-                triple(pos, limit->Id[0]) = newpos;
-                //triple(vel, limit->Id[0]) = (pred_diff - diff) / t + triple(vel, limit->Id[1]);
-                triple(vel, limit->Id[0]) = (newpos - Vec3(get_particle_position(limit->Id[0]))) / t;
+                auto limit = *it;
+                Vec3 diff = Vec3(get_particle_position(limit->Id[0])) - Vec3(get_particle_position(limit->Id[1]));
+                Vec3 pred_diff = triple(pos, limit->Id[0]) - triple(pos, limit->Id[1]);
+                float sqRatio = pred_diff.dot(pred_diff) / limit->squared_length;
+
+                if (sqRatio > 1.21f)
+                {
+                    flag = true;
+                    pred_diff *=  1.1 / sqrt(sqRatio);
+                }
+                else if (sqRatio < 0.81f)
+                {
+                    flag = true;
+                    pred_diff *= 0.9 / sqrt(sqRatio);
+                }
+
+                if (flag)
+                {
+                    flag = false;
+                    Vec3 newpos = pred_diff + triple(pos, limit->Id[1]);
+                    triple(pos, limit->Id[0]) = newpos;
+                    //triple(vel, limit->Id[0]) = (pred_diff - diff) / t + triple(vel, limit->Id[1]);
+                    triple(vel, limit->Id[0]) = (newpos - Vec3(get_particle_position(limit->Id[0]))) / t;
+                }
             }
         }
     }
@@ -98,9 +98,13 @@ namespace WR
 
         bool add_strand(float* positions, size_t n = N_PARTICLES_PER_STRAND);
         void reserve(size_t np, size_t ns) { m_strands.reserve(ns); m_particles.reserve(np); }
+        // orders the strands along a Morton curve over their roots and renumbers
+        // the particles to match, before init_simulation
+        void sort_strands();
 
         size_t n_strands() const{ return m_strands.size(); }
         const HairStrand& get_strand(size_t idx) const { return m_strands[idx]; }
+        size_t get_original_strand_id(size_t i) const { return m_originalIds.empty() ? i : m_originalIds[i]; }
 
         size_t n_particles() const{ return m_particles.size(); }
         const HairParticle& get_particle(size_t idx) const { return m_particles[idx]; }
@@ -108,6 +112,8 @@ namespace WR
         const float* get_visible_particle_position(size_t i, size_t j) const { return get_particle_position(get_strand(i).get_visible_particle(j)); }
         const float* get_particle_position(size_t i) const { return reinterpret_cast<const float*>(&m_position(3 * i)); }
 
+        size_t n_sleeping_strands() const { return m_nSleeping; }
+
     private:
         size_t add_particle(const vec3&, float mass_1, bool isPerturbed = false, bool isFixedPos = false);
         void add_particle(HairStrand& strand, const vec3&, float mass_1, bool isPerturbed = false, bool isFixedPos = false, bool isVisible = true);
@@ -121,11 +127,34 @@ namespace WR
 
         void resolve_strain_limits(VecX& pos, VecX& vel, float t) const;
         void resolve_body_collision(const Mat3& mWorld, VecX& pos, VecX& vel, float t) const;
+        // moves particles whose path through the step crosses into the body
+        // back to where they first reach it
+        void resolve_continuous_collision(const Mat3& mWorld, VecX& pos, VecX& vel, float t) const;
         void step(const Mat3& mWorld, float fTime, float fTimeElapsed, UserData* = nullptr);
 
-        template <class _M1, class _M2>
-        void filter(const _M1& vec, _M2& res) const{ res = m_filter.cwiseProduct(vec); }
-        void modified_pcg(const SparseMat& A, const VecX& b, VecX& dv) const;
+        // body collisions as velocity constraints of the solve (Baraff-Witkin):
+        // contacts are added where the solution would end within the collision
+        // threshold and released where their constraint force pulls inwards
+        void solve_with_contacts(const Mat3& mWorld, const SparseMat& A, const VecX& b, float t, VecX& dv);
+        bool add_contacts(const Mat3& mWorld, const VecX& dv, float t, VecX& z, std::vector<unsigned char>& state);
+        bool release_contacts(const VecX& force, VecX& z, std::vector<unsigned char>& state);
+        void apply_friction(const VecX& force, VecX& dv) const;
+
+        // strands that stay at rest relative to the body for a while fall
+        // asleep: they are carried rigidly with it and left out of assembly,
+        // solve and collision until the body accelerates, turns them against
+        // gravity or comes nearer
+        void wake_sleeping(const Mat3& mWorld);
+        void carry_sleeping(const Mat3& mCarry, VecX& pos, VecX& vel, float t) const;
+        void update_sleep(const Mat3& mWorld, const Mat3& mCarry, const VecX& pos, float t);
+        void set_asleep(size_t i, bool bAsleep);
+        // closest body distance of the visible particles of each strand listed
+        void body_distance(const Mat3& mWorld, const VecX& pos, const std::vector<size_t>& strands, std::vector<float>& dist) const;
+
+        // fixed particles are filtered out, contacts lose their normal component
+        void filter(const VecX& vec, VecX& res) const;
+        // dv is z plus the solution in the filtered directions
+        void modified_pcg(const SparseMat& A, const VecX& b, const VecX& z, VecX& dv) const;
         void LU(const SparseMat& A, const VecX& b, VecX& dv) const;
         void simple_solve(const MatX& A, const VecX& b, VecX& dv) const;
 
@@ -135,10 +164,32 @@ namespace WR
         std::vector<HairSegment>        m_segments;
         std::list<StrainLimitPair*>     m_strain_limits;
 
+        struct Contact
+        {
+            int     id;
+            Vec3    normal;     // world space, out of the body
+        };
+        std::vector<Contact>            m_contacts;     // of the current solve
+
+        struct StrandActivity
+        {
+            int     quietSteps;     // in a row below SLEEP_SPEED
+            bool    bAsleep;
+            Vec3    gravity;        // body space direction when it fell asleep
+            float   distance;       // to the body when it fell asleep
+        };
+        std::vector<StrandActivity>                         m_activity;
+        std::vector<std::list<ISpring*>::iterator>          m_strandSprings;    // first of each strand
+        std::vector<std::list<StrainLimitPair*>::iterator>  m_strandLimits;
+        std::vector<size_t>                                 m_originalIds;      // empty in load order
+        size_t                                              m_nSleeping = 0;
+        size_t                                              m_nStep = 0;
+
         VecX                            m_position;
         VecX                            m_velocity;
         VecX                            m_filter, m_gravity;
         SparseMat                       m_mass_1, m_mass, m_wind_damping;
+        Mat3                            m_lastWorld;    // body transform of the last step
 
         bool                            mb_simInited = false;
         UserData*                       mp_data = nullptr;
@@ -70,6 +70,10 @@ bool wrLevelsetOctree::construct(Polyhedron_3& geom, size_t maxLvl)
         tItr->idx = count;
         triList[count].initInfo();
     }
+    bvh.build(triList, nTriangles);
+    leafBlocks.resize(bvh.n_slots() / bvh.LEAF_SIZE);
+    for (size_t i = 0; i < leafBlocks.size(); i++)
+        WRG::pack_triangles(triList, bvh.indices() + i * bvh.LEAF_SIZE, bvh.LEAF_SIZE, leafBlocks[i]);
 
     pRoot = createRootNode(geom);
 
@@ -163,6 +167,7 @@ void wrLevelsetOctree::releaseExceptDt()
         delete cellList[i];
 
     SAFE_DELETE_ARRAY(triList);
+    leafBlocks.clear();
     nTriangles = 0;
 
     pRoot = nullptr;
@@ -204,25 +209,8 @@ void wrLevelsetOctree::computeMinDistance(Node* node)
 
         int type = -1;
         size_t triIdx = 0;
-        Node* curNode = node;
         Vector_3 diff;
-        double tmpSquaredDist, distLimit;
-
-        while (true)
-        {
-            if (!curNode->eList.empty())
-            {
-                tmpSquaredDist = minSquaredDist(vh->point(), curNode->eList.cbegin(), curNode->eList.cend(), &diff, &triIdx, &type);
-                distLimit = minDist(curNode->triple, vh->point());
-
-                if (tmpSquaredDist < distLimit * distLimit || !curNode->pParent)
-                {
-                    dist = sqrt(tmpSquaredDist);
-                    break;
-                }
-            }
-            curNode = curNode->pParent;
-        }
+        dist = sqrt(nearestTriangle(vh->point(), node, &diff, &triIdx, &type));
 
         int sign = determineSign(type, vh->point(), diff, triIdx);
         dist *= sign;
@@ -301,51 +289,47 @@ double wrLevelsetOctree::minSquaredDist(const Point_3& p, Iterator begin, Iterat
 {
     assert(begin != end);
 
-    double dist = 1.e8;
-    size_t triIdx = 0;
-    int type = 0;
-    double s;
-    double t;
-
-    for (auto eItr = begin; eItr != end; eItr++)
+    size_t triIdx = *begin;
+    if (std::next(begin) != end)
     {
-        WRG::PointTriangleDistResult<K::FT> res;
-        auto &tri = triList[*eItr];
-        tri.computeInfo(p);
-        WRG::squaredDistance(p, tri, tri.infos, res);
-        if (dist > res.dist)
-        {
-            dist = res.dist;
-            type = res.type;
-            s = res.s;
-            t = res.t;
-            triIdx = *eItr;
-        }
+        const float q[3] = { float(p.x()), float(p.y()), float(p.z()) };
+        triIdx = WRG::nearest_triangle(q, triList, begin, end);
     }
+
+    // the closest one again in double for its closest point and feature type
+    WRG::PointTriangleDistResult<K::FT> res;
+    auto &tri = triList[triIdx];
+    tri.computeInfo(p);
+    WRG::squaredDistance(p, tri, tri.infos, res);
     if (diff)
-        *diff = p - (triList[triIdx].vertex(0) + s * triList[triIdx].E0 + t * triList[triIdx].E1);
+        *diff = p - (tri.vertex(0) + res.s * tri.E0 + res.t * tri.E1);
 
     if (pTriIdx) *pTriIdx = triIdx;
-    if (pType) *pType = type;
-    return dist;
+    if (pType) *pType = res.type;
+    return res.dist;
 }
 
-double wrLevelsetOctree::minDist(const Cube& bbox, const Point_3& p)
+double wrLevelsetOctree::nearestTriangle(const Point_3& p, const Node* hint, Vector_3* diff, size_t* tri, int* type) const
 {
-    double dist = 1.e9;
-
-#define MIN_TEST(d, d0)\
-    {if ((d) < (d0))\
-        (d0) = (d);}
+    size_t best = bvh.NOT_FOUND;
+    double bestSq = 1.e8;
+    // a few triangles near the hint only seed the bound, internal nodes list
+    // far more than a leaf block
+    if (hint && !hint->eList.empty())
+    {
+        const size_t nSeed = std::min<size_t>(hint->eList.size(), bvh.LEAF_SIZE);
+        bestSq = minSquaredDist(p, hint->eList.cbegin(), hint->eList.cbegin() + nSeed, nullptr, &best);
+    }
 
-    MIN_TEST(fabs(bbox.xmax() - p.x()), dist);
-    MIN_TEST(fabs(bbox.xmin() - p.x()), dist);
-    MIN_TEST(fabs(bbox.ymax() - p.y()), dist);
-    MIN_TEST(fabs(bbox.ymin() - p.y()), dist);
-    MIN_TEST(fabs(bbox.zmax() - p.z()), dist);
-    MIN_TEST(fabs(bbox.zmin() - p.z()), dist);
+    const float q[3] = { float(p.x()), float(p.y()), float(p.z()) };
+    best = bvh.nearest_by_leaf(p, [this, &q](const unsigned* tris, unsigned count, unsigned offset, double& bestSq, size_t& best)
+    {
+        WRG::nearest_in_block(q, leafBlocks[offset / bvh.LEAF_SIZE], tris, count, bestSq, best);
+    }, bestSq, best);
+    assert(best != bvh.NOT_FOUND);
 
-    return dist;
+    // once more for the closest point and its feature type
+    return minSquaredDist(p, &best, &best + 1, diff, tri, type);
 }
 
 wrLevelsetOctree::Node* wrLevelsetOctree::createRootNode(const Polyhedron_3& geom)
@@ -395,7 +379,7 @@ wrLevelsetOctree::Node* wrLevelsetOctree::createNode()
 
 float wrLevelsetOctree::queryExactDistance(const Point_3& p) const
 {
-    return sqrt(minSquaredDist(p, pRoot->eList.begin(), pRoot->eList.end()));
+    return sqrt(nearestTriangle(p, nullptr));
 }
 
 float wrLevelsetOctree::queryDistance(const Point_3& p) const
@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include "linmath.h"
 #include "wrGeo.h"
+#include "wrTriangleBVH.h"
+#include "wrTriangleBlock.h"
 #include <list>
 #include <vector>
 #include <CGAL\Exact_predicates_inexact_constructions_kernel.h>
@@ -150,8 +152,8 @@ private:
 
     template <class Iterator>
     double minSquaredDist(const Point_3& p, Iterator begin, Iterator end, Vector_3* diff = nullptr, size_t* tri = nullptr, int* type = nullptr) const;
-
-    double minDist(const Cube& bbox, const Point_3& p);
+    // the elements of hint (if any) give the BVH search a starting bound
+    double nearestTriangle(const Point_3& p, const Node* hint, Vector_3* diff = nullptr, size_t* tri = nullptr, int* type = nullptr) const;
     void computeGradient();
 
     int detSignOnFace(const Point_3& p, const Vector_3& diff, size_t triIdx) const;
@@ -169,6 +171,8 @@ private:
     std::vector<Node*>              cellList;
     Triangle_3*                     triList = nullptr;
     size_t                          nTriangles = 0;
+    WRG::TriangleBVH<Triangle_3>    bvh;
+    std::vector<WRG::TriangleBlock8> leafBlocks; // the triangles of each BVH leaf
     CGAL::Bbox_3                    box;
 };
 
@@ -0,0 +1,75 @@
+#include "wrMappedFile.h"
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+namespace WR
+{
+    bool MappedFile::open(const wchar_t* fileName)
+    {
+        close();
+
+#ifdef _WIN32
+        HANDLE hf = CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (hf == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(hf, &fileSize) && fileSize.QuadPart > 0)
+            mapping = CreateFileMappingW(hf, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+        const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (view)
+        {
+            hFile = hf;
+            hMapping = mapping;
+            pData = static_cast<const char*>(view);
+            nSize = size_t(fileSize.QuadPart);
+            return true;
+        }
+
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(hf);
+#endif
+
+        // fallback: read the whole file
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            return false;
+
+        buffer.resize(size_t(file.tellg()));
+        file.seekg(0);
+        file.read(buffer.data(), buffer.size());
+        if (!file || buffer.empty())
+        {
+            buffer.clear();
+            return false;
+        }
+
+        pData = buffer.data();
+        nSize = buffer.size();
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+#ifdef _WIN32
+        if (hMapping)
+        {
+            UnmapViewOfFile(pData);
+            CloseHandle(hMapping);
+            CloseHandle(hFile);
+        }
+#endif
+        hFile = hMapping = nullptr;
+        pData = nullptr;
+        nSize = 0;
+        std::vector<char>().swap(buffer);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+
+namespace WR
+{
+    // Read-only view of a whole file. Memory-mapped on Windows, read into
+    // memory elsewhere or when mapping fails.
+    class MappedFile
+    {
+    public:
+        MappedFile(){}
+        ~MappedFile() { close(); }
+
+        bool open(const wchar_t* fileName);
+        void close();
+
+        const char* data() const { return pData; }
+        size_t size() const { return nSize; }
+        bool is_open() const { return pData != nullptr; }
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        void*   hFile = nullptr;
+        void*   hMapping = nullptr;
+
+        const char*         pData = nullptr;
+        size_t              nSize = 0;
+        std::vector<char>   buffer;
+    };
+}
@@ -12,10 +12,16 @@
 #include "wrGeo.h"
 #include "wrHair.h"
 #include "CacheHair.h"
+#include "CacheWriter.h"
 #include "HairDebugRenderer.h"
+#include "SimulationRunner.h"
 
 
 #include "SphereCollisionObject.h"
+#include "CompoundCollisionObject.h"
+#include "ColliderBenchmark.h"
+#include <CGAL\bounding_box.h>
+#include <ppl.h>
 
 using namespace DirectX;
 
@@ -45,9 +51,70 @@ struct CB_VS_PER_FRAME
 #else
 #define ADF_FILE L"../../models/head"
 #endif
+#define MODEL_FILE L"../../models/head.off"
 
 extern std::string CACHE_FILE;
 extern std::string REF_FILE;
+extern std::string TRANSCODE_FILE;
+
+namespace
+{
+    // of the lazy ADF warm-up, spread evenly over the cache
+    const size_t MAX_WARM_UP_FRAMES = 64;
+    const size_t MAX_WARM_UP_POINTS = 200000;
+
+    // the cache never queries the collider itself, so the lazy ADF is refined
+    // up front where the particles of the cache go, one level per round
+    void warmUpLazyCollision(WR::ADFLazyCollisionObject* pCollision, WR::CacheHair20* pCache)
+    {
+        typedef WR::ICollisionObject::Point_3 Point_3;
+
+        const size_t nFrame = pCache->getFrameNumber();
+        const size_t nStrand = pCache->n_strands();
+        if (!nFrame || !nStrand) return;
+
+        const size_t frameStride = (nFrame + MAX_WARM_UP_FRAMES - 1) / MAX_WARM_UP_FRAMES;
+        const size_t perFrame = MAX_WARM_UP_POINTS / ((nFrame + frameStride - 1) / frameStride);
+        const size_t strandStride = std::max<size_t>(1, nStrand * (N_PARTICLES_PER_STRAND - 1) / std::max<size_t>(1, perFrame));
+
+        // the roots are not collided
+        std::vector<Point_3> points;
+        WR::CacheHair* pFrames = pCache;
+        for (size_t f = 0; f < nFrame; f += frameStride)
+        {
+            pFrames->jumpTo(int(f));
+            const float* m = pCache->get_rigidMotionMatrix();
+            const float R[9] = { m[0], m[1], m[2], m[4], m[5], m[6], m[8], m[9], m[10] };
+            const float t[3] = { m[3], m[7], m[11] };
+            const WR::RigidTransform xf(R, t);
+
+            for (size_t i = 0; i < nStrand; i += strandStride)
+            {
+                for (size_t j = 1; j < N_PARTICLES_PER_STRAND; j++)
+                {
+                    float q[3];
+                    xf.to_local(pCache->get_visible_particle_position(i, j), q);
+                    points.push_back(Point_3(q[0], q[1], q[2]));
+                }
+            }
+        }
+        pCache->rewind();
+
+        for (int level = 0; level < LAZY_ADF_LEVEL; level++)
+        {
+            concurrency::parallel_for(size_t(0), points.size(), [pCollision, &points](size_t k)
+            {
+                pCollision->query_distance(points[k]);
+            });
+
+            const size_t nRefined = pCollision->n_refined();
+            pCollision->refine();
+            if (pCollision->n_refined() == nRefined)
+                break;
+        }
+        WR_LOG_INFO << "lazy ADF warmed up over " << points.size() << " particles, " << pCollision->n_refined() << " leaves refined";
+    }
+}
 
 wrSceneManager::wrSceneManager()
 {
@@ -76,6 +143,13 @@ bool wrSceneManager::init()
     //WR::HairParticle::set_hair(hair);
     //hair->init_simulation();
 
+    /* the cache rewritten through the C++ writer, e.g. without its directions */
+    if (!TRANSCODE_FILE.empty())
+    {
+        WR::transcodeCache(CACHE_FILE.c_str(), TRANSCODE_FILE.c_str(),
+            TRANSCODE_DIRECTION ? WR::CacheWriter::ANIM2 : WR::CacheWriter::ANIM2_NO_DIRECTION);
+    }
+
     /* load the nCahce converted file */
     auto hair = new WR::CacheHair20;
     hair->loadFile(CACHE_FILE.c_str(), true);
@@ -85,6 +159,14 @@ bool wrSceneManager::init()
     hair0->loadFile(REF_FILE.c_str(), true);
     pHair0 = hair0;
 
+    /* both caches share the decoded frames budget for scrubbing */
+    if (FRAME_CACHE_SIZE > 0)
+    {
+        pFrameCache = new WR::FrameCache(size_t(FRAME_CACHE_SIZE) << 20);
+        hair->setFrameCache(pFrameCache);
+        hair0->setFrameCache(pFrameCache);
+    }
+
     /* make the sphere as the collision object */
     //WR::Polyhedron_3 *P = WRG::readFile<WR::Polyhedron_3>("../../models/head.off");
     //WR::SphereCollisionObject* sphere = new WR::SphereCollisionObject;
@@ -92,11 +174,52 @@ bool wrSceneManager::init()
     //pCollisionHead = sphere;
     //delete P;
 
+    /* numbers for choosing the collider settings below */
+    if (COLLIDER_BENCH)
+        WR::runColliderBenchmark(MODEL_FILE, ADF_FILE, CACHE_FILE.c_str(), "collider_bench.csv");
+
     if (APPLY_COLLISION)
-        pCollisionHead = WR::loadCollisionObject(ADF_FILE);
+    {
+        if (LAZY_ADF_LEVEL > 0)
+        {
+            pCollisionHead = pLazyCollision = WR::createLazyCollisionObject(MODEL_FILE, LAZY_ADF_LEVEL);
+            warmUpLazyCollision(pLazyCollision, hair);
+        }
+        else if (BRICK_GRID_RES > 0)
+        {
+            pCollisionHead = WR::loadBakedCollisionObject(ADF_FILE, BRICK_GRID_RES);
+            if (!pCollisionHead)
+            {
+                WR_LOG_ERROR << "cannot bake the head ADF into a brick grid of " << BRICK_GRID_RES << ", querying the ADF";
+                pCollisionHead = WR::loadCollisionObject(ADF_FILE);
+            }
+        }
+        else
+            pCollisionHead = WR::loadCollisionObject(ADF_FILE);
+
+        /* the body proxies are placed from the head box */
+        if (BODY_PROXIES)
+        {
+            WR::Polyhedron_3* pHead = WRG::readFile<WR::Polyhedron_3>(MODEL_FILE);
+            assert(pHead);
+            CGAL::Bbox_3 headBox = CGAL::bounding_box(pHead->points_begin(), pHead->points_end()).bbox();
+            delete pHead;
+            pCollisionHead = WR::createBodyCollisionObject(pCollisionHead, headBox);
+        }
+    }
+
+    /* the hairs step on their own threads while the frames render */
+    if (SIM_RATE > 0.f)
+    {
+        pSimData = new WR::UserData;
+        pSimData->pCollisionHead = pCollisionHead;
+        pRunner = new WR::SimulationRunner(pHair, SIM_RATE, pSimData);
+        pRunner0 = new WR::SimulationRunner(pHair0, SIM_RATE, pSimData);
+    }
 
     HRESULT hr;
-    auto hairRenderer = new HairBiDebugRenderer(hair, hair0);
+    const WR::IHair* pShown0 = pRunner0 ? pRunner0 : pHair0;
+    auto hairRenderer = new HairBiDebugRenderer(getShownHair(), pShown0);
     pHairRenderer = hairRenderer;
     V_RETURN(hairRenderer->init());
 
@@ -122,8 +245,20 @@ void wrSceneManager::onFrame(double fTime, float fElapsedTime)
 
     if (!get_bPause())
     {
-        pHair->onFrame(wrmWorld.transpose(), fTime, fElapsedTime, &userData);
-        pHair0->onFrame(wrmWorld.transpose(), fTime, fElapsedTime, &userData);
+        if (pRunner)
+        {
+            pRunner->onFrame(wrmWorld.transpose(), fTime, fElapsedTime);
+            pRunner0->onFrame(wrmWorld.transpose(), fTime, fElapsedTime);
+        }
+        else
+        {
+            pHair->onFrame(wrmWorld.transpose(), fTime, fElapsedTime, &userData);
+            pHair0->onFrame(wrmWorld.transpose(), fTime, fElapsedTime, &userData);
+        }
+
+        // picks up the leaves this frame's collisions reached, unless still busy
+        if (pLazyCollision)
+            pLazyCollision->refine_async();
     }
     pHairRenderer->onFrame(fTime, fElapsedTime);
     pMeshRenderer->onFrame(fTime, fElapsedTime);
@@ -139,13 +274,14 @@ void wrSceneManager::render(double fTime, float fElapsedTime)
     setPerFrameConstantBuffer(fTime, fElapsedTime);
     pHairRenderer->render(fTime, fElapsedTime);
 
+    const WR::IHair* pShown0 = pRunner0 ? pRunner0 : pHair0;
     vec3 offset0{ -2.f, 0, 0 };
-    pMeshRenderer->setTransformation(pHair0->get_rigidMotionMatrix());
+    pMeshRenderer->setTransformation(pShown0->get_rigidMotionMatrix());
     pMeshRenderer->setOffset(offset0);
     pMeshRenderer->render(fTime, fElapsedTime);
 
     vec3 offset1{ 2.f, 0, 0 };
-    pMeshRenderer->setTransformation(pHair0->get_rigidMotionMatrix());
+    pMeshRenderer->setTransformation(pShown0->get_rigidMotionMatrix());
     pMeshRenderer->setOffset(offset1);
     pMeshRenderer->render(fTime, fElapsedTime);
 }
@@ -153,6 +289,11 @@ void wrSceneManager::render(double fTime, float fElapsedTime)
 
 void wrSceneManager::release()
 {
+    // the simulation threads use the hairs and the collider
+    SAFE_DELETE(pRunner);
+    SAFE_DELETE(pRunner0);
+    SAFE_DELETE(pSimData);
+
     SAFE_RELEASE(pcbVSPerFrame);
 
     if (pHairRenderer) pHairRenderer->release();
@@ -160,9 +301,11 @@ void wrSceneManager::release()
 
     SAFE_DELETE(pMeshRenderer);
     SAFE_DELETE(pCollisionHead);
+    pLazyCollision = nullptr;
     SAFE_DELETE(pHairRenderer);
     SAFE_DELETE(pHair);
     SAFE_DELETE(pHair0);
+    SAFE_DELETE(pFrameCache);
 }
 
 
@@ -217,7 +360,12 @@ bool wrSceneManager::initConstantBuffer()
 
 void wrSceneManager::onKeyboard(UINT nChar, bool bKeyDown, bool bAltDown, void* pUserContext)
 {
+    if (!bKeyDown) return;
 
+    if (nChar == VK_OEM_PERIOD)
+        stepFrame(true);
+    else if (nChar == VK_OEM_COMMA)
+        stepFrame(false);
 }
 
 void wrSceneManager::nextColorScheme()
@@ -270,11 +418,31 @@ void  wrSceneManager::stepId()
 }
 
 
-void wrSceneManager::redirectTo()
+void wrSceneManager::withHairs(const std::function<void(WR::IHair*)>& f)
+{
+    if (pRunner)
+    {
+        pRunner->exclusive(f);
+        pRunner0->exclusive(f);
+    }
+    else
+    {
+        f(pHair);
+        f(pHair0);
+    }
+}
+
+
+const WR::IHair* wrSceneManager::getShownHair() const
 {
-    auto ptr = reinterpret_cast<WR::CacheHair*>(pHair);
-    auto ptr0 = reinterpret_cast<WR::CacheHair*>(pHair0);
+    if (pRunner)
+        return pRunner;
+    return pHair;
+}
 
+
+void wrSceneManager::redirectTo()
+{
     std::ifstream file("../id.txt");
     if (!file.is_open()) throw std::exception("File not found!");
     int id, frame;
@@ -282,7 +450,23 @@ void wrSceneManager::redirectTo()
     file >> frame;
     file.close();
 
-    ptr->jumpTo(frame);
-    ptr0->jumpTo(frame);
+    withHairs([frame](WR::IHair* p)
+    {
+        reinterpret_cast<WR::CacheHair*>(p)->jumpTo(frame);
+    });
+}
+
+
+void wrSceneManager::stepFrame(bool bForward)
+{
+    set_bPause(true);
+    withHairs([bForward](WR::IHair* p)
+    {
+        auto ptr = reinterpret_cast<WR::CacheHair*>(p);
+        if (bForward)
+            ptr->stepForward();
+        else
+            ptr->stepBackward();
+    });
 }
 
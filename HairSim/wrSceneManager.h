@@ -1,5 +1,6 @@
 #pragma once
 #include "wrMacro.h"
+#include <functional>
 
 class CModelViewerCamera;
 class wrHairRenderer;
@@ -8,7 +9,11 @@ class wrMeshRenderer;
 namespace WR
 {
     class IHair;
+    class SimulationRunner;
+    struct UserData;
     class ICollisionObject;
+    class ADFLazyCollisionObject;
+    class FrameCache;
 }
 
 class wrRendererInterface
@@ -41,10 +46,15 @@ public:
     void stepId();
     void resize(int w, int h) { nWidth = w; nHeight = h; }
     void redirectTo();
+    void stepFrame(bool bForward);
+    // what the renderer shows of pHair, safe to read on the render thread
+    const WR::IHair* getShownHair() const;
 
 private:
     void setPerFrameConstantBuffer(double, float);
     bool initConstantBuffer();
+    // runs f on both hairs, between two steps when they have their own threads
+    void withHairs(const std::function<void(WR::IHair*)>& f);
 
 public:
     WR::IHair*                  pHair = nullptr;
@@ -59,6 +69,11 @@ private:
 
     ID3D11Buffer*               pcbVSPerFrame = nullptr;
     WR::ICollisionObject*       pCollisionHead = nullptr;
+    WR::ADFLazyCollisionObject* pLazyCollision = nullptr;   // pCollisionHead, or the head in it, when refined on demand
+    WR::FrameCache*             pFrameCache = nullptr;
+    WR::SimulationRunner*       pRunner = nullptr;      // pHair on its own thread, shown instead of it
+    WR::SimulationRunner*       pRunner0 = nullptr;
+    WR::UserData*               pSimData = nullptr;     // of the runners
 
     int nWidth, nHeight;
 };
@@ -0,0 +1,128 @@
+#include <xmmintrin.h>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include "wrSpline.h"
+
+namespace WR
+{
+    namespace
+    {
+        const size_t max_points = 64;
+        const float min_interval = 1e-7f;
+
+        inline __m128 load3(const float* p)
+        {
+            return _mm_set_ps(0.f, p[2], p[1], p[0]);
+        }
+
+        inline void store3(float* p, __m128 v)
+        {
+            float tmp[4];
+            _mm_storeu_ps(tmp, v);
+            p[0] = tmp[0]; p[1] = tmp[1]; p[2] = tmp[2];
+        }
+
+        inline float dot3(__m128 a, __m128 b)
+        {
+            __m128 m = _mm_mul_ps(a, b);
+            __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+            s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2)));
+            return _mm_cvtss_f32(s);
+        }
+
+        inline __m128 scale(__m128 v, float s)
+        {
+            return _mm_mul_ps(v, _mm_set1_ps(s));
+        }
+    }
+
+    // The three coordinates share the tridiagonal system, so they are solved together
+    // in the lanes of one register; the system itself only depends on the intervals.
+    void computeStrandDirections(const float* pos, size_t n, float* dir)
+    {
+        assert(n >= 4 && n <= max_points);
+
+        __m128 y[max_points], slope[max_points], rhs[max_points], M[max_points];
+        float u[max_points], h[max_points];
+        float sub[max_points], diag[max_points], sup[max_points];
+
+        // normalised chord length parameterisation
+        u[0] = 0.f;
+        y[0] = load3(pos);
+        for (size_t i = 1; i < n; i++)
+        {
+            y[i] = load3(pos + 3 * i);
+            __m128 d = _mm_sub_ps(y[i], y[i - 1]);
+            u[i] = u[i - 1] + std::sqrt(dot3(d, d));
+        }
+
+        if (u[n - 1] <= 0.f)
+        {
+            memset(dir, 0, sizeof(float) * 3 * n);
+            return;
+        }
+
+        float inv = 1.f / u[n - 1];
+        for (size_t i = 1; i < n; i++)
+            u[i] *= inv;
+
+        for (size_t i = 0; i < n - 1; i++)
+        {
+            h[i] = u[i + 1] - u[i];
+            if (h[i] < min_interval) h[i] = min_interval;
+            slope[i] = scale(_mm_sub_ps(y[i + 1], y[i]), 1.f / h[i]);
+        }
+
+        // second derivatives M[1..n-2]; the not-a-knot conditions
+        //   M0 = ((h0 + h1) M1 - h0 M2) / h1 and its mirror at the tip
+        // are folded into the first and the last row
+        for (size_t i = 1; i < n - 1; i++)
+        {
+            sub[i] = h[i - 1];
+            diag[i] = 2.f * (h[i - 1] + h[i]);
+            sup[i] = h[i];
+            rhs[i] = scale(_mm_sub_ps(slope[i], slope[i - 1]), 6.f);
+        }
+
+        const float h0 = h[0], h1 = h[1];
+        diag[1] = (h0 + h1) * (h0 + 2.f * h1) / h1;
+        sup[1] = (h1 - h0) * (h1 + h0) / h1;
+
+        const float a = h[n - 3], b = h[n - 2];
+        sub[n - 2] = (a - b) * (a + b) / a;
+        diag[n - 2] = (a + b) * (2.f * a + b) / a;
+
+        for (size_t i = 2; i < n - 1; i++)
+        {
+            float w = sub[i] / diag[i - 1];
+            diag[i] -= w * sup[i - 1];
+            rhs[i] = _mm_sub_ps(rhs[i], scale(rhs[i - 1], w));
+        }
+
+        M[n - 2] = scale(rhs[n - 2], 1.f / diag[n - 2]);
+        for (size_t i = n - 3; i >= 1; i--)
+            M[i] = scale(_mm_sub_ps(rhs[i], scale(M[i + 1], sup[i])), 1.f / diag[i]);
+
+        M[0] = scale(_mm_sub_ps(scale(M[1], h0 + h1), scale(M[2], h0)), 1.f / h1);
+        M[n - 1] = scale(_mm_sub_ps(scale(M[n - 2], a + b), scale(M[n - 3], b)), 1.f / a);
+
+        // S'(x) = M[i+1] (x - u[i])^2 / 2h - M[i] (u[i+1] - x)^2 / 2h + slope[i] - (M[i+1] - M[i]) h / 6
+        size_t i = 0;
+        for (size_t k = 0; k < n; k++)
+        {
+            float x = float(k) / float(n - 1);
+            while (i < n - 2 && x > u[i + 1]) i++;
+
+            float l = x - u[i], r = u[i + 1] - x;
+            float inv2h = 0.5f / h[i];
+            __m128 d = _mm_add_ps(scale(M[i + 1], l * l * inv2h), scale(M[i], -r * r * inv2h));
+            d = _mm_add_ps(d, slope[i]);
+            d = _mm_sub_ps(d, scale(_mm_sub_ps(M[i + 1], M[i]), h[i] / 6.f));
+
+            float len = std::sqrt(dot3(d, d));
+            if (len > 0.f) d = scale(d, 1.f / len);
+            store3(dir + 3 * k, d);
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+
+namespace WR
+{
+    // Unit tangents of a strand given by n >= 4 points (xyz, packed).
+    // The strand is interpolated by a not-a-knot cubic spline over normalised chord
+    // length and its derivative is sampled at n uniform parameters in [0, 1], which
+    // matches splprep(s=0) + splev(der=1) in Frame.calcParticleDirections.
+    void computeStrandDirections(const float* pos, size_t n, float* dir);
+}
@@ -0,0 +1,360 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <CGAL\number_utils.h>
+
+namespace WRG
+{
+    // Bounding volume hierarchy over a triangle array for nearest triangle queries.
+    // It is built top down with binned SAH and flattened depth first: the left
+    // child of a node follows it, the right child is at offset. A leaf holds
+    // count (up to LEAF_SIZE) triangles from triIndex[offset], and every leaf
+    // owns LEAF_SIZE slots of triIndex, padded with its last triangle, so that
+    // offset / LEAF_SIZE numbers the leaves for per-leaf triangle blocks.
+    //
+    // Boxes are float, rounded outwards, so that pruning stays conservative for
+    // double kernels too.
+    template <class Triangle>
+    class TriangleBVH
+    {
+    public:
+        static const size_t NOT_FOUND = size_t(-1);
+        static const unsigned LEAF_SIZE = 8;
+
+        struct Node
+        {
+            float       bmin[3];
+            unsigned    offset;     // right child, or first triangle of a leaf
+            float       bmax[3];
+            unsigned    count;      // 0 for interior nodes
+        };
+
+        void build(const Triangle* tris, size_t n)
+        {
+            nodes.clear();
+            triIndex.resize(n);
+            if (!n) return;
+
+            prims.resize(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                Prim& pr = prims[i];
+                triangle_box(tris[i], pr.bmin, pr.bmax);
+                for (int a = 0; a < 3; a++)
+                    pr.c[a] = 0.5f * (pr.bmin[a] + pr.bmax[a]);
+                triIndex[i] = unsigned(i);
+            }
+
+            nodes.reserve(2 * n);
+            build_node(0, n, 0);
+            std::vector<Prim>().swap(prims);
+
+            std::vector<unsigned> slots;
+            slots.reserve(n + n / 2);
+            for (auto& node : nodes)
+            {
+                if (!node.count) continue;
+                const unsigned first = unsigned(slots.size());
+                for (unsigned k = 0; k < LEAF_SIZE; k++)
+                    slots.push_back(triIndex[node.offset + std::min(k, node.count - 1)]);
+                node.offset = first;
+            }
+            triIndex.swap(slots);
+        }
+
+        // recomputes the boxes bottom up after the vertices of the same triangles
+        // moved. The tree keeps its structure, which degrades with large motions
+        void refit(const Triangle* tris)
+        {
+            // children come after their parent
+            for (size_t i = nodes.size(); i-- > 0;)
+            {
+                Node& node = nodes[i];
+                reset(node.bmin, node.bmax);
+                if (node.count)
+                {
+                    for (unsigned k = 0; k < node.count; k++)
+                    {
+                        float bmin[3], bmax[3];
+                        triangle_box(tris[triIndex[node.offset + k]], bmin, bmax);
+                        grow(node.bmin, node.bmax, bmin, bmax);
+                    }
+                }
+                else
+                {
+                    grow(node.bmin, node.bmax, nodes[i + 1].bmin, nodes[i + 1].bmax);
+                    grow(node.bmin, node.bmax, nodes[node.offset].bmin, nodes[node.offset].bmax);
+                }
+            }
+        }
+
+        // nearest triangle to p, sqDist(i) being the squared distance from p to
+        // triangle i. Nearer boxes are visited first and boxes not closer than
+        // bestSq are skipped; bestSq and best may come in as an already known
+        // triangle, which is returned when nothing is closer.
+        template <class Point, class FT, class SqDist>
+        size_t nearest(const Point& p, SqDist sqDist, FT& bestSq, size_t best = NOT_FOUND) const
+        {
+            return nearest_by_leaf(p, [&sqDist](const unsigned* tris, unsigned count, unsigned, FT& bestSq, size_t& best)
+            {
+                for (unsigned k = 0; k < count; k++)
+                {
+                    FT dt = sqDist(size_t(tris[k]));
+                    if (dt < bestSq)
+                    {
+                        bestSq = dt;
+                        best = tris[k];
+                    }
+                }
+            }, bestSq, best);
+        }
+
+        // the same search with whole leaves at a time: leafDist(tris, count, offset,
+        // bestSq, best) lowers bestSq and sets best to the closest of the count
+        // triangles tris = indices() + offset if one is closer
+        template <class Point, class FT, class LeafDist>
+        size_t nearest_by_leaf(const Point& p, LeafDist leafDist, FT& bestSq, size_t best = NOT_FOUND) const
+        {
+            if (nodes.empty()) return best;
+
+            const double q[3] = { CGAL::to_double(p[0]), CGAL::to_double(p[1]), CGAL::to_double(p[2]) };
+            struct Entry { unsigned node; double dist; } stack[MAX_STACK];
+            int top = 0;
+
+            double d = box_distance(nodes[0], q);
+            if (d >= bestSq) return best;
+            unsigned idx = 0;
+            while (true)
+            {
+                const Node& node = nodes[idx];
+                if (node.count)
+                {
+                    leafDist(triIndex.data() + node.offset, node.count, node.offset, bestSq, best);
+                }
+                else
+                {
+                    unsigned l = idx + 1, r = node.offset;
+                    double dl = box_distance(nodes[l], q), dr = box_distance(nodes[r], q);
+                    if (dr < dl)
+                    {
+                        std::swap(l, r);
+                        std::swap(dl, dr);
+                    }
+                    if (dl < bestSq)
+                    {
+                        if (dr < bestSq)
+                        {
+                            stack[top].node = r;
+                            stack[top++].dist = dr;
+                        }
+                        idx = l;
+                        continue;
+                    }
+                }
+
+                // the bound may have shrunk since a box was pushed
+                do
+                {
+                    if (!top) return best;
+                    --top;
+                } while (stack[top].dist >= bestSq);
+                idx = stack[top].node;
+            }
+        }
+
+        bool empty() const { return nodes.empty(); }
+        size_t n_nodes() const { return nodes.size(); }
+        // the leaf slots, n_slots() / LEAF_SIZE leaves
+        const unsigned* indices() const { return triIndex.data(); }
+        size_t n_slots() const { return triIndex.size(); }
+
+    private:
+        static const int N_BINS = 12;
+        // below MAX_DEPTH ranges are split in halves, which bounds the stack
+        static const int MAX_DEPTH = 48;
+        static const int MAX_STACK = MAX_DEPTH + 32;
+
+        struct Prim
+        {
+            float bmin[3], bmax[3], c[3];
+        };
+
+        struct Bin
+        {
+            float       bmin[3], bmax[3];
+            unsigned    count;
+        };
+
+        static float round_down(double v)
+        {
+            float f = float(v);
+            return f > v ? std::nextafter(f, -std::numeric_limits<float>::max()) : f;
+        }
+
+        static float round_up(double v)
+        {
+            float f = float(v);
+            return f < v ? std::nextafter(f, std::numeric_limits<float>::max()) : f;
+        }
+
+        static void triangle_box(const Triangle& tri, float* bmin, float* bmax)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                double lo = CGAL::to_double(tri.vertex(0)[a]), hi = lo;
+                for (int k = 1; k < 3; k++)
+                {
+                    double v = CGAL::to_double(tri.vertex(k)[a]);
+                    lo = std::min(lo, v);
+                    hi = std::max(hi, v);
+                }
+                bmin[a] = round_down(lo);
+                bmax[a] = round_up(hi);
+            }
+        }
+
+        static double box_distance(const Node& node, const double* q)
+        {
+            double d = 0.0;
+            for (int a = 0; a < 3; a++)
+            {
+                double e = std::max(0.0, std::max(node.bmin[a] - q[a], q[a] - node.bmax[a]));
+                d += e * e;
+            }
+            return d;
+        }
+
+        static float half_area(const float* bmin, const float* bmax)
+        {
+            float e[3] = { bmax[0] - bmin[0], bmax[1] - bmin[1], bmax[2] - bmin[2] };
+            return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+        }
+
+        static void reset(float* bmin, float* bmax)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                bmin[a] = std::numeric_limits<float>::max();
+                bmax[a] = -std::numeric_limits<float>::max();
+            }
+        }
+
+        static void grow(float* bmin, float* bmax, const float* omin, const float* omax)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                bmin[a] = std::min(bmin[a], omin[a]);
+                bmax[a] = std::max(bmax[a], omax[a]);
+            }
+        }
+
+        unsigned build_node(size_t begin, size_t end, int depth)
+        {
+            const unsigned idx = unsigned(nodes.size());
+            nodes.push_back(Node());
+
+            Node node;
+            float cmin[3], cmax[3];
+            reset(node.bmin, node.bmax);
+            reset(cmin, cmax);
+            for (size_t i = begin; i < end; i++)
+            {
+                const Prim& pr = prims[triIndex[i]];
+                grow(node.bmin, node.bmax, pr.bmin, pr.bmax);
+                grow(cmin, cmax, pr.c, pr.c);
+            }
+
+            const size_t n = end - begin;
+            node.offset = unsigned(begin);
+            node.count = unsigned(n);
+            if (n <= LEAF_SIZE)
+            {
+                nodes[idx] = node;
+                return idx;
+            }
+
+            // cheapest split between SAH bins over the centroid bounds
+            int bestAxis = -1, bestBin = 0;
+            float bestCost = std::numeric_limits<float>::max();
+            for (int a = 0; a < 3; a++)
+            {
+                const float extent = cmax[a] - cmin[a];
+                if (extent <= 0.f) continue;
+
+                Bin bins[N_BINS];
+                for (int b = 0; b < N_BINS; b++)
+                {
+                    reset(bins[b].bmin, bins[b].bmax);
+                    bins[b].count = 0;
+                }
+                const float scale = N_BINS / extent;
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Prim& pr = prims[triIndex[i]];
+                    Bin& bin = bins[std::min(N_BINS - 1, int((pr.c[a] - cmin[a]) * scale))];
+                    grow(bin.bmin, bin.bmax, pr.bmin, pr.bmax);
+                    bin.count++;
+                }
+
+                float leftArea[N_BINS], bmin[3], bmax[3];
+                unsigned leftCount[N_BINS], count = 0;
+                reset(bmin, bmax);
+                for (int b = 0; b < N_BINS - 1; b++)
+                {
+                    grow(bmin, bmax, bins[b].bmin, bins[b].bmax);
+                    count += bins[b].count;
+                    leftArea[b] = count ? half_area(bmin, bmax) : 0.f;
+                    leftCount[b] = count;
+                }
+
+                reset(bmin, bmax);
+                count = 0;
+                for (int b = N_BINS - 1; b > 0; b--)
+                {
+                    grow(bmin, bmax, bins[b].bmin, bins[b].bmax);
+                    count += bins[b].count;
+                    if (!count || !leftCount[b - 1]) continue;
+
+                    float cost = leftArea[b - 1] * leftCount[b - 1] + half_area(bmin, bmax) * count;
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = a;
+                        bestBin = b - 1;
+                    }
+                }
+            }
+
+            size_t mid;
+            if (bestAxis < 0 || depth >= MAX_DEPTH)
+            {
+                // all centroids coincide or too deep, split the range in halves
+                mid = begin + n / 2;
+            }
+            else
+            {
+                const float scale = N_BINS / (cmax[bestAxis] - cmin[bestAxis]);
+                const float lo = cmin[bestAxis];
+                const int axis = bestAxis, split = bestBin;
+                const std::vector<Prim>& pr = prims;
+                mid = std::partition(triIndex.begin() + begin, triIndex.begin() + end, [&](unsigned t)
+                {
+                    return std::min(N_BINS - 1, int((pr[t].c[axis] - lo) * scale)) <= split;
+                }) - triIndex.begin();
+                if (mid == begin || mid == end) mid = begin + n / 2;
+            }
+
+            node.count = 0;
+            build_node(begin, mid, depth + 1);
+            node.offset = build_node(mid, end, depth + 1);
+            nodes[idx] = node;
+            return idx;
+        }
+
+        std::vector<Node>       nodes;
+        std::vector<unsigned>   triIndex;
+        std::vector<Prim>       prims;      // only during build
+    };
+}
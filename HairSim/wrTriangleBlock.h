@@ -0,0 +1,228 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <CGAL\number_utils.h>
+
+namespace WRG
+{
+    // Eight triangles in SoA layout for the batched point-triangle distance:
+    // first vertex, the two edges from it and their dot products, as in
+    // PointTriangleDistInfo. Unused lanes repeat a triangle of the block.
+    struct TriangleBlock8
+    {
+        float v0[3][8];
+        float e0[3][8];
+        float e1[3][8];
+        float a[8], b[8], c[8];
+    };
+
+    // packs n (1 to 8) triangles with initialized infos, given by index
+    template <class Triangle>
+    void pack_triangles(const Triangle* tris, const unsigned* idx, size_t n, TriangleBlock8& blk)
+    {
+        assert(n > 0 && n <= 8);
+        for (size_t k = 0; k < 8; k++)
+        {
+            const Triangle& tri = tris[idx[std::min(k, n - 1)]];
+            for (int i = 0; i < 3; i++)
+            {
+                blk.v0[i][k] = float(CGAL::to_double(tri.vertex(0)[i]));
+                blk.e0[i][k] = float(CGAL::to_double(tri.E0[i]));
+                blk.e1[i][k] = float(CGAL::to_double(tri.E1[i]));
+            }
+            blk.a[k] = float(CGAL::to_double(tri.infos.a));
+            blk.b[k] = float(CGAL::to_double(tri.infos.b));
+            blk.c[k] = float(CGAL::to_double(tri.infos.c));
+        }
+    }
+
+    namespace detail
+    {
+        struct SSELanes
+        {
+            typedef __m128 V;
+            static const int WIDTH = 4;
+
+            static V set1(float v) { return _mm_set1_ps(v); }
+            static V load(const float* p) { return _mm_loadu_ps(p); }
+            static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+            static void store_int(int* p, V v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_cvttps_epi32(v)); }
+            static V add(V a, V b) { return _mm_add_ps(a, b); }
+            static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+            static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+            static V div(V a, V b) { return _mm_div_ps(a, b); }
+            static V and_(V a, V b) { return _mm_and_ps(a, b); }
+            static V andnot(V m, V a) { return _mm_andnot_ps(m, a); }   // a & ~m
+            static V or_(V a, V b) { return _mm_or_ps(a, b); }
+            static V lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+            static V le(V a, V b) { return _mm_cmple_ps(a, b); }
+            static V ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+            static V gt(V a, V b) { return _mm_cmpgt_ps(a, b); }
+            static V abs(V a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+            static V select(V m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+        };
+
+#ifdef __AVX2__
+        struct AVXLanes
+        {
+            typedef __m256 V;
+            static const int WIDTH = 8;
+
+            static V set1(float v) { return _mm256_set1_ps(v); }
+            static V load(const float* p) { return _mm256_loadu_ps(p); }
+            static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+            static void store_int(int* p, V v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_cvttps_epi32(v)); }
+            static V add(V a, V b) { return _mm256_add_ps(a, b); }
+            static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+            static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+            static V div(V a, V b) { return _mm256_div_ps(a, b); }
+            static V and_(V a, V b) { return _mm256_and_ps(a, b); }
+            static V andnot(V m, V a) { return _mm256_andnot_ps(m, a); }
+            static V or_(V a, V b) { return _mm256_or_ps(a, b); }
+            static V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+            static V le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+            static V ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+            static V gt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+            static V abs(V a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+            static V select(V m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+        };
+#endif
+
+        // squaredDistance for the lanes [k, k + WIDTH) of the block. Every region
+        // candidate is computed and the region masks select among them, with the
+        // same tests and results as the scalar version
+        template <class L>
+        inline void distance_lanes(const float* p, const TriangleBlock8& blk, int k,
+            float* dist, float* s, float* t, int* type)
+        {
+            typedef typename L::V V;
+            const V zero = L::set1(0.f), one = L::set1(1.f), two = L::set1(2.f);
+
+            V D[3];
+            for (int i = 0; i < 3; i++)
+                D[i] = L::sub(L::load(blk.v0[i] + k), L::set1(p[i]));
+
+            V a = L::load(blk.a + k), b = L::load(blk.b + k), c = L::load(blk.c + k);
+            V d = zero, e = zero, f = zero;
+            for (int i = 0; i < 3; i++)
+            {
+                d = L::add(d, L::mul(L::load(blk.e0[i] + k), D[i]));
+                e = L::add(e, L::mul(L::load(blk.e1[i] + k), D[i]));
+                f = L::add(f, L::mul(D[i], D[i]));
+            }
+
+            V det = L::abs(L::sub(L::mul(a, c), L::mul(b, b)));
+            V s0 = L::sub(L::mul(b, e), L::mul(c, d));
+            V t0 = L::sub(L::mul(b, d), L::mul(a, e));
+
+            // edge s = 0
+            V ne = L::sub(zero, e);
+            V eNonNeg = L::ge(e, zero), eFar = L::ge(ne, c);
+            V tE3 = L::select(eNonNeg, zero, L::select(eFar, one, L::div(ne, c)));
+            V typeE3 = L::select(eNonNeg, L::set1(4.f), L::select(eFar, L::set1(2.f), L::set1(3.f)));
+
+            // edge t = 0
+            V nd = L::sub(zero, d);
+            V dNonNeg = L::ge(d, zero), dFar = L::ge(nd, a);
+            V sE5 = L::select(dNonNeg, zero, L::select(dFar, one, L::div(nd, a)));
+            V typeE5 = L::select(dNonNeg, L::set1(4.f), L::select(dFar, L::set1(6.f), L::set1(5.f)));
+
+            // edge s + t = 1
+            V numer = L::sub(L::add(c, e), L::add(b, d));
+            V denom = L::add(L::sub(a, L::mul(two, b)), c);
+            V nLow = L::le(numer, zero), nHigh = L::ge(numer, denom);
+            V sE1 = L::select(nLow, zero, L::select(nHigh, one, L::div(numer, denom)));
+            V tE1 = L::sub(one, sE1);
+            V typeE1 = L::select(nLow, L::set1(2.f), L::select(nHigh, L::set1(6.f), one));
+
+            // interior
+            V invDet = L::div(one, det);
+            V sI = L::mul(s0, invDet), tI = L::mul(t0, invDet);
+
+            V inside = L::le(L::add(s0, t0), det);
+            V sNeg = L::lt(s0, zero), tNeg = L::lt(t0, zero), eNeg = L::lt(e, zero);
+            V pick1In2 = L::gt(L::add(c, e), L::add(b, d));
+            V pick1In6 = L::gt(L::add(a, d), L::add(b, e));
+
+            // regions 3, 4 with e < 0, and 2 toward s = 0
+            V useE3 = L::or_(L::and_(inside, L::and_(sNeg, L::or_(L::andnot(tNeg, inside), eNeg))),
+                L::andnot(inside, L::andnot(pick1In2, sNeg)));
+            // regions 5, 4 with e >= 0, and 6 toward t = 0
+            V useE5 = L::or_(L::and_(inside, L::and_(tNeg, L::andnot(L::and_(sNeg, eNeg), inside))),
+                L::andnot(inside, L::andnot(sNeg, L::andnot(pick1In6, tNeg))));
+            V useI = L::and_(inside, L::andnot(L::or_(sNeg, tNeg), inside));
+
+            V rs = L::select(useI, sI, L::select(useE3, zero, L::select(useE5, sE5, sE1)));
+            V rt = L::select(useI, tI, L::select(useE3, tE3, L::select(useE5, zero, tE1)));
+
+            V q = L::add(L::mul(L::mul(a, rs), rs), L::mul(L::mul(L::mul(two, b), rs), rt));
+            q = L::add(q, L::mul(L::mul(c, rt), rt));
+            q = L::add(q, L::add(L::mul(L::mul(two, d), rs), L::mul(L::mul(two, e), rt)));
+            L::store(dist + k, L::abs(L::add(q, f)));
+
+            if (s) L::store(s + k, rs);
+            if (t) L::store(t + k, rt);
+            if (type)
+            {
+                V rtype = L::select(useI, zero, L::select(useE3, typeE3, L::select(useE5, typeE5, typeE1)));
+                L::store_int(type + k, rtype);
+            }
+        }
+    }
+
+    // squaredDistance from p to the 8 triangles of blk, s, t and type are optional
+    inline void squaredDistance8(const float* p, const TriangleBlock8& blk,
+        float* dist, float* s = nullptr, float* t = nullptr, int* type = nullptr)
+    {
+#ifdef __AVX2__
+        detail::distance_lanes<detail::AVXLanes>(p, blk, 0, dist, s, t, type);
+#else
+        detail::distance_lanes<detail::SSELanes>(p, blk, 0, dist, s, t, type);
+        detail::distance_lanes<detail::SSELanes>(p, blk, 4, dist, s, t, type);
+#endif
+    }
+
+    // lowers bestSq and sets best to the closest of the first count triangles
+    // of blk, numbered idx, if one is closer
+    template <class FT>
+    inline void nearest_in_block(const float* p, const TriangleBlock8& blk, const unsigned* idx, size_t count,
+        FT& bestSq, size_t& best)
+    {
+        float dist[8];
+        squaredDistance8(p, blk, dist);
+        for (size_t k = 0; k < count; k++)
+        {
+            if (dist[k] < bestSq)
+            {
+                bestSq = dist[k];
+                best = idx[k];
+            }
+        }
+    }
+
+    // closest to p of the triangles tris[*it], gathered 8 at a time
+    template <class Triangle, class Iterator>
+    size_t nearest_triangle(const float* p, const Triangle* tris, Iterator begin, Iterator end)
+    {
+        assert(begin != end);
+
+        float bestSq = FLT_MAX;
+        size_t best = *begin;
+        TriangleBlock8 blk;
+        unsigned idx[8];
+        while (begin != end)
+        {
+            size_t n = 0;
+            for (; begin != end && n < 8; ++begin)
+                idx[n++] = unsigned(*begin);
+            pack_triangles(tris, idx, n, blk);
+            nearest_in_block(p, blk, idx, n, bestSq, best);
+        }
+        return best;
+    }
+}
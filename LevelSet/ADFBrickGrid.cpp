@@ -0,0 +1,303 @@
+#include "ADFBrickGrid.h"
+#include <algorithm>
+#include <cmath>
+#include <ppl.h>
+#include "wrLogger.h"
+
+namespace
+{
+#define MAX_PROJECTION_ITERATION 4
+#define PROJECTION_TOL 3e-4f
+
+    const int S = WR::BrickGridCollisionObject::BRICK_SIZE + 1;
+    const float QUANT_MAX = 32767.f;
+}
+
+namespace WR
+{
+    bool BrickGridCollisionObject::build(const DistanceFunc& dist, const CGAL::Bbox_3& box, float cellSize, float band)
+    {
+        if (cellSize <= 0.f || band <= 0.f)
+        {
+            WR_LOG_ERROR << "invalid brick grid parameters, cell " << cellSize << ", band " << band;
+            return false;
+        }
+
+        m_cell_size = cellSize;
+        m_band = band;
+        domain = box;
+        invCell = 1.f / cellSize;
+        for (int i = 0; i < 3; i++)
+        {
+            origin[i] = float(box.min(i));
+            int n = std::max(1, int(std::ceil((box.max(i) - box.min(i)) * invCell)));
+            nBrick[i] = (n + BRICK_SIZE - 1) / BRICK_SIZE;
+            nCell[i] = nBrick[i] * BRICK_SIZE;
+        }
+
+        brickIndex.assign(size_t(nBrick[0]) * nBrick[1] * nBrick[2], int(EMPTY_OUTSIDE));
+        samples.clear();
+        freeBricks.clear();
+
+        std::vector<short> brick(BRICK_SAMPLES);
+        for (size_t idx = 0; idx < brickIndex.size(); idx++)
+        {
+            int state = classify_brick(dist, idx, brick.data());
+            if (state == IN_BAND)
+            {
+                brickIndex[idx] = int(samples.size() / BRICK_SAMPLES);
+                samples.insert(samples.end(), brick.begin(), brick.end());
+            }
+            else brickIndex[idx] = state;
+        }
+
+        WR_LOG_INFO << "brick grid: " << nCell[0] << "x" << nCell[1] << "x" << nCell[2]
+            << " cells, " << n_allocated_bricks() << "/" << n_bricks() << " bricks, "
+            << samples.size() * sizeof(short) / 1024 << "KB";
+        return true;
+    }
+
+    void BrickGridCollisionObject::update(const DistanceFunc& dist, const std::vector<size_t>& bricks)
+    {
+        // sample in parallel into scratch, then move the results in
+        std::vector<short> scratch(bricks.size() * BRICK_SAMPLES);
+        std::vector<int> states(bricks.size());
+        concurrency::parallel_for(size_t(0), bricks.size(), [&](size_t i)
+        {
+            states[i] = classify_brick(dist, bricks[i], &scratch[i * BRICK_SAMPLES]);
+        });
+
+        for (size_t i = 0; i < bricks.size(); i++)
+        {
+            int& bi = brickIndex[bricks[i]];
+            if (states[i] != IN_BAND)
+            {
+                if (bi >= 0) freeBricks.push_back(bi);
+                bi = states[i];
+                continue;
+            }
+
+            if (bi < 0)
+            {
+                if (freeBricks.empty())
+                {
+                    bi = int(samples.size() / BRICK_SAMPLES);
+                    samples.resize(samples.size() + BRICK_SAMPLES);
+                }
+                else
+                {
+                    bi = freeBricks.back();
+                    freeBricks.pop_back();
+                }
+            }
+            std::copy(scratch.begin() + i * BRICK_SAMPLES, scratch.begin() + (i + 1) * BRICK_SAMPLES,
+                samples.begin() + size_t(bi) * BRICK_SAMPLES);
+        }
+    }
+
+    void BrickGridCollisionObject::bricks_in(const CGAL::Bbox_3& box, std::vector<size_t>& out) const
+    {
+        int lo[3], hi[3];
+        const float brickSize = BRICK_SIZE * m_cell_size;
+        for (int i = 0; i < 3; i++)
+        {
+            lo[i] = std::max(0, int(std::floor((box.min(i) - origin[i]) / brickSize)));
+            hi[i] = std::min(nBrick[i] - 1, int(std::floor((box.max(i) - origin[i]) / brickSize)));
+            if (lo[i] > hi[i]) return;
+        }
+
+        for (int bz = lo[2]; bz <= hi[2]; bz++)
+        for (int by = lo[1]; by <= hi[1]; by++)
+        for (int bx = lo[0]; bx <= hi[0]; bx++)
+            out.push_back((size_t(bz) * nBrick[1] + by) * nBrick[0] + bx);
+    }
+
+    int BrickGridCollisionObject::classify_brick(const DistanceFunc& dist, size_t idx, short* dst) const
+    {
+        const int bx = int(idx % nBrick[0]);
+        const int by = int(idx / nBrick[0] % nBrick[1]);
+        const int bz = int(idx / nBrick[0] / nBrick[1]);
+
+        // the distance is 1-Lipschitz, a brick whose centre is farther than
+        // band + half diagonal from the surface holds no sample in the band
+        const float halfDiag = 0.5f * std::sqrt(3.f) * BRICK_SIZE * m_cell_size;
+        const float h = 0.5f * BRICK_SIZE;
+        float dc = dist(Point_3(std::min(float(domain.xmax()), origin[0] + (bx * BRICK_SIZE + h) * m_cell_size),
+            std::min(float(domain.ymax()), origin[1] + (by * BRICK_SIZE + h) * m_cell_size),
+            std::min(float(domain.zmax()), origin[2] + (bz * BRICK_SIZE + h) * m_cell_size)));
+
+        if (std::abs(dc) > m_band + halfDiag)
+            return dc < 0.f ? EMPTY_INSIDE : EMPTY_OUTSIDE;
+
+        if (sample_brick(dist, bx, by, bz, dst))
+            return IN_BAND;
+        return dst[0] < 0 ? EMPTY_INSIDE : EMPTY_OUTSIDE;
+    }
+
+    bool BrickGridCollisionObject::sample_brick(const DistanceFunc& dist, int bx, int by, int bz, short* dst) const
+    {
+        bool inBand = false, hasInside = false, hasOutside = false;
+        for (int k = 0; k < S; k++)
+        for (int j = 0; j < S; j++)
+        for (int i = 0; i < S; i++)
+        {
+            // samples past the upper end of the box (the grid is rounded up to
+            // whole bricks) are clamped back onto it
+            float x = std::min(float(domain.xmax()), origin[0] + (bx * BRICK_SIZE + i) * m_cell_size);
+            float y = std::min(float(domain.ymax()), origin[1] + (by * BRICK_SIZE + j) * m_cell_size);
+            float z = std::min(float(domain.zmax()), origin[2] + (bz * BRICK_SIZE + k) * m_cell_size);
+
+            float d = dist(Point_3(x, y, z));
+            if (std::isnan(d)) d = m_band;
+
+            float t = std::max(-1.f, std::min(1.f, d / m_band));
+            *dst++ = short(std::floor(t * QUANT_MAX + 0.5f));
+
+            inBand |= std::abs(d) < m_band;
+            hasInside |= d < 0.f;
+            hasOutside |= d >= 0.f;
+        }
+        return inBand || (hasInside && hasOutside);
+    }
+
+    float BrickGridCollisionObject::sample(const float* p, float* grad) const
+    {
+        int c[3];
+        float f[3];
+        float outside = 0.f;
+        for (int i = 0; i < 3; i++)
+        {
+            float g = (p[i] - origin[i]) * invCell;
+            float gc = std::max(0.f, std::min(g, float(nCell[i])));
+            outside += (g - gc) * (g - gc);
+            c[i] = std::min(int(gc), nCell[i] - 1);
+            f[i] = gc - c[i];
+        }
+
+        int bi = brickIndex[(size_t(c[2] / BRICK_SIZE) * nBrick[1] + c[1] / BRICK_SIZE) * nBrick[0] + c[0] / BRICK_SIZE];
+        if (bi < 0)
+        {
+            if (grad) grad[0] = grad[1] = grad[2] = 0.f;
+            return bi == EMPTY_INSIDE ? -m_band : m_band + std::sqrt(outside) * m_cell_size;
+        }
+
+        const short* s = &samples[size_t(bi) * BRICK_SAMPLES +
+            ((c[2] % BRICK_SIZE) * S + c[1] % BRICK_SIZE) * S + c[0] % BRICK_SIZE];
+
+        float v000 = s[0], v100 = s[1];
+        float v010 = s[S], v110 = s[S + 1];
+        float v001 = s[S * S], v101 = s[S * S + 1];
+        float v011 = s[S * S + S], v111 = s[S * S + S + 1];
+
+        float dx00 = v100 - v000, dx10 = v110 - v010;
+        float dx01 = v101 - v001, dx11 = v111 - v011;
+        float x00 = v000 + f[0] * dx00, x10 = v010 + f[0] * dx10;
+        float x01 = v001 + f[0] * dx01, x11 = v011 + f[0] * dx11;
+        float y0 = x00 + f[1] * (x10 - x00);
+        float y1 = x01 + f[1] * (x11 - x01);
+
+        const float scale = m_band / QUANT_MAX;
+        if (grad)
+        {
+            float gx0 = dx00 + f[1] * (dx10 - dx00);
+            float gx1 = dx01 + f[1] * (dx11 - dx01);
+            grad[0] = (gx0 + f[2] * (gx1 - gx0)) * scale * invCell;
+            grad[1] = ((x10 - x00) + f[2] * ((x11 - x01) - (x10 - x00))) * scale * invCell;
+            grad[2] = (y1 - y0) * scale * invCell;
+        }
+
+        float d = (y0 + f[2] * (y1 - y0)) * scale;
+        if (outside > 0.f) d += std::sqrt(outside) * m_cell_size;
+        return d;
+    }
+
+    float BrickGridCollisionObject::query_distance(const Point_3& p) const
+    {
+        assert(!brickIndex.empty());
+        float x[3] = { p.x(), p.y(), p.z() };
+        return sample(x, nullptr);
+    }
+
+    float BrickGridCollisionObject::query_gradient(const Point_3& p, Vector_3* grad) const
+    {
+        assert(!brickIndex.empty());
+        float x[3] = { p.x(), p.y(), p.z() }, g[3];
+        float d = sample(x, g);
+        if (grad) *grad = Vector_3(g[0], g[1], g[2]);
+        return d;
+    }
+
+    float BrickGridCollisionObject::query_squared_distance(const Point_3& p) const
+    {
+        float d = query_distance(p);
+        return d * d;
+    }
+
+    bool BrickGridCollisionObject::exceed_threshhold(const Point_3& p, float thresh) const
+    {
+        return query_distance(p) < thresh;
+    }
+
+    bool BrickGridCollisionObject::position_correlation(const Point_3& p, Point_3* pCorrect, float thresh) const
+    {
+        assert(!brickIndex.empty());
+
+        float x[3] = { p.x(), p.y(), p.z() }, g[3];
+        float d = sample(x, g);
+        if (d > thresh) return false;
+        if (!pCorrect) return true;
+
+        project(x, d, g, thresh);
+        *pCorrect = Point_3(x[0], x[1], x[2]);
+        return true;
+    }
+
+    void BrickGridCollisionObject::project(float* x, float d, float* g, float thresh) const
+    {
+        // step along the normalized gradient onto the thresh iso-surface, aiming a bit
+        // outside so that the corrected position does not collide again. Another
+        // sample after each step makes up for the interpolated distance and gradient
+        const float target = thresh + PROJECTION_TOL / 2.f;
+        for (int it = 0; it < MAX_PROJECTION_ITERATION && d < thresh; it++)
+        {
+            float gl2 = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+            if (gl2 < 1e-12f) break;
+
+            float step = (target - d) / std::sqrt(gl2);
+            for (int i = 0; i < 3; i++)
+                x[i] += g[i] * step;
+            d = sample(x, g);
+        }
+    }
+
+    void BrickGridCollisionObject::query_batch(CollisionBatch& b) const
+    {
+        assert(!brickIndex.empty());
+
+        // a single lookup gives distance and gradient, no gather is worth it
+        for (size_t i = 0; i < b.n; i++)
+        {
+            float x[3] = { b.pos[0][i], b.pos[1][i], b.pos[2][i] }, g[3];
+            float d = sample(x, g);
+
+            if (b.dist) b.dist[i] = d;
+            if (b.grad[0])
+            {
+                for (int k = 0; k < 3; k++)
+                    b.grad[k][i] = g[k];
+            }
+            if (!b.corrected[0] && !b.collide) continue;
+
+            const float thresh = b.threshold(i);
+            bool isCollide = d <= thresh;
+            if (isCollide && b.corrected[0])
+                project(x, d, g, thresh);
+            if (b.collide) b.collide[i] = isCollide;
+            if (b.corrected[0])
+            {
+                for (int k = 0; k < 3; k++)
+                    b.corrected[k][i] = x[k];
+            }
+        }
+    }
+}
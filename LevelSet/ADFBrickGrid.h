@@ -0,0 +1,77 @@
+#pragma once
+#include "ICollisionObject.h"
+#include <CGAL\Bbox_3.h>
+#include <functional>
+#include <vector>
+#include "wrMacro.h"
+
+namespace WR
+{
+    // Signed distance baked into a sparse grid of 8^3 cell bricks. Only bricks
+    // within a narrow band around the surface are allocated, each one keeps its
+    // 9^3 corner samples (the border is duplicated so that a query never looks
+    // at a neighbour brick) quantized to int16 over [-band, band]. Elsewhere the
+    // distance saturates to +-band with the sign of the empty brick.
+    //
+    // A query is a brick index lookup plus one trilinear interpolation, the
+    // gradient is the analytic derivative of the same interpolant.
+    class BrickGridCollisionObject :
+        public ICollisionObject
+    {
+        COMMON_PROPERTY(float, cell_size);
+        COMMON_PROPERTY(float, band);
+
+    public:
+        typedef std::function<float(const Point_3&)> DistanceFunc;
+
+        static const int BRICK_SIZE = 8;
+        static const int BRICK_SAMPLES = (BRICK_SIZE + 1) * (BRICK_SIZE + 1) * (BRICK_SIZE + 1);
+
+        BrickGridCollisionObject() : m_cell_size(0.f), m_band(0.f) {}
+        ~BrickGridCollisionObject() {}
+
+        // samples dist (the ADF, or an exact mesh distance) over box, which
+        // has to lie in the domain of dist. band is the half width in world units.
+        bool build(const DistanceFunc& dist, const CGAL::Bbox_3& box, float cellSize, float band);
+
+        // resamples the given bricks after the surface moved through them, in
+        // parallel, so dist has to be safe to call concurrently. Bricks entering
+        // the band reuse the storage of those leaving it. Not safe against
+        // concurrent queries.
+        void update(const DistanceFunc& dist, const std::vector<size_t>& bricks);
+        // appends the bricks overlapping box
+        void bricks_in(const CGAL::Bbox_3& box, std::vector<size_t>& out) const;
+
+        virtual float query_distance(const Point_3& p) const;
+        virtual float query_squared_distance(const Point_3& p) const;
+        virtual bool exceed_threshhold(const Point_3& p, float thresh = 0.f) const;
+        virtual bool position_correlation(const Point_3& p, Point_3* pCorrect, float thresh = 0.f) const;
+        virtual void query_batch(CollisionBatch& b) const;
+
+        // distance and its gradient, the gradient is zero outside the band
+        float query_gradient(const Point_3& p, Vector_3* grad) const;
+
+        size_t n_bricks() const { return brickIndex.size(); }
+        size_t n_allocated_bricks() const { return samples.size() / BRICK_SAMPLES - freeBricks.size(); }
+
+    private:
+        enum { IN_BAND = 0, EMPTY_OUTSIDE = -1, EMPTY_INSIDE = -2 };
+
+        float sample(const float* p, float* grad) const;
+        // x is moved in place, d and g are the distance and gradient already sampled there
+        void project(float* x, float d, float* g, float thresh) const;
+        bool sample_brick(const DistanceFunc& dist, int bx, int by, int bz, short* dst) const;
+        // EMPTY_* or IN_BAND with the samples in dst
+        int classify_brick(const DistanceFunc& dist, size_t idx, short* dst) const;
+
+        CGAL::Bbox_3    domain;
+        float   origin[3];
+        float   invCell = 0.f;
+        int     nCell[3];       // cells per axis, a multiple of BRICK_SIZE
+        int     nBrick[3];
+
+        std::vector<int>    brickIndex; // EMPTY_* or the first sample of the brick / BRICK_SAMPLES
+        std::vector<short>  samples;
+        std::vector<int>    freeBricks; // released by update
+    };
+}
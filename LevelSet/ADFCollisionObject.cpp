@@ -1,15 +1,20 @@
 #include "ADFCollisionObject.h"
 #include "wrMacro.h"
 #include <fstream>
+#include <unordered_map>
 #include "wrLogger.h"
 #include "wrMath.h"
+#include "wrMappedFile.h"
 #include "ADFOctree.h"
+#include "ADFLinearOctree.h"
 
 namespace
 {
 #define ADF_SUFFIXW L".adf"
 #define MAX_INTERATION 20
 #define CORRECTION_TOL 3e-4f
+#define MAX_NEWTON_ITERATION 6
+#define MAX_LINE_SEARCH 3
 
     template <class K, class T>
     void simplex3d_interpolation(CGAL::Point_3<K>* cell, T* vals, const CGAL::Point_3<K>& p, T& numer)
@@ -37,6 +42,31 @@ namespace
         numer = numer / sum;
     }
 
+    // same volumes as simplex3d_interpolation, normalized
+    template <class K>
+    void barycentric(const CGAL::Point_3<K>* cell, const CGAL::Point_3<K>& p, float* l)
+    {
+        l[0] = CGAL::volume(cell[1], cell[3], cell[2], p);
+        l[1] = CGAL::volume(cell[2], cell[3], cell[0], p);
+        l[2] = CGAL::volume(cell[0], cell[3], cell[1], p);
+        l[3] = CGAL::volume(cell[0], cell[1], cell[2], p);
+
+        float inv = 1.f / (l[0] + l[1] + l[2] + l[3]);
+        for (size_t i = 0; i < 4; i++)
+            l[i] *= inv;
+    }
+
+    // gradient of the linear interpolation of vals over a tetrahedron
+    template <class K>
+    CGAL::Vector_3<K> linear_gradient(const CGAL::Point_3<K>* cell, const float* vals)
+    {
+        CGAL::Vector_3<K> e1 = cell[1] - cell[0], e2 = cell[2] - cell[0], e3 = cell[3] - cell[0];
+        CGAL::Vector_3<K> n1 = CGAL::cross_product(e2, e3);
+        CGAL::Vector_3<K> n2 = CGAL::cross_product(e3, e1);
+        CGAL::Vector_3<K> n3 = CGAL::cross_product(e1, e2);
+        return (n1 * (vals[1] - vals[0]) + n2 * (vals[2] - vals[0]) + n3 * (vals[3] - vals[0])) / (e1 * n1);
+    }
+
     template <class K, class T>
     T simplex2d_interpolation(CGAL::Point_3<K>* v, T* vals, const CGAL::Point_3<K>& p)
     {
@@ -75,13 +105,45 @@ namespace
         return numer / sum;
     }
 
-    size_t g_count = 0;
+    // binary .adf: header, finite vertices, then every cell of the triangulation
+    // with its vertices (0 is the infinite vertex, finite ones start at 1) and neighbours.
+    // Since version 2 the linear octree, if any, follows the cells. Since version 3
+    // there may be no triangulation (no vertex and no cell) when the octree is present.
+    const char ADF_MAGIC[4] = { 'W', 'A', 'D', 'F' };
+    const int ADF_VERSION = 3;
+
+#pragma pack(push, 1)
+    struct ADFFileHeader
+    {
+        char    magic[4];
+        int     version;
+        float   max_step;
+        int     max_level;
+        float   bbox[6];    // min xyz, max xyz
+        int     nVertex;
+        int     nCell;
+    };
+
+    struct ADFVertexRecord
+    {
+        float   p[3];
+        float   minDist;
+        float   gradient[3];
+    };
+
+    struct ADFCellRecord
+    {
+        int     v[4];
+        int     n[4];
+    };
+#pragma pack(pop)
 }
 
 
 namespace WR
 {
-    ADFCollisionObject::ADFCollisionObject(const wchar_t* fileName)
+    ADFCollisionObject::ADFCollisionObject(const wchar_t* fileName) :
+        m_projection_mode(PROJECT_NEWTON)
     {
         load_model(fileName);
     }
@@ -90,6 +152,59 @@ namespace WR
     void ADFCollisionObject::release()
     {
         SAFE_DELETE(pDt);
+        SAFE_DELETE(pOctree);
+        locateGrid.clear();
+        gridRes = 0;
+    }
+
+    void ADFCollisionObject::build_locate_grid()
+    {
+        const size_t nVertex = pDt->number_of_vertices();
+        gridRes = std::max<size_t>(1, std::min<size_t>(64, size_t(std::cbrt(nVertex / 4.0))));
+        locateGrid.assign(gridRes * gridRes * gridRes, Dt::Vertex_handle());
+
+        // keep the vertex closest to each grid cell centre
+        std::vector<float> best(locateGrid.size(), std::numeric_limits<float>::max());
+        for (auto itr = pDt->finite_vertices_begin(); itr != pDt->finite_vertices_end(); itr++)
+        {
+            const Point_3& p = itr->point();
+            size_t idx = 0;
+            float d2 = 0.f;
+            for (int i = 2; i >= 0; i--)
+            {
+                float t = (p[i] - m_bbox.min()[i]) / (m_bbox.max()[i] - m_bbox.min()[i]) * gridRes;
+                size_t c = size_t(std::max(0.f, std::min(t, gridRes - 1.f)));
+                d2 += (t - c - 0.5f) * (t - c - 0.5f);
+                idx = idx * gridRes + c;
+            }
+            if (d2 < best[idx])
+            {
+                best[idx] = d2;
+                locateGrid[idx] = itr;
+            }
+        }
+
+        // empty grid cells start from the last filled one
+        Dt::Vertex_handle last = pDt->finite_vertices_begin();
+        for (auto& vh : locateGrid)
+        {
+            if (vh == Dt::Vertex_handle()) vh = last;
+            else last = vh;
+        }
+    }
+
+    ADFCollisionObject::Dt::Cell_handle ADFCollisionObject::locate(const Point_3& p, Dt::Cell_handle hint) const
+    {
+        if (hint != Dt::Cell_handle() || locateGrid.empty())
+            return pDt->locate(p, hint);
+
+        size_t idx = 0;
+        for (int i = 2; i >= 0; i--)
+        {
+            float t = (p[i] - m_bbox.min()[i]) / (m_bbox.max()[i] - m_bbox.min()[i]) * gridRes;
+            idx = idx * gridRes + size_t(std::max(0.f, std::min(t, gridRes - 1.f)));
+        }
+        return pDt->locate(p, locateGrid[idx]->cell());
     }
 
     float ADFCollisionObject::fake_extrapolate(const Point_3& p, const Point_3 v[], size_t infId, Dt::Cell_handle ch) const
@@ -145,12 +260,22 @@ namespace WR
         return dist;
     }
 
+    float ADFCollisionObject::query_distance(const Point_3& p) const
+    {
+        if (pOctree)
+        {
+            float x[3] = { p.x(), p.y(), p.z() };
+            return pOctree->query_distance(x);
+        }
+        return query_distance_template(p, &ADFCollisionObject::no_extrapolate);
+    }
+
     float ADFCollisionObject::query_distance_template(const Point_3& p, ExtrapolateFunc func) const
     {
         assert(pDt);
         assert(pDt->number_of_cells());
 
-        Dt::Cell_handle ch = pDt->locate(p);
+        Dt::Cell_handle ch = locate(p);
 
         Point_3 v[4];
         bool isInf = false;
@@ -186,28 +311,59 @@ namespace WR
 
     float ADFCollisionObject::query_squared_distance(const Point_3& p) const
     {
-        UNIMPLEMENTED_DECLARATION;
-        return 0.f;
+        float d = query_distance(p);
+        return d * d;
     }
 
 
+    // true when p is closer than thresh, like SphereCollisionObject. Points whose
+    // cell (or octree node) lies entirely beyond thresh are rejected on its bounds
     bool ADFCollisionObject::exceed_threshhold(const Point_3& p, float thresh) const
     {
-        UNIMPLEMENTED_DECLARATION;
-        return false;
+        if (pOctree)
+        {
+            float x[3] = { p.x(), p.y(), p.z() };
+            return pOctree->query_distance_bounded(x, thresh) < thresh;
+        }
+
+        assert(pDt);
+        Dt::Cell_handle ch = locate(p);
+
+        Point_3 v[4];
+        float vals[4];
+        for (size_t i = 0; i < 4; i++)
+        {
+            if (ch->vertex(i) == pDt->infinite_vertex())
+                return false;
+            v[i] = ch->vertex(i)->point();
+            vals[i] = ch->vertex(i)->info().minDist;
+        }
+
+        if (*std::min_element(vals, vals + 4) >= thresh)
+            return false;
+
+        float result = 0.f;
+        simplex3d_interpolation(v, vals, p, result);
+        return result < thresh;
     }
 
 
     bool ADFCollisionObject::position_correlation(const Point_3& p, Point_3* pCorrect, float thresh) const
     {
-        assert(pDt);
-        assert(pDt->number_of_cells());
-
         if (CGAL::ON_UNBOUNDED_SIDE == m_bbox.bounded_side(p))
             return false;
 
-        Dt::Cell_handle ch = pDt->locate(p);
+        if (pOctree)
+            return position_correlation_octree(p, pCorrect, thresh);
 
+        assert(pDt);
+        assert(pDt->number_of_cells());
+
+        return position_correlation_in_cell(p, locate(p), pCorrect, thresh);
+    }
+
+    bool ADFCollisionObject::position_correlation_in_cell(const Point_3& p, Dt::Cell_handle ch, Point_3* pCorrect, float thresh) const
+    {
         Point_3 v[4];
         bool isInf = false;
         int infId = -1;
@@ -229,15 +385,15 @@ namespace WR
         else
         {
             assert(CGAL::volume(v[0], v[1], v[2], v[3]) > 0);
-            std::vector<float> vals(4);
+            float vals[4];
             for (size_t i = 0; i < 4; i++)
                 vals[i] = ch->vertex(i)->info().minDist;
 
-            if (*std::min_element(vals.cbegin(), vals.cend()) > thresh)
+            if (*std::min_element(vals, vals + 4) > thresh)
                 return false;
 
             float cur_value = 0.f;
-            simplex3d_interpolation(v, vals.data(), p, cur_value);
+            simplex3d_interpolation(v, vals, p, cur_value);
 
             if (cur_value > thresh)
             {
@@ -247,16 +403,24 @@ namespace WR
             {
                 if (!pCorrect) return true;
 
-                std::vector<Vector_3> grads(4);
+                if (m_projection_mode == PROJECT_NEWTON)
+                {
+                    *pCorrect = project_newton_dt(p, ch, thresh);
+                    return true;
+                }
+
+                Vector_3 grads[4];
                 for (size_t i = 0; i < 4; i++)
                     grads[i] = ch->vertex(i)->info().gradient;
 
                 Point_3 curPos, newPos;
-                g_count = 0;
-                correct_position_by_gradient(p, curPos, v, grads.data(), cur_value, thresh);
+                correct_position_by_gradient(p, curPos, v, grads, cur_value, thresh);
 
+                // the iteration count is local, concurrent corrections share nothing
+                size_t nIter = 1;
                 Dt::Cell_handle ch_hint = ch, ch_new;
-                while (position_correlation_iteration(curPos, newPos, ch_new, ch_hint, thresh) && g_count < MAX_INTERATION)
+                newPos = curPos;
+                while (position_correlation_iteration(curPos, newPos, ch_new, ch_hint, thresh) && ++nIter < MAX_INTERATION)
                 {
                     ch_hint = ch_new;
                     curPos = newPos;
@@ -267,12 +431,280 @@ namespace WR
         }
     }
 
-    bool ADFCollisionObject::position_correlation_iteration(const Point_3& p, Point_3& newPos, Dt::Cell_handle chnew, Dt::Cell_handle chhint, float thresh) const
+    bool ADFCollisionObject::position_correlation_octree(const Point_3& p, Point_3* pCorrect, float thresh) const
+    {
+        float x[3] = { p.x(), p.y(), p.z() }, g[3];
+        float cur_value = pOctree->query_distance_bounded(x, thresh, g);
+        if (cur_value > thresh) return false;
+        if (!pCorrect) return true;
+
+        correct_position_octree(x, cur_value, g, thresh);
+        *pCorrect = Point_3(x[0], x[1], x[2]);
+        return true;
+    }
+
+    ADFCollisionObject::Point_3 ADFCollisionObject::project_newton_dt(const Point_3& p, Dt::Cell_handle ch, float thresh) const
+    {
+        // aim a bit outside so that the corrected position does not collide again
+        const float target = thresh + CORRECTION_TOL / 2.0f;
+
+        Point_3 x = p;
+        Point_3 v[4];
+        float vals[4], l[4];
+        for (size_t i = 0; i < 4; i++)
+        {
+            v[i] = ch->vertex(i)->point();
+            vals[i] = ch->vertex(i)->info().minDist;
+        }
+        barycentric(v, x, l);
+        float d = l[0] * vals[0] + l[1] * vals[1] + l[2] * vals[2] + l[3] * vals[3];
+
+        for (size_t it = 0; it < MAX_NEWTON_ITERATION; it++)
+        {
+            if (d > thresh && d - thresh < CORRECTION_TOL) break;
+
+            Vector_3 g = linear_gradient(v, vals);
+            float gl2 = g.squared_length();
+            if (gl2 < 1e-12f) break;
+            Vector_3 s = g * ((target - d) / gl2);
+
+            // the interpolant is linear in the cell, a step that stays inside is exact
+            barycentric(v, x + s, l);
+            if (*std::min_element(l, l + 4) >= 0.f)
+            {
+                x = x + s;
+                break;
+            }
+
+            // otherwise backtrack along s until the residual decreases
+            bool improved = false;
+            Point_3 xn;
+            Dt::Cell_handle chn;
+            float t = 1.f, dn = d;
+            for (int ls = 0; ls <= MAX_LINE_SEARCH && !improved; ls++, t *= 0.5f)
+            {
+                xn = x + s * t;
+                chn = locate(xn, ch);
+                if (pDt->is_infinite(chn)) continue;
+
+                for (size_t i = 0; i < 4; i++)
+                {
+                    v[i] = chn->vertex(i)->point();
+                    vals[i] = chn->vertex(i)->info().minDist;
+                }
+                barycentric(v, xn, l);
+                dn = l[0] * vals[0] + l[1] * vals[1] + l[2] * vals[2] + l[3] * vals[3];
+                improved = std::abs(dn - target) < std::abs(d - target);
+            }
+            if (!improved) break;
+
+            x = xn;
+            ch = chn;
+            d = dn;
+        }
+        return x;
+    }
+
+    void ADFCollisionObject::correct_position_octree(float* x, float cur_value, float* g, float thresh) const
+    {
+        if (m_projection_mode == PROJECT_NEWTON)
+        {
+            project_newton_octree(x, cur_value, g, thresh);
+            return;
+        }
+
+        // same damped gradient steps as the triangulation path, the octree
+        // gives distance and gradient in one descent
+        for (size_t it = 0; it < MAX_INTERATION; it++)
+        {
+            float gl = std::sqrt(g[0] * g[0] + g[1] * g[1] + g[2] * g[2]);
+            if (gl < 1e-6f) break;
+
+            float rawStep = cur_value - thresh - CORRECTION_TOL / 2.0f;
+            float step = sgn(rawStep) * std::min(m_max_step, std::abs(rawStep)) / gl;
+            for (int i = 0; i < 3; i++)
+                x[i] -= g[i] * step;
+
+            cur_value = pOctree->query_distance(x, g);
+            if (cur_value > thresh && cur_value - thresh < CORRECTION_TOL) break;
+        }
+    }
+
+    void ADFCollisionObject::project_newton_octree(float* x, float d, float* g, float thresh) const
+    {
+        const float target = thresh + CORRECTION_TOL / 2.0f;
+        for (size_t it = 0; it < MAX_NEWTON_ITERATION; it++)
+        {
+            if (d > thresh && d - thresh < CORRECTION_TOL) break;
+
+            float gl2 = g[0] * g[0] + g[1] * g[1] + g[2] * g[2];
+            if (gl2 < 1e-12f) break;
+
+            float s[3];
+            for (int i = 0; i < 3; i++)
+                s[i] = g[i] * (target - d) / gl2;
+
+            // the trilinear interpolant is nonlinear across leaves, backtrack
+            // along s until the residual decreases
+            float xn[3], gn[3], dn = d, t = 1.f;
+            bool improved = false;
+            for (int ls = 0; ls <= MAX_LINE_SEARCH && !improved; ls++, t *= 0.5f)
+            {
+                for (int i = 0; i < 3; i++)
+                    xn[i] = x[i] + s[i] * t;
+                dn = pOctree->query_distance(xn, gn);
+                improved = std::abs(dn - target) < std::abs(d - target);
+            }
+            if (!improved) break;
+
+            for (int i = 0; i < 3; i++)
+            {
+                x[i] = xn[i];
+                g[i] = gn[i];
+            }
+            d = dn;
+        }
+    }
+
+    void ADFCollisionObject::query_batch(CollisionBatch& b) const
+    {
+        if (!pOctree)
+        {
+            query_batch_dt(b);
+            return;
+        }
+
+        // only the collision result is wanted, as in the simulation: most points
+        // stop at a coarse node that is entirely beyond their threshold
+        if (!b.dist && !b.grad[0])
+        {
+            for (size_t i = 0; i < b.n; i++)
+            {
+                float x[3] = { b.pos[0][i], b.pos[1][i], b.pos[2][i] }, g[3];
+                const float thresh = b.threshold(i);
+                float d = pOctree->query_distance_bounded(x, thresh, g);
+                bool isCollide = d <= thresh && CGAL::ON_UNBOUNDED_SIDE != m_bbox.bounded_side(Point_3(x[0], x[1], x[2]));
+                if (isCollide && b.corrected[0])
+                    correct_position_octree(x, d, g, thresh);
+                if (b.collide) b.collide[i] = isCollide;
+                if (b.corrected[0])
+                {
+                    for (int k = 0; k < 3; k++)
+                        b.corrected[k][i] = x[k];
+                }
+            }
+            return;
+        }
+
+        // distances and gradients of a chunk in one batched descent, then the
+        // few colliding points are corrected one by one
+        const size_t CHUNK = 64;
+        float dist[CHUNK], grad[3][CHUNK];
+        float* gp[3] = { grad[0], grad[1], grad[2] };
+
+        for (size_t i0 = 0; i0 < b.n; i0 += CHUNK)
+        {
+            const size_t m = std::min(CHUNK, b.n - i0);
+            const float* pos[3] = { b.pos[0] + i0, b.pos[1] + i0, b.pos[2] + i0 };
+            pOctree->query_batch(m, pos, dist, gp);
+
+            for (size_t j = 0; j < m; j++)
+            {
+                const size_t i = i0 + j;
+                if (b.dist) b.dist[i] = dist[j];
+                if (b.grad[0])
+                {
+                    for (int k = 0; k < 3; k++)
+                        b.grad[k][i] = grad[k][j];
+                }
+                if (!b.corrected[0] && !b.collide) continue;
+
+                float x[3] = { pos[0][j], pos[1][j], pos[2][j] };
+                const float thresh = b.threshold(i);
+                bool isCollide = dist[j] <= thresh && CGAL::ON_UNBOUNDED_SIDE != m_bbox.bounded_side(Point_3(x[0], x[1], x[2]));
+                if (isCollide && b.corrected[0])
+                {
+                    float g[3] = { grad[0][j], grad[1][j], grad[2][j] };
+                    correct_position_octree(x, dist[j], g, thresh);
+                }
+                if (b.collide) b.collide[i] = isCollide;
+                if (b.corrected[0])
+                {
+                    for (int k = 0; k < 3; k++)
+                        b.corrected[k][i] = x[k];
+                }
+            }
+        }
+    }
+
+    void ADFCollisionObject::query_batch_dt(CollisionBatch& b) const
+    {
+        assert(pDt);
+
+        // batches are usually strands, consecutive points are close and the
+        // previous cell is a better start than the location grid
+        Dt::Cell_handle hint;
+        for (size_t i = 0; i < b.n; i++)
+        {
+            Point_3 p(b.pos[0][i], b.pos[1][i], b.pos[2][i]);
+            Dt::Cell_handle ch = locate(p, hint);
+            hint = ch;
+
+            int infId = -1;
+            Point_3 v[4];
+            for (int k = 0; k < 4; k++)
+            {
+                if (ch->vertex(k) == pDt->infinite_vertex()) infId = k;
+                else v[k] = ch->vertex(k)->point();
+            }
+
+            if (b.dist || b.grad[0])
+            {
+                float d = std::numeric_limits<float>::max();
+                Vector_3 g(0, 0, 0);
+                if (infId < 0)
+                {
+                    float vals[4];
+                    Vector_3 grads[4];
+                    for (int k = 0; k < 4; k++)
+                    {
+                        vals[k] = ch->vertex(k)->info().minDist;
+                        grads[k] = ch->vertex(k)->info().gradient;
+                    }
+                    d = 0.f;
+                    simplex3d_interpolation(v, vals, p, d);
+                    simplex3d_interpolation(v, grads, p, g);
+                }
+                if (b.dist) b.dist[i] = d;
+                if (b.grad[0])
+                {
+                    for (int k = 0; k < 3; k++)
+                        b.grad[k][i] = g[k];
+                }
+            }
+
+            if (b.corrected[0] || b.collide)
+            {
+                Point_3 c = p;
+                bool isCollide = CGAL::ON_UNBOUNDED_SIDE != m_bbox.bounded_side(p) &&
+                    position_correlation_in_cell(p, ch, &c, b.threshold(i));
+                if (b.collide) b.collide[i] = isCollide;
+                if (b.corrected[0])
+                {
+                    b.corrected[0][i] = c.x();
+                    b.corrected[1][i] = c.y();
+                    b.corrected[2][i] = c.z();
+                }
+            }
+        }
+    }
+
+    bool ADFCollisionObject::position_correlation_iteration(const Point_3& p, Point_3& newPos, Dt::Cell_handle& chnew, Dt::Cell_handle chhint, float thresh) const
     {
         chnew = pDt->locate(p, chhint);
 
-        std::vector<float> dist(4);
-        std::vector<Point_3> pts(4);
+        float dist[4];
+        Point_3 pts[4];
         for (size_t i = 0; i < 4; i++)
         {
             pts[i] = chnew->vertex(i)->point();
@@ -280,15 +712,15 @@ namespace WR
         }
 
         float cur_value = 0.f;
-        simplex3d_interpolation(pts.data(), dist.data(), p, cur_value);
+        simplex3d_interpolation(pts, dist, p, cur_value);
 
         if (cur_value > thresh && cur_value - thresh < CORRECTION_TOL) return false;
 
-        std::vector<Vector_3> grads(4);
+        Vector_3 grads[4];
         for (size_t i = 0; i < 4; i++)
             grads[i] = chnew->vertex(i)->info().gradient;
 
-        correct_position_by_gradient(p, newPos, pts.data(), grads.data(), cur_value, thresh + CORRECTION_TOL / 2.0f);
+        correct_position_by_gradient(p, newPos, pts, grads, cur_value, thresh + CORRECTION_TOL / 2.0f);
 
         return true;
     }
@@ -301,21 +733,26 @@ namespace WR
         float rawStep = cur_value - thresh;
         float step = sgn(rawStep) * std::min(m_max_step, std::abs(rawStep));
         newPos = p - g * step * 0.8f;
-
-        //WR_LOG_DEBUG << "correlation iteration: " << g_count <<
-        //    " dist: " << query_distance(newPos) << " step: " << step;
-        g_count++;
     }
 
-    bool ADFCollisionObject::save_model(const wchar_t* fileName) const
+    bool ADFCollisionObject::save_model(const wchar_t* fileName, bool binary) const
     {
-        assert(pDt);
+        if (!binary && !pDt)
+        {
+            WR_LOG_ERROR << "the text format needs the triangulation.";
+            return false;
+        }
 
         std::wstring fullName(fileName);
         size_t sz;
         const wchar_t *pch;
         ADD_SUFFIX_IF_NECESSARYW(fileName, ADF_SUFFIXW, fullName);
 
+        return binary ? save_model_binary(fullName) : save_model_text(fullName);
+    }
+
+    bool ADFCollisionObject::save_model_text(const std::wstring& fullName) const
+    {
         std::ofstream file(fullName);
         assert(file);
 
@@ -334,6 +771,76 @@ namespace WR
         return true;
     }
 
+    bool ADFCollisionObject::save_model_binary(const std::wstring& fullName) const
+    {
+        std::ofstream file(fullName, std::ios::binary);
+        if (!file.is_open())
+        {
+            WR_LOG_ERROR << "cannot open file for writing.";
+            return false;
+        }
+
+        // finite vertices are numbered from 1, 0 is the infinite vertex
+        std::unordered_map<const void*, int> vIndex, cIndex;
+        std::vector<ADFVertexRecord> vertices;
+        std::vector<ADFCellRecord> cells;
+        if (pDt)
+        {
+            vertices.reserve(pDt->number_of_vertices());
+            vIndex[&*pDt->infinite_vertex()] = 0;
+            for (auto itr = pDt->finite_vertices_begin(); itr != pDt->finite_vertices_end(); itr++)
+            {
+                ADFVertexRecord r;
+                auto& info = itr->info();
+                for (int i = 0; i < 3; i++)
+                {
+                    r.p[i] = itr->point()[i];
+                    r.gradient[i] = info.gradient[i];
+                }
+                r.minDist = info.minDist;
+                vIndex[&*itr] = int(vertices.size() + 1);
+                vertices.push_back(r);
+            }
+
+            const Dt::Triangulation_data_structure& tds = pDt->tds();
+            int nCell = 0;
+            for (auto itr = tds.cells_begin(); itr != tds.cells_end(); itr++)
+                cIndex[&*itr] = nCell++;
+
+            cells.reserve(nCell);
+            for (auto itr = tds.cells_begin(); itr != tds.cells_end(); itr++)
+            {
+                ADFCellRecord r;
+                for (int i = 0; i < 4; i++)
+                {
+                    r.v[i] = vIndex[&*itr->vertex(i)];
+                    r.n[i] = cIndex[&*itr->neighbor(i)];
+                }
+                cells.push_back(r);
+            }
+        }
+
+        ADFFileHeader header;
+        memcpy(header.magic, ADF_MAGIC, 4);
+        header.version = ADF_VERSION;
+        header.max_step = m_max_step;
+        header.max_level = int(m_max_level);
+        for (int i = 0; i < 3; i++)
+        {
+            header.bbox[i] = m_bbox.min()[i];
+            header.bbox[i + 3] = m_bbox.max()[i];
+        }
+        header.nVertex = int(vertices.size());
+        header.nCell = int(cells.size());
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(vertices.data()), sizeof(ADFVertexRecord) * vertices.size());
+        file.write(reinterpret_cast<const char*>(cells.data()), sizeof(ADFCellRecord) * cells.size());
+        if (pOctree)
+            pOctree->save(file);
+        return file.good();
+    }
+
     bool ADFCollisionObject::load_model(const wchar_t* fileName)
     {
         release();
@@ -345,6 +852,28 @@ namespace WR
 
         WR_LOG_INFO << "load Model: " << fullName;
 
+        MappedFile file;
+        if (!file.open(fullName.c_str()))
+        {
+            WR_LOG_ERROR << "cannot open the model.";
+            return false;
+        }
+
+        bool result = false;
+        if (file.size() >= 4 && !memcmp(file.data(), ADF_MAGIC, 4))
+            result = load_model_binary(file.data(), file.size());
+        else
+        {
+            file.close();
+            result = load_model_text(fullName);
+        }
+
+        if (result) WR_LOG_INFO << "load succeded! " << fullName;
+        return result;
+    }
+
+    bool ADFCollisionObject::load_model_text(const std::wstring& fullName)
+    {
         std::ifstream file(fullName);
         assert(file);
 
@@ -376,8 +905,110 @@ namespace WR
             count++;
         }
         file.close();
+        return true;
+    }
+
+    bool ADFCollisionObject::load_model_binary(const char* data, size_t size)
+    {
+        ADFFileHeader header;
+        if (size < sizeof(header))
+            return false;
+        memcpy(&header, data, sizeof(header));
 
-        WR_LOG_INFO << "load succeded! " << fullName;
+        if (header.version < 1 || header.version > ADF_VERSION)
+        {
+            WR_LOG_ERROR << "unsupported adf version " << header.version;
+            return false;
+        }
+
+        // counts are checked by division so that no product wraps around
+        size_t left = size - sizeof(header);
+        if (header.nVertex < 0 || header.nCell < 0 || size_t(header.nVertex) > left / sizeof(ADFVertexRecord))
+        {
+            WR_LOG_ERROR << "truncated adf file.";
+            return false;
+        }
+        const size_t nVertex = header.nVertex;
+        left -= nVertex * sizeof(ADFVertexRecord);
+        if (size_t(header.nCell) > left / sizeof(ADFCellRecord))
+        {
+            WR_LOG_ERROR << "truncated adf file.";
+            return false;
+        }
+        const size_t nCell = header.nCell;
+        const size_t dtSize = sizeof(header) + nVertex * sizeof(ADFVertexRecord) + nCell * sizeof(ADFCellRecord);
+
+        m_max_step = header.max_step;
+        m_max_level = header.max_level;
+        m_bbox = BoundingBox(Point_3(header.bbox[0], header.bbox[1], header.bbox[2]),
+            Point_3(header.bbox[3], header.bbox[4], header.bbox[5]));
+
+        const ADFVertexRecord* vr = reinterpret_cast<const ADFVertexRecord*>(data + sizeof(header));
+        const ADFCellRecord* cr = reinterpret_cast<const ADFCellRecord*>(vr + nVertex);
+
+        // rebuild the triangulation data structure as it was saved, no point is re-inserted
+        if (nVertex > 0)
+        {
+            pDt = new Dt;
+            Dt::Triangulation_data_structure& tds = pDt->tds();
+            tds.clear();
+
+            std::vector<Dt::Vertex_handle> vhs(nVertex + 1);
+            vhs[0] = tds.create_vertex();
+            pDt->set_infinite_vertex(vhs[0]);
+            for (size_t i = 0; i < nVertex; i++)
+            {
+                auto vh = tds.create_vertex();
+                vh->set_point(Point_3(vr[i].p[0], vr[i].p[1], vr[i].p[2]));
+                vh->info().minDist = vr[i].minDist;
+                vh->info().gradient = Vector_3(vr[i].gradient[0], vr[i].gradient[1], vr[i].gradient[2]);
+                vhs[i + 1] = vh;
+            }
+
+            std::vector<Dt::Cell_handle> chs(nCell);
+            for (size_t i = 0; i < nCell; i++)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    if (size_t(cr[i].v[k]) > nVertex || size_t(cr[i].n[k]) >= nCell)
+                    {
+                        WR_LOG_ERROR << "corrupted adf cell " << i;
+                        release();
+                        return false;
+                    }
+                }
+                chs[i] = tds.create_cell(vhs[cr[i].v[0]], vhs[cr[i].v[1]], vhs[cr[i].v[2]], vhs[cr[i].v[3]]);
+            }
+
+            for (size_t i = 0; i < nCell; i++)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    chs[i]->set_neighbor(k, chs[cr[i].n[k]]);
+                    vhs[cr[i].v[k]]->set_cell(chs[i]);
+                }
+            }
+            tds.set_dimension(3);
+
+            assert(pDt->number_of_vertices() == nVertex);
+            build_locate_grid();
+        }
+
+        if (header.version >= 2 && size > dtSize)
+        {
+            pOctree = new ADFLinearOctree;
+            if (!pOctree->load(data + dtSize, size - dtSize))
+            {
+                WR_LOG_ERROR << "corrupted adf octree, falling back to the triangulation.";
+                SAFE_DELETE(pOctree);
+            }
+        }
+
+        if (!pDt && !pOctree)
+        {
+            WR_LOG_ERROR << "adf file without triangulation nor octree.";
+            return false;
+        }
         return true;
     }
 
@@ -8,14 +8,25 @@
 
 namespace WR
 {
+    class ADFLinearOctree;
+
     class ADFCollisionObject :
         public ICollisionObject
     {
         typedef CGAL::Iso_cuboid_3<K> BoundingBox;
 
+    public:
+        // how position_correlation moves a colliding point onto the thresh iso-surface
+        enum ProjectionMode
+        {
+            PROJECT_GRADIENT,   // damped steps along the interpolated vertex gradients
+            PROJECT_NEWTON      // Newton steps with a line search on the interpolant itself
+        };
+
         COMMON_PROPERTY(BoundingBox, bbox);
         COMMON_PROPERTY(size_t, max_level);
         COMMON_PROPERTY(float, max_step);
+        COMMON_PROPERTY(ProjectionMode, projection_mode);
 
         friend class ADFOctree;
 
@@ -32,37 +43,70 @@ namespace WR
         typedef float(ADFCollisionObject::*ExtrapolateFunc)(const Point_3& p, const Point_3 v[], size_t infId, Dt::Cell_handle ch) const;
 
     public:
-        ADFCollisionObject(Dt* stt, const BoundingBox& box, size_t lvl, float sz) :
-            pDt(stt), m_bbox(box), m_max_level(lvl), m_max_step(sz * 0.95f){
-            compute_gradient();
+        // takes ownership of the triangulation and of the octree, one of them may be null
+        ADFCollisionObject(Dt* stt, const BoundingBox& box, size_t lvl, float sz, ADFLinearOctree* octree = nullptr) :
+            pDt(stt), pOctree(octree), m_bbox(box), m_max_level(lvl), m_max_step(sz * 0.95f), m_projection_mode(PROJECT_NEWTON){
+            assert(pDt || pOctree);
+            if (pDt) compute_gradient();
         }
         ADFCollisionObject(const wchar_t*);
         ~ADFCollisionObject() { release(); }
 
-        virtual float query_distance(const Point_3& p) const { return query_distance_template(p, &ADFCollisionObject::no_extrapolate); }
+        virtual float query_distance(const Point_3& p) const;
         virtual float query_squared_distance(const Point_3& p) const;
         virtual bool exceed_threshhold(const Point_3& p, float thresh = 0.f) const;
         virtual bool position_correlation(const Point_3& p, Point_3* pCorrect, float thresh = 0.f) const;
+        // the octree path gathers four leaves and interpolates them with SSE, the
+        // triangulation path starts each point location from the previous cell
+        virtual void query_batch(CollisionBatch& b) const;
 
-        bool save_model(const wchar_t*) const;
+        // binary .adf by default, the text format is kept as an export option and
+        // needs the triangulation. load_model tells the two apart by the magic of
+        // the binary header.
+        bool save_model(const wchar_t*, bool binary = true) const;
         bool load_model(const wchar_t*);
 
         void compute_gradient();
 
+        // when present, queries descend the octree instead of walking the triangulation
+        const ADFLinearOctree* get_octree() const { return pOctree; }
+
     private:
+        bool position_correlation_in_cell(const Point_3& p, Dt::Cell_handle ch, Point_3* pCorrect, float thresh) const;
         // must be in finite cell, near hint
-        bool position_correlation_iteration(const Point_3& p, Point_3& newPos, Dt::Cell_handle chnew, Dt::Cell_handle chhint, float thresh) const;
+        bool position_correlation_iteration(const Point_3& p, Point_3& newPos, Dt::Cell_handle& chnew, Dt::Cell_handle chhint, float thresh) const;
         void correct_position_by_gradient(const Point_3& p, Point_3& newPos, Point_3* pts, Vector_3* grads, float cur_value, float thresh) const;
+        // the interpolant is linear in a cell, a Newton step that stays in it is exact and
+        // needs no point location. Steps that leave it are backtracked until the residual decreases
+        Point_3 project_newton_dt(const Point_3& p, Dt::Cell_handle ch, float thresh) const;
         float query_distance_with_extrapolation(const Point_3& p) const { return query_distance_template(p, &ADFCollisionObject::extrapolate); }
         float query_distance_with_fake_extrapolation(const Point_3& p) const { return query_distance_template(p, &ADFCollisionObject::fake_extrapolate); }
         float query_distance_template(const Point_3& p, ExtrapolateFunc func) const;
+        bool position_correlation_octree(const Point_3& p, Point_3* pCorrect, float thresh) const;
+        // x is moved in place, d and g are the distance and gradient already queried there
+        void correct_position_octree(float* x, float d, float* g, float thresh) const;
+        void project_newton_octree(float* x, float d, float* g, float thresh) const;
+        void query_batch_dt(CollisionBatch& b) const;
 
         float no_extrapolate(const Point_3& p, const Point_3 v[], size_t infId, Dt::Cell_handle ch) const { return std::numeric_limits<float>::max(); }
         float extrapolate(const Point_3& p, const Point_3 v[], size_t infId, Dt::Cell_handle ch) const;
         float fake_extrapolate(const Point_3& p, const Point_3 v[], size_t infId, Dt::Cell_handle ch) const;
 
+        bool save_model_text(const std::wstring& fileName) const;
+        bool save_model_binary(const std::wstring& fileName) const;
+        bool load_model_text(const std::wstring& fileName);
+        bool load_model_binary(const char* data, size_t size);
+
+        // a triangulation loaded from the binary format has no location hierarchy;
+        // a coarse grid of start vertices over the bbox replaces it
+        Dt::Cell_handle locate(const Point_3& p, Dt::Cell_handle hint = Dt::Cell_handle()) const;
+        void build_locate_grid();
+
         void release();
 
         Dt* pDt = nullptr;
+        ADFLinearOctree* pOctree = nullptr;
+        std::vector<Dt::Vertex_handle> locateGrid;
+        size_t gridRes = 0;
     };
 }
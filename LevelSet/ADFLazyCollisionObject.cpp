@@ -0,0 +1,65 @@
+#include "ADFLazyCollisionObject.h"
+#include "ADFLinearOctree.h"
+#include "wrLogger.h"
+
+namespace WR
+{
+    ADFLazyCollisionObject::ADFLazyCollisionObject(Polyhedron_3_FaceWithId& geom, size_t maxLvl, size_t coarseLvl) :
+        pTree(new ADFOctree), busy(false), nRefined(0)
+    {
+        if (!pTree->constructCoarse(geom, coarseLvl, maxLvl))
+            throw std::exception("Failed to construct the coarse ADF");
+        pObject.reset(pTree->createCollisionObject(true));
+    }
+
+    ADFLazyCollisionObject::~ADFLazyCollisionObject()
+    {
+        tasks.wait();
+        SAFE_DELETE(pTree);
+    }
+
+    bool ADFLazyCollisionObject::refine_async(unsigned minTouches)
+    {
+        bool expected = false;
+        if (!busy.compare_exchange_strong(expected, true))
+            return false;
+
+        tasks.run([this, minTouches]
+        {
+            refine_current(minTouches);
+            busy = false;
+        });
+        return true;
+    }
+
+    void ADFLazyCollisionObject::refine(unsigned minTouches)
+    {
+        tasks.wait();
+        refine_current(minTouches);
+    }
+
+    void ADFLazyCollisionObject::refine_current(unsigned minTouches)
+    {
+        // the current object is made from the tree as it is now, so its leaf
+        // numbers are the tree's
+        std::shared_ptr<const ADFCollisionObject> obj = current();
+        const ADFLinearOctree* pOctree = obj->get_octree();
+
+        std::vector<unsigned> leaves;
+        for (unsigned i = 0; i < unsigned(pOctree->n_leaves()); i++)
+        {
+            if (pOctree->touch_count(i) >= minTouches)
+                leaves.push_back(i);
+        }
+        if (leaves.empty())
+            return;
+
+        size_t n = pTree->refine(leaves);
+        if (!n)
+            return;
+
+        std::shared_ptr<const ADFCollisionObject> next(pTree->createCollisionObject(true));
+        std::atomic_store(&pObject, next);
+        nRefined += n;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "ICollisionObject.h"
+#include "ADFOctree.h"
+#include <atomic>
+#include <memory>
+#include <ppl.h>
+
+namespace WR
+{
+    // ADF refined where the queries go. The octree is built down to a coarse
+    // level only, the collision object made from it counts the queries reaching
+    // each leaf, and refine_async splits the touched leaves to the full level in
+    // a background task. The refined object then replaces the current one
+    // atomically; queries running meanwhile finish on the one they started with.
+    class ADFLazyCollisionObject :
+        public ICollisionObject
+    {
+    public:
+        // the polyhedron is only needed during the construction
+        ADFLazyCollisionObject(Polyhedron_3_FaceWithId& geom, size_t maxLvl, size_t coarseLvl = 3);
+        ~ADFLazyCollisionObject();
+
+        virtual float query_distance(const Point_3& p) const { return current()->query_distance(p); }
+        virtual float query_squared_distance(const Point_3& p) const { return current()->query_squared_distance(p); }
+        virtual bool exceed_threshhold(const Point_3& p, float thresh = 0.f) const { return current()->exceed_threshhold(p, thresh); }
+        virtual bool position_correlation(const Point_3& p, Point_3* pCorrect, float thresh = 0.f) const { return current()->position_correlation(p, pCorrect, thresh); }
+        virtual void query_batch(CollisionBatch& b) const { current()->query_batch(b); }
+
+        // starts refining the leaves reached by at least minTouches queries since
+        // the last swap, returns false if a refinement is still running
+        bool refine_async(unsigned minTouches = 1);
+        // refines now, e.g. after a warm-up pass of queries over a cache
+        void refine(unsigned minTouches = 1);
+        void wait() { tasks.wait(); }
+
+        size_t n_refined() const { return nRefined; }
+
+    private:
+        std::shared_ptr<const ADFCollisionObject> current() const { return std::atomic_load(&pObject); }
+        void refine_current(unsigned minTouches);
+
+        ADFOctree*                                  pTree = nullptr;    // only used by one refinement at a time
+        std::shared_ptr<const ADFCollisionObject>   pObject;
+        concurrency::task_group                     tasks;
+        std::atomic<bool>                           busy;
+        std::atomic<size_t>                         nRefined;
+    };
+}
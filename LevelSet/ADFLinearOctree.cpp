@@ -0,0 +1,399 @@
+#include "ADFLinearOctree.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include "wrLogger.h"
+
+namespace
+{
+#pragma pack(push, 1)
+    struct OctreeHeader
+    {
+        float   origin[3];
+        float   size[3];
+        int     depth;
+        int     nNode;
+        int     nLeaf;
+    };
+#pragma pack(pop)
+
+    struct LeafRef
+    {
+        unsigned    leaf;
+        int         level;
+        unsigned    cell[3];
+
+        bool operator < (const LeafRef& r) const { return level < r.level; }
+    };
+}
+
+namespace WR
+{
+    ADFLinearOctree::ADFLinearOctree()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            origin[i] = 0.f;
+            size[i] = invSize[i] = 1.f;
+        }
+    }
+
+    float ADFLinearOctree::interpolate(const float* c, const float* f)
+    {
+        float x0 = c[0] + f[0] * (c[1] - c[0]);
+        float x1 = c[2] + f[0] * (c[3] - c[2]);
+        float x2 = c[4] + f[0] * (c[5] - c[4]);
+        float x3 = c[6] + f[0] * (c[7] - c[6]);
+        float y0 = x0 + f[1] * (x1 - x0);
+        float y1 = x2 + f[1] * (x3 - x2);
+        return y0 + f[2] * (y1 - y0);
+    }
+
+    unsigned ADFLinearOctree::find_leaf(const float* u, int& level, unsigned* cell, float cutoff, float* lower) const
+    {
+        const unsigned scale = 1u << maxDepth;
+        unsigned q[3];
+        for (int i = 0; i < 3; i++)
+            q[i] = std::min(unsigned(u[i] * scale), scale - 1);
+
+        unsigned node = 0;
+        level = 0;
+        while (true)
+        {
+            if (lower && bounds[2 * node] > cutoff)
+            {
+                *lower = bounds[2 * node];
+                return NOT_FOUND;
+            }
+            if (nodes[node] & LEAF_FLAG) break;
+
+            unsigned shift = maxDepth - 1 - level;
+            unsigned child = ((q[0] >> shift) & 1) | (((q[1] >> shift) & 1) << 1) | (((q[2] >> shift) & 1) << 2);
+            node = nodes[node] + child;
+            level++;
+        }
+
+        for (int i = 0; i < 3; i++)
+            cell[i] = q[i] >> (maxDepth - level);
+
+        const unsigned leaf = nodes[node] & ~LEAF_FLAG;
+        if (touches) touches[leaf].fetch_add(1, std::memory_order_relaxed);
+        return leaf;
+    }
+
+    void ADFLinearOctree::enable_touch_counts()
+    {
+        touches.reset(new std::atomic<unsigned>[n_leaves()]);
+        for (size_t i = 0; i < n_leaves(); i++)
+            touches[i] = 0;
+    }
+
+    float ADFLinearOctree::clamp_to_box(const float* p, float* u) const
+    {
+        float outside = 0.f;
+        for (int i = 0; i < 3; i++)
+        {
+            float t = (p[i] - origin[i]) * invSize[i];
+            float tc = std::max(0.f, std::min(t, 1.f));
+            outside += (t - tc) * (t - tc) * size[i] * size[i];
+            u[i] = tc;
+        }
+        return outside > 0.f ? std::sqrt(outside) : 0.f;
+    }
+
+    float ADFLinearOctree::query_distance(const float* p, float* grad) const
+    {
+        float u[3];
+        float outside = clamp_to_box(p, u);
+
+        int level;
+        unsigned cell[3];
+        unsigned leaf = find_leaf(u, level, cell);
+        return interpolate_leaf(leaf, u, level, cell, grad) + outside;
+    }
+
+    float ADFLinearOctree::query_distance_bounded(const float* p, float thresh, float* grad) const
+    {
+        float u[3];
+        float outside = clamp_to_box(p, u);
+
+        int level;
+        unsigned cell[3];
+        float lower;
+        unsigned leaf = find_leaf(u, level, cell, thresh - outside, &lower);
+        if (leaf == NOT_FOUND)
+            return lower + outside;
+        return interpolate_leaf(leaf, u, level, cell, grad) + outside;
+    }
+
+    float ADFLinearOctree::interpolate_leaf(unsigned leaf, const float* u, int level, const unsigned* cell, float* grad) const
+    {
+        const float* c = &corners[8 * leaf];
+
+        const float s = float(1u << level);
+        float f[3];
+        for (int i = 0; i < 3; i++)
+            f[i] = u[i] * s - cell[i];
+
+        if (grad)
+        {
+            float dx0 = c[1] - c[0], dx1 = c[3] - c[2], dx2 = c[5] - c[4], dx3 = c[7] - c[6];
+            float x0 = c[0] + f[0] * dx0, x1 = c[2] + f[0] * dx1;
+            float x2 = c[4] + f[0] * dx2, x3 = c[6] + f[0] * dx3;
+            float gx0 = dx0 + f[1] * (dx1 - dx0), gx1 = dx2 + f[1] * (dx3 - dx2);
+            float gy0 = x1 - x0, gy1 = x3 - x2;
+            float y0 = x0 + f[1] * gy0, y1 = x2 + f[1] * gy1;
+            grad[0] = (gx0 + f[2] * (gx1 - gx0)) * s * invSize[0];
+            grad[1] = (gy0 + f[2] * (gy1 - gy0)) * s * invSize[1];
+            grad[2] = (y1 - y0) * s * invSize[2];
+        }
+
+        return interpolate(c, f);
+    }
+
+    void ADFLinearOctree::query_batch(size_t n, const float* const pos[3], float* dist, float* const grad[3]) const
+    {
+        for (size_t i = 0; i < n; i += 4)
+        {
+            const size_t m = std::min<size_t>(4, n - i);
+
+            // gather the leaf corners lane by lane, missing lanes repeat the last point
+            float c[8][4], f[3][4], s[4], outside[4];
+            for (size_t j = 0; j < 4; j++)
+            {
+                const size_t idx = i + std::min(j, m - 1);
+                float u[3];
+                outside[j] = 0.f;
+                for (int k = 0; k < 3; k++)
+                {
+                    float t = (pos[k][idx] - origin[k]) * invSize[k];
+                    float tc = std::max(0.f, std::min(t, 1.f));
+                    outside[j] += (t - tc) * (t - tc) * size[k] * size[k];
+                    u[k] = tc;
+                }
+
+                int level;
+                unsigned cell[3];
+                const float* corner = &corners[8 * find_leaf(u, level, cell)];
+                for (int k = 0; k < 8; k++)
+                    c[k][j] = corner[k];
+
+                s[j] = float(1u << level);
+                for (int k = 0; k < 3; k++)
+                    f[k][j] = u[k] * s[j] - cell[k];
+            }
+
+            __m128 c0 = _mm_loadu_ps(c[0]), c1 = _mm_loadu_ps(c[1]), c2 = _mm_loadu_ps(c[2]), c3 = _mm_loadu_ps(c[3]);
+            __m128 c4 = _mm_loadu_ps(c[4]), c5 = _mm_loadu_ps(c[5]), c6 = _mm_loadu_ps(c[6]), c7 = _mm_loadu_ps(c[7]);
+            __m128 fx = _mm_loadu_ps(f[0]), fy = _mm_loadu_ps(f[1]), fz = _mm_loadu_ps(f[2]);
+
+            __m128 dx0 = _mm_sub_ps(c1, c0), dx1 = _mm_sub_ps(c3, c2);
+            __m128 dx2 = _mm_sub_ps(c5, c4), dx3 = _mm_sub_ps(c7, c6);
+            __m128 x0 = _mm_add_ps(c0, _mm_mul_ps(fx, dx0)), x1 = _mm_add_ps(c2, _mm_mul_ps(fx, dx1));
+            __m128 x2 = _mm_add_ps(c4, _mm_mul_ps(fx, dx2)), x3 = _mm_add_ps(c6, _mm_mul_ps(fx, dx3));
+            __m128 gy0 = _mm_sub_ps(x1, x0), gy1 = _mm_sub_ps(x3, x2);
+            __m128 y0 = _mm_add_ps(x0, _mm_mul_ps(fy, gy0)), y1 = _mm_add_ps(x2, _mm_mul_ps(fy, gy1));
+            __m128 d = _mm_add_ps(y0, _mm_mul_ps(fz, _mm_sub_ps(y1, y0)));
+            d = _mm_add_ps(d, _mm_sqrt_ps(_mm_loadu_ps(outside)));
+
+            float out[4];
+            _mm_storeu_ps(out, d);
+            std::copy(out, out + m, dist + i);
+
+            if (grad)
+            {
+                __m128 sc = _mm_loadu_ps(s);
+                __m128 gx0 = _mm_add_ps(dx0, _mm_mul_ps(fy, _mm_sub_ps(dx1, dx0)));
+                __m128 gx1 = _mm_add_ps(dx2, _mm_mul_ps(fy, _mm_sub_ps(dx3, dx2)));
+                __m128 g[3];
+                g[0] = _mm_add_ps(gx0, _mm_mul_ps(fz, _mm_sub_ps(gx1, gx0)));
+                g[1] = _mm_add_ps(gy0, _mm_mul_ps(fz, _mm_sub_ps(gy1, gy0)));
+                g[2] = _mm_sub_ps(y1, y0);
+                for (int k = 0; k < 3; k++)
+                {
+                    _mm_storeu_ps(out, _mm_mul_ps(g[k], _mm_mul_ps(sc, _mm_set1_ps(invSize[k]))));
+                    std::copy(out, out + m, grad[k] + i);
+                }
+            }
+        }
+    }
+
+    void ADFLinearOctree::constrain_hanging_nodes()
+    {
+        std::vector<LeafRef> leaves;
+        leaves.reserve(n_leaves());
+
+        // depth first walk to recover the level and cell of every leaf
+        std::vector<LeafRef> stack(1);
+        stack[0].leaf = 0;
+        stack[0].level = 0;
+        stack[0].cell[0] = stack[0].cell[1] = stack[0].cell[2] = 0;
+        while (!stack.empty())
+        {
+            LeafRef r = stack.back();
+            stack.pop_back();
+
+            unsigned word = nodes[r.leaf];
+            if (word & LEAF_FLAG)
+            {
+                r.leaf = word & ~LEAF_FLAG;
+                leaves.push_back(r);
+                continue;
+            }
+            for (unsigned k = 0; k < 8; k++)
+            {
+                LeafRef c;
+                c.leaf = word + k;
+                c.level = r.level + 1;
+                for (int i = 0; i < 3; i++)
+                    c.cell[i] = r.cell[i] * 2 + ((k >> i) & 1);
+                stack.push_back(c);
+            }
+        }
+
+        // coarse leaves first, so that a constrained corner only ever reads
+        // from a leaf whose own corners are already final
+        std::stable_sort(leaves.begin(), leaves.end());
+
+        const float eps = 0.25f / float(1u << maxDepth);
+        size_t nHanging = 0;
+        for (auto& l : leaves)
+        {
+            if (l.level == 0) continue;
+
+            const float s = float(1u << l.level);
+            for (unsigned k = 0; k < 8; k++)
+            {
+                float c[3];
+                for (int i = 0; i < 3; i++)
+                    c[i] = (l.cell[i] + ((k >> i) & 1)) / s;
+
+                // the coarsest leaf among the ones around the corner decides its value
+                int coarseLevel = l.level;
+                unsigned coarseLeaf = 0, coarseCell[3];
+                for (unsigned probe = 0; probe < 8; probe++)
+                {
+                    float u[3];
+                    bool inside = true;
+                    for (int i = 0; i < 3; i++)
+                    {
+                        u[i] = c[i] + (((probe >> i) & 1) ? eps : -eps);
+                        inside &= u[i] > 0.f && u[i] < 1.f;
+                    }
+                    if (!inside) continue;
+
+                    int level;
+                    unsigned cell[3];
+                    unsigned leaf = find_leaf(u, level, cell);
+                    if (level < coarseLevel)
+                    {
+                        coarseLevel = level;
+                        coarseLeaf = leaf;
+                        memcpy(coarseCell, cell, sizeof(cell));
+                    }
+                }
+                if (coarseLevel == l.level) continue;
+
+                const float cs = float(1u << coarseLevel);
+                float f[3];
+                for (int i = 0; i < 3; i++)
+                    f[i] = c[i] * cs - coarseCell[i];
+                corners[8 * l.leaf + k] = interpolate(&corners[8 * coarseLeaf], f);
+                nHanging++;
+            }
+        }
+
+        compute_bounds();
+
+        WR_LOG_INFO << "linear octree: " << n_nodes() << " nodes, " << n_leaves()
+            << " leaves, depth " << maxDepth << ", " << nHanging << " hanging corners";
+    }
+
+    void ADFLinearOctree::compute_bounds()
+    {
+        // children always come after their parent, a reverse sweep is bottom up
+        bounds.resize(2 * nodes.size());
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            unsigned word = nodes[i];
+            float lo, hi;
+            if (word & LEAF_FLAG)
+            {
+                const float* c = &corners[8 * (word & ~LEAF_FLAG)];
+                lo = *std::min_element(c, c + 8);
+                hi = *std::max_element(c, c + 8);
+            }
+            else
+            {
+                const float* b = &bounds[2 * word];
+                lo = b[0];
+                hi = b[1];
+                for (size_t k = 1; k < 8; k++)
+                {
+                    lo = std::min(lo, b[2 * k]);
+                    hi = std::max(hi, b[2 * k + 1]);
+                }
+            }
+            bounds[2 * i] = lo;
+            bounds[2 * i + 1] = hi;
+        }
+    }
+
+    bool ADFLinearOctree::save(std::ostream& os) const
+    {
+        OctreeHeader header;
+        for (int i = 0; i < 3; i++)
+        {
+            header.origin[i] = origin[i];
+            header.size[i] = size[i];
+        }
+        header.depth = maxDepth;
+        header.nNode = int(nodes.size());
+        header.nLeaf = int(n_leaves());
+
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char*>(nodes.data()), sizeof(unsigned) * nodes.size());
+        os.write(reinterpret_cast<const char*>(corners.data()), sizeof(float) * corners.size());
+        return os.good();
+    }
+
+    size_t ADFLinearOctree::load(const char* data, size_t size)
+    {
+        OctreeHeader header;
+        if (size < sizeof(header))
+            return 0;
+        memcpy(&header, data, sizeof(header));
+
+        const size_t nNode = header.nNode, nLeaf = header.nLeaf;
+        const size_t total = sizeof(header) + nNode * sizeof(unsigned) + nLeaf * 8 * sizeof(float);
+        if (header.depth < 0 || header.depth > 20 || !nNode || size < total)
+            return 0;
+
+        maxDepth = header.depth;
+        for (int i = 0; i < 3; i++)
+        {
+            origin[i] = header.origin[i];
+            this->size[i] = header.size[i];
+            invSize[i] = 1.f / header.size[i];
+        }
+
+        const unsigned* pn = reinterpret_cast<const unsigned*>(data + sizeof(header));
+        nodes.assign(pn, pn + nNode);
+        const float* pc = reinterpret_cast<const float*>(pn + nNode);
+        corners.assign(pc, pc + nLeaf * 8);
+
+        for (auto word : nodes)
+        {
+            if ((word & LEAF_FLAG) ? (word & ~LEAF_FLAG) >= nLeaf : word + 8 > nNode)
+            {
+                WR_LOG_ERROR << "corrupted octree node " << word;
+                nodes.clear();
+                corners.clear();
+                return 0;
+            }
+        }
+        compute_bounds();
+        return total;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace WR
+{
+    // Pointerless copy of the adaptive ADFOctree for queries. Nodes are stored
+    // breadth first, the 8 children of a node are contiguous and in Morton order
+    // (x | y << 1 | z << 2), so a query descends by the bits of the quantized
+    // point in O(depth). Each node is one word: the index of its first child,
+    // or LEAF_FLAG | the index of its 8 corner distances.
+    //
+    // Corner values on a face or edge of a coarser neighbour leaf (hanging nodes)
+    // are replaced by the coarse interpolation, which keeps the trilinear field
+    // continuous across level changes.
+    //
+    // Every node also keeps the minimum and maximum corner value below it. The
+    // trilinear field never leaves those bounds, so a descent can stop at the
+    // first node that is entirely farther than a threshold.
+    class ADFLinearOctree
+    {
+        friend class ADFOctree;
+
+    public:
+        static const unsigned LEAF_FLAG = 0x80000000u;
+        static const unsigned NOT_FOUND = 0xffffffffu;
+
+        ADFLinearOctree();
+
+        // signed distance and optionally its gradient at p, points outside
+        // the root box get their distance to the box added
+        float query_distance(const float* p, float* grad = nullptr) const;
+        // n points in SoA layout, grad may be null. Descents are scalar, the
+        // interpolation runs four points at a time
+        void query_batch(size_t n, const float* const pos[3], float* dist, float* const grad[3]) const;
+        // the exact distance where it is not above thresh, otherwise possibly only
+        // a lower bound above thresh (and grad is left untouched)
+        float query_distance_bounded(const float* p, float thresh, float* grad = nullptr) const;
+
+        // counts from now on the queries reaching each leaf, for refinement on
+        // demand. Off by default, the counters are atomic
+        void enable_touch_counts();
+        unsigned touch_count(unsigned leaf) const { return touches ? unsigned(touches[leaf]) : 0u; }
+
+        size_t n_nodes() const { return nodes.size(); }
+        size_t n_leaves() const { return corners.size() / 8; }
+        int depth() const { return maxDepth; }
+
+        bool save(std::ostream& os) const;
+        // returns the bytes consumed, 0 on a corrupted or truncated block
+        size_t load(const char* data, size_t size);
+
+    private:
+        // with lower given, stops at a node whose minimum is above cutoff and
+        // returns NOT_FOUND, with that minimum in lower
+        unsigned find_leaf(const float* u, int& level, unsigned* cell,
+            float cutoff = 3.4e38f, float* lower = nullptr) const;
+        float clamp_to_box(const float* p, float* u) const;
+        float interpolate_leaf(unsigned leaf, const float* u, int level, const unsigned* cell, float* grad) const;
+        void constrain_hanging_nodes();
+        void compute_bounds();
+
+        static float interpolate(const float* c, const float* f);
+
+        float                   origin[3];
+        float                   size[3];
+        float                   invSize[3];
+        int                     maxDepth = 0;
+
+        std::vector<unsigned>   nodes;
+        std::vector<float>      corners;    // 8 per leaf, Morton order
+        std::vector<float>      bounds;     // min, max per node
+
+        std::unique_ptr<std::atomic<unsigned>[]>    touches;    // per leaf, null when not counting
+    };
+}
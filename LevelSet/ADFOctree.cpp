@@ -4,41 +4,44 @@
 #include "wrGeo.h"
 #include "linmath.h"
 #include "ADFCollisionObject.h"
+#include "ADFLinearOctree.h"
 #include <CGAL\bounding_box.h>
+#include <algorithm>
+#include <array>
+#include <ppl.h>
 
 namespace
 {
-    const unsigned EIDX[12][3] = {
-        { 0, 1, 2 }, { 1, 2, 2 }, { 2, 1, 2 }, { 1, 0, 2 },
-        { 0, 0, 1 }, { 0, 2, 1 }, { 2, 2, 1 }, { 2, 0, 1 },
-        { 0, 1, 0 }, { 1, 2, 0 }, { 2, 1, 0 }, { 1, 0, 0 }
-    };
-
-    const unsigned FIDX[6][3] = {
-        { 1, 1, 2 }, { 0, 1, 1 }, { 1, 2, 1 },
-        { 2, 1, 1 }, { 1, 0, 1 }, { 1, 1, 0 }
-    };
-
-    const unsigned BIDX[8][2] = {
-        { 12, 20 }, { 21, 9 }, { 26, 2 }, { 24, 10 },
-        { 4, 26 }, { 16, 22 }, { 25, 14 }, { 19, 23 }
-    };
-
-    const unsigned CIDX[8][8] = {
-        { 0, 8, 20, 11, 12, 21, 26, 24 },
-        { 8, 1, 9, 20, 21, 13, 22, 26 },
-        { 20, 9, 2, 10, 26, 22, 14, 23 },
-        { 11, 20, 10, 3, 24, 26, 23, 15 },
-        { 12, 21, 26, 24, 4, 16, 25, 19 },
-        { 21, 13, 22, 26, 16, 5, 17, 25 },
-        { 26, 22, 14, 23, 25, 17, 6, 18 },
-        { 24, 26, 23, 15, 19, 25, 18, 7 }
-    };
+#define PARALLEL_LEVEL 3
+#define MAX_GRID_LEVEL 20
+// adaptive builds split cells crossing the surface down to this level anyway,
+// so that thin features between the lattice points are not missed
+#define MIN_ADAPTIVE_LEVEL 3
+// tolerance factor at the surface, growing linearly to 1 at box_enlarge_size
+#define NARROW_BAND_SCALE 0.1f
+
+    // spreads the low 21 bits of v to every third bit
+    unsigned long long spread_bits(unsigned v)
+    {
+        unsigned long long x = v & 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffull;
+        x = (x | x << 16) & 0x1f0000ff0000ffull;
+        x = (x | x << 8) & 0x100f00f00f00f00full;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+        x = (x | x << 2) & 0x1249249249249249ull;
+        return x;
+    }
+
+    unsigned long long morton_key(const unsigned* g)
+    {
+        return spread_bits(g[0]) | spread_bits(g[1]) << 1 | spread_bits(g[2]) << 2;
+    }
 }
 
 namespace WR
 {
     float ADFOctree::m_box_enlarge_size = 0.1f;
+    float ADFOctree::m_error_tolerance = 0.f;
 
     ADFOctree::ADFOctree()
     {
@@ -52,24 +55,85 @@ namespace WR
 
     ADFCollisionObject* ADFOctree::releaseAndCreateCollisionObject()
     {
-        ADFCollisionObject* pCO = new ADFCollisionObject(dt, box, nMaxLevel, m_box_enlarge_size);
+        ADFCollisionObject* pCO = new ADFCollisionObject(dt, box, nMaxLevel, m_box_enlarge_size, createLinearOctree());
         releaseExceptDt();
         dt = nullptr;
         return pCO;
     }
 
+    ADFCollisionObject* ADFOctree::createCollisionObject(bool countTouches) const
+    {
+        ADFLinearOctree* pOctree = createLinearOctree();
+        if (countTouches)
+            pOctree->enable_touch_counts();
+        return new ADFCollisionObject(nullptr, box, nMaxLevel, m_box_enlarge_size, pOctree);
+    }
+
+    ADFLinearOctree* ADFOctree::createLinearOctree() const
+    {
+        assert(pRoot);
+        ADFLinearOctree* pOctree = new ADFLinearOctree;
+        for (int i = 0; i < 3; i++)
+        {
+            pOctree->origin[i] = pRoot->bbox.min()[i];
+            pOctree->size[i] = pRoot->bbox.max()[i] - pRoot->bbox.min()[i];
+            pOctree->invSize[i] = 1.f / pOctree->size[i];
+        }
+
+        // breadth first, the children of a node are appended together and
+        // are already in Morton order
+        std::vector<const Node*> queue(1, pRoot);
+        pOctree->nodes.reserve(cellList.size());
+        for (size_t i = 0; i < queue.size(); i++)
+        {
+            const Node* node = queue[i];
+            pOctree->maxDepth = std::max(pOctree->maxDepth, int(node->level));
+
+            if (!node->children[0])
+            {
+                pOctree->nodes.push_back(ADFLinearOctree::LEAF_FLAG | unsigned(pOctree->n_leaves()));
+                for (size_t k = 0; k < 8; k++)
+                    pOctree->corners.push_back(cornerDists[node->corners[k]]);
+                continue;
+            }
+
+            pOctree->nodes.push_back(unsigned(queue.size()));
+            queue.insert(queue.end(), node->children, node->children + 8);
+        }
+
+        pOctree->constrain_hanging_nodes();
+        return pOctree;
+    }
+
+    bool ADFOctree::construct(Polyhedron_3& geom, size_t maxLvl, bool withTriangulation)
+    {
+        if (!constructCoarse(geom, maxLvl, maxLvl))
+            return false;
+
+        if (withTriangulation)
+            createTriangulation();
+
+        WR_LOG_INFO << "constructed: depth, " << maxLvl << ", " << cellList.size()
+            << " nodes, " << cornerPoints.size() << " corners";
+        return true;
+    }
 
-    bool ADFOctree::construct(Polyhedron_3& geom, size_t maxLvl)
+    bool ADFOctree::constructCoarse(Polyhedron_3& geom, size_t coarseLvl, size_t maxLvl)
     {
         release();
+        if (maxLvl > MAX_GRID_LEVEL)
+        {
+            WR_LOG_ERROR << "ADF level " << maxLvl << " exceeds " << MAX_GRID_LEVEL;
+            return false;
+        }
         nMaxLevel = maxLvl;
-        dt = new Dt;
 
         WR_LOG_INFO << "constructing...";
 
         // contruct all the triangles
         nTriangles = geom.size_of_facets();
         triList = new Triangle_3[nTriangles];
+        triBoxes = new CGAL::Bbox_3[nTriangles];
 
         size_t count = 0;
         for (auto tItr = geom.facets_begin(); tItr != geom.facets_end(); tItr++, count++)
@@ -86,84 +150,353 @@ namespace WR
             triList[count].fh = tItr;
             tItr->idx = count;
             triList[count].initInfo();
+            triBoxes[count] = triList[count].bbox();
         }
+        computePseudoNormals();
+        bvh.build(triList, nTriangles);
+        leafBlocks.resize(bvh.n_slots() / bvh.LEAF_SIZE);
+        for (size_t i = 0; i < leafBlocks.size(); i++)
+            WRG::pack_triangles(triList, bvh.indices() + i * bvh.LEAF_SIZE, bvh.LEAF_SIZE, leafBlocks[i]);
 
         pRoot = createRootNode(geom);
+        if (std::min(coarseLvl, nMaxLevel) > 0)
+            constructChildren(pRoot, std::min(coarseLvl, nMaxLevel));
 
-        constructChildren(pRoot);
-        WR_LOG_INFO << "constructed: depth, " << maxLvl;
+        collectNodes();
+        computeCorners();
+        if (m_error_tolerance > 0.f)
+            measureError();
         return true;
     }
 
-    void ADFOctree::constructChildren(Node* root)
+    size_t ADFOctree::refine(const std::vector<unsigned>& leaves)
     {
+        // only leaves are split, so no node of the batch is inside another's
+        // subtree. The linear octree numbers the leaves breadth first, as
+        // cellList has them
+        std::vector<Node*> leafList;
+        for (size_t i = 0; i < cellList.size(); i++)
+        {
+            if (!cellList[i]->children[0])
+                leafList.push_back(cellList[i]);
+        }
 
-        //   /----0----/            •-----y
-        //  3|        1|            |
-        // /----2----/ |            |
-        // | 4       | 5            x
-        // | |       | |              1
-        // 7 /----8--6-/          4  0(5)  2  
-        // |11       |9               3
-        // /----10---/
+        std::vector<Node*> split;
+        for (size_t i = 0; i < leaves.size(); i++)
+        {
+            if (leaves[i] >= leafList.size()) continue;
 
-        // 顶点0-7，边中点8-19，面心20-25，体心26
-        // 子节点方位标记和顶点方位标记同
-        DtVh v[27];
-        for (size_t i = 0; i < 8; i++)
-            v[i] = root->vertices[i];
+            Node* leaf = leafList[leaves[i]];
+            for (int k = 0; k < 27; k++)
+            {
+                const int cell[3] = { int(leaf->cell[0]) + k % 3 - 1, int(leaf->cell[1]) + k / 3 % 3 - 1, int(leaf->cell[2]) + k / 9 - 1 };
+                Node* node = findLeaf(leaf->level, cell);
+                if (node && isRefinable(node))
+                    split.push_back(node);
+            }
+        }
+        std::sort(split.begin(), split.end());
+        split.erase(std::unique(split.begin(), split.end()), split.end());
+        if (split.empty())
+            return 0;
 
-        vec3 coords[3];
+        concurrency::parallel_for(size_t(0), split.size(), [this, &split](size_t i)
+        {
+            split[i]->bRefined = true;
+            constructChildren(split[i], nMaxLevel);
+        });
+        collectNodes();
+        computeCorners();
+        if (m_error_tolerance > 0.f)
+            measureError();
+
+        WR_LOG_INFO << "refined " << split.size() << " leaves: " << cellList.size()
+            << " nodes, " << cornerPoints.size() << " corners";
+        return split.size();
+    }
 
-        coords[0][0] = root->bbox.xmin();
-        coords[0][1] = (root->bbox.xmin() + root->bbox.xmax()) / 2.0f;
-        coords[0][2] = root->bbox.xmax();
+    ADFOctree::Node* ADFOctree::findLeaf(size_t level, const int* cell) const
+    {
+        const int n = 1 << level;
+        for (int a = 0; a < 3; a++)
+        {
+            if (cell[a] < 0 || cell[a] >= n)
+                return nullptr;
+        }
 
-        coords[1][0] = root->bbox.ymin();
-        coords[1][1] = (root->bbox.ymin() + root->bbox.ymax()) / 2.0f;
-        coords[1][2] = root->bbox.ymax();
+        Node* node = pRoot;
+        while (node->children[0] && node->level < level)
+        {
+            const size_t shift = level - node->level - 1;
+            unsigned child = 0;
+            for (int a = 0; a < 3; a++)
+                child |= ((cell[a] >> shift) & 1) << a;
+            node = node->children[child];
+        }
+        return node;
+    }
 
-        coords[2][0] = root->bbox.zmin();
-        coords[2][1] = (root->bbox.zmin() + root->bbox.zmax()) / 2.0f;
-        coords[2][2] = root->bbox.zmax();
+    bool ADFOctree::isRefinable(const Node* node) const
+    {
+        if (node->children[0] || node->eList.empty() || node->level >= nMaxLevel)
+            return false;
+        for (const Node* n = node; n; n = n->pParent)
+        {
+            if (n->bRefined)
+                return false;
+        }
+        return true;
+    }
 
-        const unsigned OE = 8;
-        for (size_t i = 0; i < 12; i++)
-            v[i + OE] = dt->insert(Point_3(coords[0][EIDX[i][0]], coords[1][EIDX[i][1]], coords[2][EIDX[i][2]]), root->vertices[0]);
+    void ADFOctree::computeLattice(const Node* node, const float* corners, float* lattice) const
+    {
+        const Point_3& lo = node->bbox.min();
+        const Vector_3 ext = node->bbox.max() - lo;
+        for (unsigned i = 0; i < 27; i++)
+        {
+            const unsigned x = i % 3, y = i / 3 % 3, z = i / 9;
+            if (corners && x != 1 && y != 1 && z != 1)
+            {
+                lattice[i] = corners[x / 2 | (y / 2) << 1 | (z / 2) << 2];
+                continue;
+            }
+            Point_3 p(lo.x() + ext.x() * (0.5f * x), lo.y() + ext.y() * (0.5f * y), lo.z() + ext.z() * (0.5f * z));
+            lattice[i] = computeMinDistance(p, node);
+        }
+    }
 
-        const unsigned OF = 20;
-        for (size_t i = 0; i < 6; i++)
-            v[i + OF] = dt->insert(Point_3(coords[0][FIDX[i][0]], coords[1][FIDX[i][1]], coords[2][FIDX[i][2]]), root->vertices[0]);
+    bool ADFOctree::needsSubdivide(Node* node, const float* lattice) const
+    {
+        for (unsigned k = 0; k < 8; k++)
+            node->exact[k] = lattice[(k & 1) * 2 + (k >> 1 & 1) * 6 + (k >> 2) * 18];
+        node->hasExact = true;
+
+        // no point of the cell is nearer to the surface than lower
+        const float halfDiag = 0.5f * sqrt((node->bbox.max() - node->bbox.min()).squared_length());
+        const float lower = std::max(0.f, std::abs(lattice[13]) - halfDiag);
+        if (lower > m_box_enlarge_size)
+            return false;
+
+        float maxError = 0.f, sqError = 0.f;
+        for (unsigned i = 0; i < 27; i++)
+        {
+            const unsigned x = i % 3, y = i / 3 % 3, z = i / 9;
+            if (x != 1 && y != 1 && z != 1) continue;
 
-        v[26] = dt->insert(Point_3(coords[0][1], coords[1][1], coords[2][1]), root->vertices[0]);
+            const float f[3] = { 0.5f * x, 0.5f * y, 0.5f * z };
+            float v = 0.f;
+            for (unsigned k = 0; k < 8; k++)
+            {
+                float w = 1.f;
+                for (int a = 0; a < 3; a++)
+                    w *= (k >> a & 1) ? f[a] : 1.f - f[a];
+                v += w * node->exact[k];
+            }
+            const float e = std::abs(v - lattice[i]);
+            maxError = std::max(maxError, e);
+            sqError += e * e;
+        }
+        node->maxError = maxError;
+        node->sqError = sqError;
 
-        // deploy chidren
-        for (size_t i = 0; i < 8; i++)
+        const float scale = std::max(NARROW_BAND_SCALE, std::min(1.f, lower / m_box_enlarge_size));
+        return maxError > m_error_tolerance * scale;
+    }
+
+    void ADFOctree::measureError()
+    {
+        float maxError = 0.f;
+        double sqError = 0.0;
+        size_t n = 0;
+        for (size_t i = 0; i < cellList.size(); i++)
+        {
+            const Node* node = cellList[i];
+            if (node->children[0] || node->maxError < 0.f) continue;
+
+            maxError = std::max(maxError, node->maxError);
+            sqError += node->sqError;
+            n += 19;
+        }
+        errorMax = maxError;
+        errorRms = n ? float(sqrt(sqError / n)) : 0.f;
+
+        WR_LOG_INFO << "interpolation error in the band: max " << errorMax << ", rms " << errorRms
+            << " over " << n << " samples";
+    }
+
+    void ADFOctree::constructChildren(Node* root, size_t stopLevel, const float* lattice)
+    {
+        const bool adaptive = m_error_tolerance > 0.f;
+        float rootLattice[27];
+        if (adaptive && !lattice)
+        {
+            computeLattice(root, root->hasExact ? root->exact : nullptr, rootLattice);
+            lattice = rootLattice;
+        }
+
+        concurrency::task_group tasks;
+        for (unsigned i = 0; i < 8; i++)
         {
             Node* child = createNode();
             child->level = root->level + 1;
             child->pParent = root;
 
-            for (size_t j = 0; j < 8; j++)
-                child->vertices[j] = v[CIDX[i][j]];
-
-            child->bbox = Cube_3(v[BIDX[i][0]]->point(), v[BIDX[i][1]]->point());
+            unsigned lo[3], hi[3];
+            const unsigned shift = unsigned(nMaxLevel - child->level);
+            for (int k = 0; k < 3; k++)
+            {
+                child->cell[k] = root->cell[k] * 2 + ((i >> k) & 1);
+                lo[k] = child->cell[k] << shift;
+                hi[k] = (child->cell[k] + 1) << shift;
+            }
+            child->bbox = Cube_3(gridPoint(lo), gridPoint(hi));
             computeTripleFromBbox(child->triple, child->bbox);
 
+            // the box test rejects most of the parent's triangles before the exact one
+            const CGAL::Bbox_3 tb = child->triple.bbox();
             for (auto eItr = root->eList.begin(); eItr != root->eList.end(); eItr++)
             {
-                if (CGAL::do_intersect(triList[*eItr], child->triple.bbox()))
+                if (CGAL::do_overlap(triBoxes[*eItr], tb) && CGAL::do_intersect(triList[*eItr], tb))
                     child->eList.push_back(*eItr);
             }
+            root->children[i] = child;
+
+            if (!adaptive)
+            {
+                // if has elements and not max level, split
+                if (!child->eList.empty() && child->level < stopLevel)
+                {
+                    if (child->level <= PARALLEL_LEVEL)
+                        tasks.run([this, child, stopLevel]{ constructChildren(child, stopLevel); });
+                    else constructChildren(child, stopLevel);
+                }
+                continue;
+            }
 
-            // if has elements and not max level, split
-            if (!child->eList.empty() && child->level < nMaxLevel)
-                constructChildren(child);
-            else computeMinDistance(child);
+            // the corners of the child are points of the parent lattice
+            float corners[8];
+            for (unsigned k = 0; k < 8; k++)
+            {
+                unsigned idx = 0;
+                for (int a = 0, stride = 1; a < 3; a++, stride *= 3)
+                    idx += (((i >> a) & 1) + ((k >> a) & 1)) * stride;
+                corners[k] = lattice[idx];
+            }
+            std::array<float, 27> sub;
+            computeLattice(child, corners, sub.data());
 
-            root->children[i] = child;
+            bool split = needsSubdivide(child, sub.data()) || (child->level < MIN_ADAPTIVE_LEVEL && !child->eList.empty());
+            if (split && child->level < stopLevel)
+            {
+                if (child->level <= PARALLEL_LEVEL)
+                    tasks.run([this, child, stopLevel, sub]{ constructChildren(child, stopLevel, sub.data()); });
+                else constructChildren(child, stopLevel, sub.data());
+            }
+        }
+        tasks.wait();
+    }
+
+    void ADFOctree::collectNodes()
+    {
+        cellList.assign(1, pRoot);
+        for (size_t i = 0; i < cellList.size(); i++)
+        {
+            if (cellList[i]->children[0])
+                cellList.insert(cellList.end(), cellList[i]->children, cellList[i]->children + 8);
+        }
+    }
+
+    void ADFOctree::computeCorners()
+    {
+        // every leaf corner keyed by its position on the finest grid; sorting puts
+        // the copies shared by neighbour leaves next to each other, in Morton order
+        std::vector<std::pair<unsigned long long, unsigned>> keys;
+        std::vector<Node*> leaves;
+        for (size_t i = 0; i < cellList.size(); i++)
+        {
+            Node* node = cellList[i];
+            if (node->children[0]) continue;
+
+            const unsigned shift = unsigned(nMaxLevel - node->level);
+            for (unsigned k = 0; k < 8; k++)
+            {
+                unsigned g[3];
+                for (int a = 0; a < 3; a++)
+                    g[a] = (node->cell[a] + ((k >> a) & 1)) << shift;
+                keys.push_back(std::make_pair(morton_key(g), unsigned(leaves.size() * 8 + k)));
+            }
+            leaves.push_back(node);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<unsigned long long> oldKeys;
+        std::vector<float> oldDists;
+        oldKeys.swap(cornerKeys);
+        oldDists.swap(cornerDists);
+
+        std::vector<const Node*> cornerLeaf;
+        std::vector<unsigned> cornerSlot;
+        cornerPoints.clear();
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            Node* leaf = leaves[keys[i].second / 8];
+            const unsigned k = keys[i].second % 8;
+            if (i == 0 || keys[i].first != keys[i - 1].first)
+            {
+                const unsigned shift = unsigned(nMaxLevel - leaf->level);
+                unsigned g[3];
+                for (int a = 0; a < 3; a++)
+                    g[a] = (leaf->cell[a] + ((k >> a) & 1)) << shift;
+                cornerPoints.push_back(gridPoint(g));
+                cornerKeys.push_back(keys[i].first);
+                cornerLeaf.push_back(leaf);
+                cornerSlot.push_back(k);
+            }
+            leaf->corners[k] = unsigned(cornerPoints.size() - 1);
+        }
+
+        // both key lists are sorted, corners of a previous call keep their
+        // distance, and so do those an adaptive build already computed
+        cornerDists.resize(cornerPoints.size());
+        std::vector<size_t> missing;
+        for (size_t i = 0, j = 0; i < cornerKeys.size(); i++)
+        {
+            while (j < oldKeys.size() && oldKeys[j] < cornerKeys[i]) j++;
+            if (j < oldKeys.size() && oldKeys[j] == cornerKeys[i])
+                cornerDists[i] = oldDists[j];
+            else if (cornerLeaf[i]->hasExact)
+                cornerDists[i] = cornerLeaf[i]->exact[cornerSlot[i]];
+            else missing.push_back(i);
         }
 
+        // any leaf holding a corner gives the same exact distance
+        concurrency::parallel_for(size_t(0), missing.size(), [this, &cornerLeaf, &missing](size_t i)
+        {
+            cornerDists[missing[i]] = computeMinDistance(cornerPoints[missing[i]], cornerLeaf[missing[i]]);
+        });
+    }
+
+    void ADFOctree::createTriangulation()
+    {
+        // one bulk insertion, CGAL sorts the points spatially before inserting
+        std::vector<std::pair<Point_3, ADF::VInfo>> pts(cornerPoints.size());
+        for (size_t i = 0; i < pts.size(); i++)
+        {
+            pts[i].first = cornerPoints[i];
+            pts[i].second.minDist = cornerDists[i];
+        }
+
+        dt = new Dt;
+        dt->insert(pts.begin(), pts.end());
+    }
+
+    ADFOctree::Point_3 ADFOctree::gridPoint(const unsigned* g) const
+    {
+        const float scale = 1.f / float(1u << nMaxLevel);
+        const Cube_3& bbox = pRoot->bbox;
+        return Point_3(bbox.xmin() + (bbox.xmax() - bbox.xmin()) * (g[0] * scale),
+            bbox.ymin() + (bbox.ymax() - bbox.ymin()) * (g[1] * scale),
+            bbox.zmin() + (bbox.zmax() - bbox.zmin()) * (g[2] * scale));
     }
 
     void ADFOctree::release()
@@ -183,60 +516,56 @@ namespace WR
             delete cellList[i];
 
         SAFE_DELETE_ARRAY(triList);
+        SAFE_DELETE_ARRAY(triBoxes);
+        SAFE_DELETE_ARRAY(edgeNormals);
+        SAFE_DELETE_ARRAY(vertexNormals);
+        leafBlocks.clear();
         nTriangles = 0;
 
         pRoot = nullptr;
         nMaxLevel = 0;
         cellList.clear();
+        cornerPoints.clear();
+        cornerDists.clear();
+        cornerKeys.clear();
     }
 
     float ADFOctree::query_distance(const Point_3& p) const
+    {
+        return computeMinDistance(p, nullptr);
+    }
+
+    float ADFOctree::computeMinDistance(const Point_3& p, const Node* leaf) const
     {
         int type = -1;
         size_t triIdx = 0;
         Vector_3 diff;
 
-        float sd = minSquaredDist(p, pRoot->eList.cbegin(), pRoot->eList.cend(), &diff, &triIdx, &type);
-        int sign = determineSign(type, p, diff, triIdx);
-
-        return sign * sqrt(sd);
+        float sd = nearestTriangle(p, leaf, &diff, &triIdx, &type);
+        return sqrt(sd) * determineSign(type, p, diff, triIdx);
     }
 
-
-    void ADFOctree::computeMinDistance(Node* node)
+    float ADFOctree::nearestTriangle(const Point_3& p, const Node* hint, Vector_3* diff, size_t* tri, int* type) const
     {
-        static int count = 0;
-        for (size_t i = 0; i < 8; i++)
+        size_t best = bvh.NOT_FOUND;
+        float bestSq = std::numeric_limits<float>::max();
+        // a few triangles near the hint only seed the bound, internal nodes
+        // list far more than a leaf block
+        if (hint && !hint->eList.empty())
         {
-            auto& vh = node->vertices[i];
-            auto& dist = vh->info().minDist;
-            if (dist < 1.0e8) continue;
-
-            int type = -1;
-            size_t triIdx = 0;
-            Node* curNode = node;
-            Vector_3 diff;
-            float tmpSquaredDist, distLimit;
+            const size_t nSeed = std::min<size_t>(hint->eList.size(), bvh.LEAF_SIZE);
+            bestSq = minSquaredDist(p, hint->eList.cbegin(), hint->eList.cbegin() + nSeed, nullptr, &best);
+        }
 
-            while (true)
-            {
-                if (!curNode->eList.empty())
-                {
-                    tmpSquaredDist = minSquaredDist(vh->point(), curNode->eList.cbegin(), curNode->eList.cend(), &diff, &triIdx, &type);
-                    distLimit = minDist(curNode->triple, vh->point());
-
-                    if (tmpSquaredDist < distLimit * distLimit || !curNode->pParent)
-                    {
-                        dist = sqrt(tmpSquaredDist);
-                        break;
-                    }
-                }
-                curNode = curNode->pParent;
-            }
+        const float q[3] = { p.x(), p.y(), p.z() };
+        best = bvh.nearest_by_leaf(p, [this, &q](const unsigned* tris, unsigned count, unsigned offset, float& bestSq, size_t& best)
+        {
+            WRG::nearest_in_block(q, leafBlocks[offset / bvh.LEAF_SIZE], tris, count, bestSq, best);
+        }, bestSq, best);
+        assert(best != bvh.NOT_FOUND);
 
-            int sign = determineSign(type, vh->point(), diff, triIdx);
-            dist *= sign;
-        }
+        // once more for the closest point and its feature type
+        return minSquaredDist(p, &best, &best + 1, diff, tri, type);
     }
 
     int ADFOctree::determineSign(int type, const Point_3& p, const Vector_3& diff, size_t triIdx) const
@@ -270,30 +599,51 @@ namespace WR
 
     int ADFOctree::detSignOnEdge(const Point_3& p, const Vector_3& diff, size_t triIdx, int seq) const
     {
-        auto edge = triList[triIdx].fh->facet_begin();
-        for (size_t i = 0; i < seq; i++, edge++);
-
-        Vector_3 normal = (triList[edge->opposite()->facet()->idx].normal + triList[triIdx].normal) / 2.0;
-        if (diff * normal > 0.0) return 1;
+        if (diff * edgeNormals[3 * triIdx + seq] > 0.0) return 1;
         else return -1;
     }
 
     int ADFOctree::detSignOnVertex(const Point_3& p, const Vector_3& diff, size_t triIdx, int seq) const
     {
-        auto edge = triList[triIdx].fh->facet_begin();
-        for (size_t i = 0; i < seq; i++, edge++);
+        if (diff * vertexNormals[3 * triIdx + seq] > 0.0) return 1;
+        else return -1;
+    }
 
-        auto vh = edge->vertex();
-        const size_t dim = vh->degree();
-        auto v_circle = vh->vertex_begin();
-        Vector_3 dir(0, 0, 0);
-        for (size_t i = 0; i < dim; i++, v_circle++)
+    // The halfedge seq of a facet ends at its vertex seq and starts at the
+    // previous one, so it is the edge of region 3, 5, 1 for seq 0, 1, 2. Each
+    // edge gets the sum of its two face normals, each vertex the sum of the
+    // normals of its faces weighted by their angles at it; the sign of diff
+    // against these is correct for any closest point on the feature.
+    void ADFOctree::computePseudoNormals()
+    {
+        edgeNormals = new Vector_3[3 * nTriangles];
+        vertexNormals = new Vector_3[3 * nTriangles];
+
+        for (size_t i = 0; i < nTriangles; i++)
         {
-            auto newDir = v_circle->opposite()->vertex()->point() - vh->point();
-            dir = dir + newDir;
+            const Vector_3& normal = triList[i].normal;
+            auto edge = triList[i].fh->facet_begin();
+            for (size_t seq = 0; seq < 3; seq++, edge++)
+            {
+                auto opp = edge->opposite();
+                edgeNormals[3 * i + seq] = normal + (opp->is_border() ? normal : triList[opp->facet()->idx].normal);
+
+                auto vh = edge->vertex();
+                Vector_3 n(0, 0, 0);
+                auto vc = vh->vertex_begin();
+                for (size_t k = 0; k < vh->degree(); k++, vc++)
+                {
+                    if (vc->is_border()) continue;
+
+                    Vector_3 a = vc->opposite()->vertex()->point() - vh->point();
+                    Vector_3 b = vc->next()->vertex()->point() - vh->point();
+                    double cosA = (a * b) / sqrt(a.squared_length() * b.squared_length());
+                    double angle = acos(std::max(-1.0, std::min(1.0, cosA)));
+                    n = n + float(angle) * triList[vc->facet()->idx].normal;
+                }
+                vertexNormals[3 * i + seq] = n;
+            }
         }
-        if (diff * dir < 0.0) return 1;
-        else return -1;
     }
 
 
@@ -303,51 +653,23 @@ namespace WR
     {
         assert(begin != end);
 
-        float dist = std::numeric_limits<float>::max();
-        size_t triIdx = 0;
-        int type = 0;
-        float s;
-        float t;
-
-        for (auto eItr = begin; eItr != end; eItr++)
+        size_t triIdx = *begin;
+        if (std::next(begin) != end)
         {
-            WRG::PointTriangleDistResult<K::FT> res;
-            auto &tri = triList[*eItr];
-            tri.computeInfo(p);
-            WRG::squaredDistance(p, tri, tri.infos, res);
-            if (dist > res.dist)
-            {
-                dist = res.dist;
-                type = res.type;
-                s = res.s;
-                t = res.t;
-                triIdx = *eItr;
-            }
+            const float q[3] = { p.x(), p.y(), p.z() };
+            triIdx = WRG::nearest_triangle(q, triList, begin, end);
         }
+
+        // the closest one again for its closest point and feature type
+        WRG::PointTriangleDistResult<K::FT> res;
+        const auto& tri = triList[triIdx];
+        WRG::squaredDistance(p, tri, tri.infoAt(p), res);
         if (diff)
-            *diff = p - (triList[triIdx].vertex(0) + s * triList[triIdx].E0 + t * triList[triIdx].E1);
+            *diff = p - (tri.vertex(0) + res.s * tri.E0 + res.t * tri.E1);
 
         if (pTriIdx) *pTriIdx = triIdx;
-        if (pType) *pType = type;
-        return dist;
-    }
-
-    float ADFOctree::minDist(const Cube_3& bbox, const Point_3& p)
-    {
-        float dist = std::numeric_limits<float>::max();
-
-#define MIN_TEST(d, d0)\
-                    {if ((d) < (d0))\
-        (d0) = (d);}
-
-        MIN_TEST(fabs(bbox.xmax() - p.x()), dist);
-        MIN_TEST(fabs(bbox.xmin() - p.x()), dist);
-        MIN_TEST(fabs(bbox.ymax() - p.y()), dist);
-        MIN_TEST(fabs(bbox.ymin() - p.y()), dist);
-        MIN_TEST(fabs(bbox.zmax() - p.z()), dist);
-        MIN_TEST(fabs(bbox.zmin() - p.z()), dist);
-
-        return dist;
+        if (pType) *pType = res.type;
+        return res.dist;
     }
 
     ADFOctree::Node* ADFOctree::createRootNode(const Polyhedron_3& geom)
@@ -359,18 +681,11 @@ namespace WR
         WR_LOG_INFO << "Bbox size: " << bbox;
 
         WRG::enlarge(bbox, m_box_enlarge_size); // 不希望贴的太紧
-        node->vertices[0] = dt->insert(Point_3(bbox.xmin(), bbox.ymin(), bbox.zmax()));
-        node->vertices[1] = dt->insert(Point_3(bbox.xmin(), bbox.ymax(), bbox.zmax()));
-        node->vertices[2] = dt->insert(Point_3(bbox.xmax(), bbox.ymax(), bbox.zmax()));
-        node->vertices[3] = dt->insert(Point_3(bbox.xmax(), bbox.ymin(), bbox.zmax()));
-
-        node->vertices[4] = dt->insert(Point_3(bbox.xmin(), bbox.ymin(), bbox.zmin()));
-        node->vertices[5] = dt->insert(Point_3(bbox.xmin(), bbox.ymax(), bbox.zmin()));
-        node->vertices[6] = dt->insert(Point_3(bbox.xmax(), bbox.ymax(), bbox.zmin()));
-        node->vertices[7] = dt->insert(Point_3(bbox.xmax(), bbox.ymin(), bbox.zmin()));
 
         node->level = 0;
         node->bbox = bbox;
+        node->cell[0] = node->cell[1] = node->cell[2] = 0;
+        computeTripleFromBbox(node->triple, node->bbox);
 
         for (size_t i = 0; i < nTriangles; i++)
             node->eList.push_back(i);
@@ -380,9 +695,9 @@ namespace WR
 
     ADFOctree::Node* ADFOctree::createNode()
     {
+        // not registered in cellList here, subtrees are built concurrently
         Node* node = new Node;
         memset(node->children, 0, sizeof(node->children));
-        cellList.push_back(node);
         return node;
     }
 
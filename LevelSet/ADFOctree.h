@@ -1,5 +1,7 @@
 ﻿#pragma once
 #include "wrGeo.h"
+#include "wrTriangleBVH.h"
+#include "wrTriangleBlock.h"
 #include "ADFCollisionObject.h"
 #include "wrMacro.h"
 //#include <CGAL\Delaunay_Triangulation_3.h>
@@ -11,6 +13,8 @@
 
 namespace WR
 {
+    class ADFLinearOctree;
+
     template <class Refs, class Plane>
     struct FaceWithId : public CGAL::HalfedgeDS_face_base<Refs, CGAL::Tag_true, Plane> {
         int idx;
@@ -60,10 +64,18 @@ namespace WR
 
         void computeInfo(const Point_3& p)
         {
+            infos = infoAt(p);
+        }
+
+        // computeInfo without touching the triangle, for concurrent queries
+        Info infoAt(const Point_3& p) const
+        {
+            Info info = infos;
             Vector_3 D = vertex(0) - p;
-            infos.d = E0 * D;
-            infos.e = E1 * D;
-            infos.f = D * D;
+            info.d = E0 * D;
+            info.e = E1 * D;
+            info.f = D * D;
+            return info;
         }
 
         Info                infos;
@@ -85,55 +97,100 @@ namespace WR
 
         struct Node
         {
-            //   0---------1
-            //  /|        /|
-            // 3---------2 |
-            // | |       | |
-            // | |       | |
-            // | 4-------|-5
-            // |/        |/
-            // 7---------6
-            //   
-            //   z
-            //   |
-            //   •----y
-            //  /
-            // x
-
-            DtVh                    vertices[8];
+            // corners and children are in Morton order, x | y << 1 | z << 2
+
+            unsigned                corners[8];     // index into cornerPoints, leaves only
             std::vector<unsigned>   eList;
             size_t                  level;
+            unsigned                cell[3];        // integer position among the nodes of its level
             Cube_3                  bbox, triple;
 
             Node*                   pParent = nullptr;
             Node*                   children[8];
 
+            // adaptive builds only: exact corner distances, and the largest and
+            // summed squared interpolation error at the 19 other lattice points
+            float                   exact[8];
+            bool                    hasExact = false;
+            float                   maxError = -1.f;    // not measured (far field) when negative
+            float                   sqError = 0.f;
+
+            // split by refine(), which leaves its subtree as it is from then on
+            bool                    bRefined = false;
+
             bool hasChild() const { return children[0] == nullptr; }
         };
 
         STATIC_PROPERTY(float, box_enlarge_size);
+        // absolute tolerance of the trilinear interpolation, a positive value
+        // subdivides by error instead of wherever the surface passes. Within
+        // box_enlarge_size of the surface it is scaled down, farther cells stop
+        STATIC_PROPERTY(float, error_tolerance);
 
     public:
         ADFOctree();
         ~ADFOctree();
 
-        bool construct(Polyhedron_3& geom, size_t maxLvl);
+        // the triangulation is only needed by the text export and the queries of
+        // an ADF without octree, the grid points make its insertion the slowest step
+        bool construct(Polyhedron_3& geom, size_t maxLvl, bool withTriangulation = true);
+        // octree only, split down to coarseLvl on the grid of maxLvl; refine()
+        // later takes chosen leaves on to maxLvl
+        bool constructCoarse(Polyhedron_3& geom, size_t coarseLvl, size_t maxLvl);
+        // splits the given leaves, numbered as in the linear octree, and their
+        // neighbours down to the max level and returns how many were split. The
+        // neighbours keep the hanging nodes toward coarse leaves off the given
+        // ones. Known corner distances are kept. Subtrees split before stay as
+        // they are, so touching the same places again splits nothing
+        size_t refine(const std::vector<unsigned>& leaves);
         ADFCollisionObject* releaseAndCreateCollisionObject();
+        // an octree only collision object, the tree is kept for refine()
+        ADFCollisionObject* createCollisionObject(bool countTouches = false) const;
+        ADFLinearOctree* createLinearOctree() const;
         float query_distance(const Point_3& p) const;
         const CGAL::Bbox_3& bbox() const { return box; }
+        // achieved in the band by an adaptive build
+        float max_error() const { return errorMax; }
+        float rms_error() const { return errorRms; }
 
     private:
-        void constructChildren(Node*);
+        // subtrees above PARALLEL_LEVEL are split as concurrent tasks. lattice
+        // is that of the node in adaptive builds, computed when null
+        void constructChildren(Node*, size_t stopLevel, const float* lattice = nullptr);
+        // exact distances on the 3 x 3 x 3 points of the node, x + 3y + 9z, with
+        // the 8 corners taken from corners when given
+        void computeLattice(const Node* node, const float* corners, float* lattice) const;
+        // keeps the exact corners and the error of the node, and tells if the
+        // interpolation misses the tolerance
+        bool needsSubdivide(Node* node, const float* lattice) const;
+        void measureError();
         Node* createNode();
         Node* createRootNode(const Polyhedron_3&);
-
-        void computeMinDistance(Node*);
+        void collectNodes();
+        // the node of the given level covering the cell, or the leaf above it
+        // when the tree is coarser there, null outside the root
+        Node* findLeaf(size_t level, const int* cell) const;
+        // a leaf that refine() may split: not at the max level, crossed by the
+        // surface and not inside a subtree refine() made
+        bool isRefinable(const Node* node) const;
+        // deduplicates the leaf corners on the finest grid and computes the
+        // distances not known from a previous call
+        void computeCorners();
+        void createTriangulation();
+        Point_3 gridPoint(const unsigned* g) const;
+        // angle weighted pseudo-normals of the edges and vertices of triList
+        void computePseudoNormals();
+
+        float computeMinDistance(const Point_3& p, const Node* leaf) const;
+        // squared distance to the nearest triangle, the elements of hint (if any)
+        // give the BVH search a starting bound. Candidates are compared in blocks
+        // of 8 with the SIMD kernel, the result is that of the scalar one
+        float nearestTriangle(const Point_3& p, const Node* hint, Vector_3* diff, size_t* tri, int* type) const;
         int determineSign(int type, const Point_3& p, const Vector_3& diff, size_t triIdx) const;
 
         template <class Iterator>
         float minSquaredDist(const Point_3& p, Iterator begin, Iterator end, Vector_3* diff = nullptr, size_t* tri = nullptr, int* type = nullptr) const;
 
-        float minDist(const Cube_3& bbox, const Point_3& p);
         void computeGradient();
 
         void computeTripleFromBbox(Cube_3&, const Cube_3&) const;
@@ -149,10 +206,23 @@ namespace WR
         size_t                          nMaxLevel = 0;
         Dt*                             dt = nullptr;
 
-        std::vector<Node*>              cellList;
+        std::vector<Node*>              cellList;   // breadth first
         Triangle_3*                     triList = nullptr;
+        CGAL::Bbox_3*                   triBoxes = nullptr;
+        // 3 * triangle + seq, seq as in detSignOnEdge / detSignOnVertex
+        Vector_3*                       edgeNormals = nullptr;
+        Vector_3*                       vertexNormals = nullptr;
+        WRG::TriangleBVH<Triangle_3>    bvh;
+        std::vector<WRG::TriangleBlock8> leafBlocks; // the triangles of each BVH leaf
         size_t                          nTriangles = 0;
         CGAL::Bbox_3                    box;
 
+        std::vector<Point_3>            cornerPoints;
+        std::vector<float>              cornerDists;
+        std::vector<unsigned long long> cornerKeys;     // Morton keys on the finest grid, sorted
+
+        float                           errorMax = 0.f;
+        float                           errorRms = 0.f;
+
     };
 }
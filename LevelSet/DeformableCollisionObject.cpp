@@ -0,0 +1,260 @@
+#include "DeformableCollisionObject.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <map>
+#include <ppl.h>
+#include "wrLogger.h"
+
+namespace WR
+{
+    DeformableCollisionObject::DeformableCollisionObject(const float* positions, size_t nVertices,
+        const unsigned* idx, size_t nTriangles, float cellSize, float band, float margin) :
+        vertices(positions, positions + 3 * nVertices), indices(idx, idx + 3 * nTriangles)
+    {
+        if (!nTriangles)
+            throw std::exception("Empty deformable mesh");
+
+        // edges are matched by their sorted vertex pair
+        neighbours.assign(3 * nTriangles, unsigned(NO_NEIGHBOUR));
+        std::map<std::pair<unsigned, unsigned>, unsigned> edges;
+        for (unsigned e = 0; e < unsigned(3 * nTriangles); e++)
+        {
+            const unsigned t = e / 3, seq = e % 3;
+            unsigned a = indices[3 * t + (seq + 2) % 3], b = indices[3 * t + seq];
+            auto res = edges.insert(std::make_pair(std::make_pair(std::min(a, b), std::max(a, b)), e));
+            if (!res.second)
+            {
+                neighbours[e] = res.first->second / 3;
+                neighbours[res.first->second] = t;
+            }
+        }
+
+        vertexTriStart.assign(nVertices + 1, 0);
+        for (unsigned v : indices)
+            vertexTriStart[v + 1]++;
+        for (size_t v = 0; v < nVertices; v++)
+            vertexTriStart[v + 1] += vertexTriStart[v];
+        vertexTris.resize(indices.size());
+        std::vector<unsigned> fill(vertexTriStart.begin(), vertexTriStart.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++)
+            vertexTris[fill[indices[i]]++] = unsigned(i / 3);
+
+        triList.resize(nTriangles);
+        for (size_t t = 0; t < nTriangles; t++)
+            updateTriangle(t);
+        edgeNormals.resize(3 * nTriangles);
+        for (size_t t = 0; t < nTriangles; t++)
+            updateEdgeNormals(t);
+        vertexNormals.resize(nVertices);
+        for (unsigned v = 0; v < unsigned(nVertices); v++)
+            updateVertexNormal(v);
+
+        bvh.build(triList.data(), nTriangles);
+        leafBlocks.resize(bvh.n_slots() / bvh.LEAF_SIZE);
+        triLeaf.resize(nTriangles);
+        for (size_t i = 0; i < leafBlocks.size(); i++)
+        {
+            packLeaf(i);
+            for (unsigned k = 0; k < bvh.LEAF_SIZE; k++)
+                triLeaf[bvh.indices()[i * bvh.LEAF_SIZE + k]] = unsigned(i);
+        }
+
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (size_t v = 0; v < nVertices; v++)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                lo[i] = std::min(lo[i], positions[3 * v + i]);
+                hi[i] = std::max(hi[i], positions[3 * v + i]);
+            }
+        }
+        CGAL::Bbox_3 box(lo[0] - margin, lo[1] - margin, lo[2] - margin,
+            hi[0] + margin, hi[1] + margin, hi[2] + margin);
+
+        if (!grid.build([this](const Point_3& p){ return exact_distance(p); }, box, cellSize, band))
+            throw std::exception("Failed to build the deformable brick grid");
+    }
+
+    size_t DeformableCollisionObject::update(const float* positions)
+    {
+        const size_t nVertices = n_vertices();
+
+        // triangles around the vertices that moved
+        std::vector<unsigned char> triMoved(triList.size(), 0);
+        std::vector<unsigned> moved;
+        for (size_t v = 0; v < nVertices; v++)
+        {
+            if (std::equal(positions + 3 * v, positions + 3 * v + 3, vertices.begin() + 3 * v))
+                continue;
+            for (unsigned k = vertexTriStart[v]; k < vertexTriStart[v + 1]; k++)
+            {
+                unsigned t = vertexTris[k];
+                if (!triMoved[t])
+                {
+                    triMoved[t] = 1;
+                    moved.push_back(t);
+                }
+            }
+        }
+        if (moved.empty())
+            return 0;
+
+        std::vector<CGAL::Bbox_3> oldBoxes(moved.size());
+        for (size_t i = 0; i < moved.size(); i++)
+            oldBoxes[i] = bandBox(moved[i]);
+
+        std::copy(positions, positions + 3 * nVertices, vertices.begin());
+        concurrency::parallel_for(size_t(0), moved.size(), [&](size_t i)
+        {
+            updateTriangle(moved[i]);
+        });
+
+        // the pseudo-normals change on the moved triangles and their neighbours'
+        // shared edges, and at every vertex of a moved triangle
+        std::vector<unsigned> edgeTris(moved);
+        std::vector<unsigned> touchedVertices;
+        std::vector<unsigned char> vertexTouched(nVertices, 0);
+        for (unsigned t : moved)
+        {
+            for (int seq = 0; seq < 3; seq++)
+            {
+                unsigned n = neighbours[3 * t + seq];
+                if (n != NO_NEIGHBOUR && !triMoved[n])
+                {
+                    triMoved[n] = 2;
+                    edgeTris.push_back(n);
+                }
+
+                unsigned v = indices[3 * t + seq];
+                if (!vertexTouched[v])
+                {
+                    vertexTouched[v] = 1;
+                    touchedVertices.push_back(v);
+                }
+            }
+        }
+        concurrency::parallel_for(size_t(0), edgeTris.size(), [&](size_t i)
+        {
+            updateEdgeNormals(edgeTris[i]);
+        });
+        concurrency::parallel_for(size_t(0), touchedVertices.size(), [&](size_t i)
+        {
+            updateVertexNormal(touchedVertices[i]);
+        });
+
+        bvh.refit(triList.data());
+        std::vector<unsigned> leaves;
+        for (unsigned t : moved)
+            leaves.push_back(triLeaf[t]);
+        std::sort(leaves.begin(), leaves.end());
+        leaves.erase(std::unique(leaves.begin(), leaves.end()), leaves.end());
+        for (unsigned leaf : leaves)
+            packLeaf(leaf);
+
+        // the band over the box swept by each moved triangle, so that bricks the
+        // surface passed through flip their sign as well
+        std::vector<size_t> bricks;
+        for (size_t i = 0; i < moved.size(); i++)
+            grid.bricks_in(oldBoxes[i] + bandBox(moved[i]), bricks);
+        std::sort(bricks.begin(), bricks.end());
+        bricks.erase(std::unique(bricks.begin(), bricks.end()), bricks.end());
+
+        grid.update([this](const Point_3& p){ return exact_distance(p); }, bricks);
+        return bricks.size();
+    }
+
+    float DeformableCollisionObject::exact_distance(const Point_3& p) const
+    {
+        const float q[3] = { p.x(), p.y(), p.z() };
+        float bestSq = FLT_MAX;
+        size_t best = bvh.nearest_by_leaf(p, [this, &q](const unsigned* tris, unsigned count, unsigned offset, float& bestSq, size_t& best)
+        {
+            WRG::nearest_in_block(q, leafBlocks[offset / bvh.LEAF_SIZE], tris, count, bestSq, best);
+        }, bestSq);
+        assert(best != bvh.NOT_FOUND);
+
+        // once more for the closest point and its feature type
+        WRG::PointTriangleDistResult<K::FT> res;
+        const Triangle_3& tri = triList[best];
+        WRG::squaredDistance(p, tri, tri.infoAt(p), res);
+        Vector_3 diff = p - (tri.vertex(0) + res.s * tri.E0 + res.t * tri.E1);
+
+        float d = std::sqrt(res.dist);
+        return diff * pseudoNormal(best, res.type) > 0.f ? d : -d;
+    }
+
+    const DeformableCollisionObject::Vector_3& DeformableCollisionObject::pseudoNormal(size_t t, int type) const
+    {
+        switch (type)
+        {
+        case 0:
+            return triList[t].normal;
+        case 1:
+            return edgeNormals[3 * t + 2];
+        case 3:
+            return edgeNormals[3 * t];
+        case 5:
+            return edgeNormals[3 * t + 1];
+        case 2:
+            return vertexNormals[indices[3 * t + 2]];
+        case 4:
+            return vertexNormals[indices[3 * t]];
+        case 6:
+            return vertexNormals[indices[3 * t + 1]];
+        default:
+            throw std::exception("unexpected type.");
+        }
+    }
+
+    void DeformableCollisionObject::updateTriangle(size_t t)
+    {
+        Triangle_3& tri = triList[t];
+        tri = Triangle_3(vertex(indices[3 * t]), vertex(indices[3 * t + 1]), vertex(indices[3 * t + 2]));
+        tri.initInfo();
+    }
+
+    // the sum of both face normals, the own one twice on a border
+    void DeformableCollisionObject::updateEdgeNormals(size_t t)
+    {
+        const Vector_3& normal = triList[t].normal;
+        for (int seq = 0; seq < 3; seq++)
+        {
+            unsigned n = neighbours[3 * t + seq];
+            edgeNormals[3 * t + seq] = normal + (n == NO_NEIGHBOUR ? normal : triList[n].normal);
+        }
+    }
+
+    // the normals of the faces around v weighted by their angles at it
+    void DeformableCollisionObject::updateVertexNormal(unsigned v)
+    {
+        const Point_3 p = vertex(v);
+        Vector_3 n(0, 0, 0);
+        for (unsigned k = vertexTriStart[v]; k < vertexTriStart[v + 1]; k++)
+        {
+            const unsigned t = vertexTris[k];
+            int seq = 0;
+            while (indices[3 * t + seq] != v) seq++;
+
+            Vector_3 a = vertex(indices[3 * t + (seq + 1) % 3]) - p;
+            Vector_3 b = vertex(indices[3 * t + (seq + 2) % 3]) - p;
+            double cosA = (a * b) / sqrt(a.squared_length() * b.squared_length());
+            double angle = acos(std::max(-1.0, std::min(1.0, cosA)));
+            n = n + float(angle) * triList[t].normal;
+        }
+        vertexNormals[v] = n;
+    }
+
+    void DeformableCollisionObject::packLeaf(size_t leaf)
+    {
+        WRG::pack_triangles(triList.data(), bvh.indices() + leaf * bvh.LEAF_SIZE, bvh.LEAF_SIZE, leafBlocks[leaf]);
+    }
+
+    CGAL::Bbox_3 DeformableCollisionObject::bandBox(size_t t) const
+    {
+        CGAL::Bbox_3 box = triList[t].bbox();
+        const double band = grid.get_band();
+        return CGAL::Bbox_3(box.xmin() - band, box.ymin() - band, box.zmin() - band,
+            box.xmax() + band, box.ymax() + band, box.zmax() + band);
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "ICollisionObject.h"
+#include "ADFOctree.h"
+#include "ADFBrickGrid.h"
+#include <vector>
+
+namespace WR
+{
+    // Narrow band distance of a deforming triangle mesh. The topology is fixed
+    // at construction and every update brings new positions for all vertices:
+    // the triangle BVH is refitted bottom up and only the bricks within the
+    // band of a triangle that moved, over the box swept from its old to its new
+    // place, are resampled from the exact mesh distance. Queries go to the brick
+    // grid and must not overlap an update. With the hairs stepped on
+    // SimulationRunner threads, the update runs with every runner that queries
+    // it held, inside nested exclusive() calls.
+    class DeformableCollisionObject :
+        public ICollisionObject
+    {
+        typedef TriangleWithInfos<K>        Triangle_3;
+
+    public:
+        // positions holds xyz per vertex, indices three vertices per triangle.
+        // The grid covers the bounding box of the mesh enlarged by margin, which
+        // the deformed mesh has to stay in.
+        DeformableCollisionObject(const float* positions, size_t nVertices, const unsigned* indices, size_t nTriangles,
+            float cellSize, float band, float margin);
+        ~DeformableCollisionObject() {}
+
+        // new positions of all vertices, returns the number of bricks resampled
+        size_t update(const float* positions);
+
+        virtual float query_distance(const Point_3& p) const { return grid.query_distance(p); }
+        virtual float query_squared_distance(const Point_3& p) const { return grid.query_squared_distance(p); }
+        virtual bool exceed_threshhold(const Point_3& p, float thresh = 0.f) const { return grid.exceed_threshhold(p, thresh); }
+        virtual bool position_correlation(const Point_3& p, Point_3* pCorrect, float thresh = 0.f) const { return grid.position_correlation(p, pCorrect, thresh); }
+        virtual void query_batch(CollisionBatch& b) const { grid.query_batch(b); }
+
+        // signed distance to the current mesh, which the bricks are sampled from
+        float exact_distance(const Point_3& p) const;
+
+        size_t n_vertices() const { return vertices.size() / 3; }
+        size_t n_triangles() const { return triList.size(); }
+        const BrickGridCollisionObject& get_grid() const { return grid; }
+
+    private:
+        static const unsigned NO_NEIGHBOUR = unsigned(-1);
+
+        Point_3 vertex(unsigned v) const { return Point_3(vertices[3 * v], vertices[3 * v + 1], vertices[3 * v + 2]); }
+        void updateTriangle(size_t t);
+        void updateEdgeNormals(size_t t);
+        void updateVertexNormal(unsigned v);
+        const Vector_3& pseudoNormal(size_t t, int type) const;
+        void packLeaf(size_t leaf);
+        CGAL::Bbox_3 bandBox(size_t t) const;
+
+        std::vector<float>          vertices;
+        std::vector<unsigned>       indices;        // three per triangle
+        // triangle across edge seq, which runs from vertex seq + 2 to vertex seq
+        std::vector<unsigned>       neighbours;
+        std::vector<unsigned>       vertexTriStart; // triangles around vertex v are
+        std::vector<unsigned>       vertexTris;     // vertexTris[vertexTriStart[v]..vertexTriStart[v + 1])
+
+        std::vector<Triangle_3>     triList;
+        std::vector<Vector_3>       edgeNormals;    // three per triangle
+        std::vector<Vector_3>       vertexNormals;
+
+        WRG::TriangleBVH<Triangle_3>        bvh;
+        std::vector<WRG::TriangleBlock8>    leafBlocks;
+        std::vector<unsigned>               triLeaf;
+
+        BrickGridCollisionObject    grid;
+    };
+}
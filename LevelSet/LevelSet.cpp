@@ -1,10 +1,13 @@
 #include "UnitTest.h"
 #include <boost/foreach.hpp>
 #include <CGAL/point_generators_3.h>
+#include <CGAL\bounding_box.h>
 #include "LevelSet.h"
+#include "ADFBrickGrid.h"
 #include "ConfigReader.h"
 #include "wrMath.h"
 #include <vector>
+#include <unordered_map>
 #include <fstream>
 
 #include <limits>
@@ -34,7 +37,7 @@ namespace WR
     ICollisionObject* createCollisionObject(Polyhedron_3_FaceWithId& poly)
     {
         ADFOctree* pTree = new ADFOctree;
-        pTree->construct(poly, 2);
+        pTree->construct(poly, 2, false);
         ICollisionObject* pCO = pTree->releaseAndCreateCollisionObject();
         delete pTree;
         return pCO;
@@ -45,6 +48,86 @@ namespace WR
         return new ADFCollisionObject(fileName);
     }
 
+    // loads the ADF and bakes it into a brick grid with resolution cells along
+    // the longest axis and a band of 4 cells, the ADF itself is dropped
+    ICollisionObject* loadBakedCollisionObject(const wchar_t* fileName, size_t resolution)
+    {
+        ADFCollisionObject adf(fileName);
+
+        // the ADF bbox is the tight model bbox, its triangulation reaches further
+        // by the octree box gap which max_step is derived from
+        const float gap = adf.get_max_step();
+        const CGAL::Bbox_3 tight = adf.get_bbox().bbox();
+        CGAL::Bbox_3 box(tight.xmin() - gap, tight.ymin() - gap, tight.zmin() - gap,
+            tight.xmax() + gap, tight.ymax() + gap, tight.zmax() + gap);
+
+        float extent = float(std::max(box.xmax() - box.xmin(), std::max(box.ymax() - box.ymin(), box.zmax() - box.zmin())));
+        float cell = extent / resolution;
+
+        BrickGridCollisionObject* pCO = new BrickGridCollisionObject;
+        bool ok = pCO->build([&adf](const Point& p){ return adf.query_distance(p); },
+            box, cell, 4.f * cell);
+        if (!ok)
+        {
+            delete pCO;
+            return nullptr;
+        }
+        return pCO;
+    }
+
+    ADFLazyCollisionObject* createLazyCollisionObject(const wchar_t* fileName, size_t maxLevel)
+    {
+        Polyhedron_3_FaceWithId* pModel = WRG::readFile<Polyhedron_3_FaceWithId>(fileName);
+        assert(pModel);
+        ADFLazyCollisionObject* pCO = new ADFLazyCollisionObject(*pModel, maxLevel);
+        delete pModel;
+        return pCO;
+    }
+
+    CGAL::Bbox_3 readTriangleMesh(const wchar_t* fileName, std::vector<float>& positions, std::vector<unsigned>& indices)
+    {
+        Polyhedron_3_FaceWithId* pModel = WRG::readFile<Polyhedron_3_FaceWithId>(fileName);
+        assert(pModel);
+
+        positions.clear();
+        std::unordered_map<const void*, unsigned> vertexIds;
+        for (auto v = pModel->vertices_begin(); v != pModel->vertices_end(); ++v)
+        {
+            vertexIds[&*v] = unsigned(positions.size() / 3);
+            positions.push_back(v->point().x());
+            positions.push_back(v->point().y());
+            positions.push_back(v->point().z());
+        }
+
+        indices.clear();
+        for (auto f = pModel->facets_begin(); f != pModel->facets_end(); ++f)
+        {
+            assert(f->is_triangle());
+            auto h = f->facet_begin();
+            for (int k = 0; k < 3; k++, ++h)
+                indices.push_back(vertexIds[&*h->vertex()]);
+        }
+
+        CGAL::Bbox_3 box = CGAL::bounding_box(pModel->points_begin(), pModel->points_end()).bbox();
+        delete pModel;
+        return box;
+    }
+
+    // resolution cells along the longest axis, a band of 4 cells, and room for
+    // the mesh to move by a tenth of its size
+    DeformableCollisionObject* createDeformableCollisionObject(const wchar_t* fileName, size_t resolution)
+    {
+        std::vector<float> positions;
+        std::vector<unsigned> indices;
+        CGAL::Bbox_3 box = readTriangleMesh(fileName, positions, indices);
+
+        float extent = float(std::max(box.xmax() - box.xmin(), std::max(box.ymax() - box.ymin(), box.zmax() - box.zmin())));
+        float margin = 0.1f * extent;
+        float cell = (extent + 2.f * margin) / resolution;
+        return new DeformableCollisionObject(positions.data(), positions.size() / 3, indices.data(), indices.size() / 3,
+            cell, 4.f * cell, margin);
+    }
+
     ICollisionObject* createCollisionObject(const wchar_t* fileName)
     {
         Polyhedron_3_FaceWithId* pModel = WRG::readFile<Polyhedron_3_FaceWithId>(fileName);
@@ -77,8 +160,10 @@ namespace WR
         bool loadArray = std::stoi(reader.getValue("loadtest"));
         float tmp = std::stof(reader.getValue("boxgap"));
         bool regen = std::stoi(reader.getValue("regenmodel"));
+        float tolerance = std::stof(reader.getValue("adferror"));
 
         ADFOctree::set_box_enlarge_size(tmp);
+        ADFOctree::set_error_tolerance(tolerance);
 
         Polyhedron_3_FaceWithId* pModel = WRG::readFile<Polyhedron_3_FaceWithId>(fileName);
         assert(pModel);
@@ -89,7 +174,7 @@ namespace WR
         if (regen)
         {
             ADFOctree* pTree = new ADFOctree;
-            pTree->construct(*pModel, level);
+            pTree->construct(*pModel, level, false);
             pCO = pTree->releaseAndCreateCollisionObject();
             delete pTree;
         }
@@ -1,13 +1,25 @@
 #pragma once
 #include "wrGeo.h"
 #include "ADFOctree.h"
+#include "ADFLazyCollisionObject.h"
+#include "DeformableCollisionObject.h"
 #include <CGAL\Polyhedron_3.h>
+#include <vector>
 
 namespace WR
 {
     ICollisionObject* createCollisionObject(Polyhedron_3_FaceWithId& poly);
     ICollisionObject* createCollisionObject(const wchar_t* fileName);
     ICollisionObject* loadCollisionObject(const wchar_t* fileName);
+    ICollisionObject* loadBakedCollisionObject(const wchar_t* fileName, size_t resolution);
+    // ADF of the polyhedron in fileName that is refined up to maxLevel only where queried
+    ADFLazyCollisionObject* createLazyCollisionObject(const wchar_t* fileName, size_t maxLevel);
+    // vertices (xyz each) and triangles (three vertex indices each) of the
+    // polyhedron in fileName, returns its bounding box
+    CGAL::Bbox_3 readTriangleMesh(const wchar_t* fileName, std::vector<float>& positions, std::vector<unsigned>& indices);
+    // brick grid of the triangle mesh in fileName that follows updates of its
+    // vertex positions, given in the order of the file
+    DeformableCollisionObject* createDeformableCollisionObject(const wchar_t* fileName, size_t resolution);
     void runLevelSetBenchMark(const wchar_t* fileName);
 
 }
\ No newline at end of file